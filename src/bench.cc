@@ -0,0 +1,279 @@
+/*
+  Copyright 2026  Jeff Abrahamson
+
+  This file is part of srd.
+
+  srd is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  srd is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with srd.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+  Time the stages of loading and committing, and end-to-end queries
+  over generated databases, and write the results as JSON.
+
+  Usage:  srd_bench [-o file.json] [leaf count ...]
+
+  The JSON goes to bench.json unless we're told otherwise.  Databases
+  live in the test directory (cf. make clean-test).
+*/
+
+#include <chrono>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <stdlib.h>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "srd.h"
+#include "test_text.h"
+
+using namespace srd;
+using namespace std;
+
+namespace {
+
+struct Result {
+  string name;
+  uint64_t iterations;
+  double seconds; // Per iteration.
+  uint64_t bytes; // Per iteration, or 0 if not meaningful.
+};
+
+vector<Result> results;
+
+/*
+  Run fn at least once and until min_seconds have passed, and record
+  the mean time per run.
+*/
+void bench(const string &name, const uint64_t bytes,
+           const function<void()> &fn, const double min_seconds = 0.5) {
+  typedef chrono::steady_clock Clock;
+  uint64_t iterations = 0;
+  Clock::time_point start = Clock::now();
+  double elapsed = 0;
+  do {
+    fn();
+    ++iterations;
+    elapsed = chrono::duration<double>(Clock::now() - start).count();
+  } while (elapsed < min_seconds);
+  Result result = {name, iterations, elapsed / iterations, bytes};
+  results.push_back(result);
+  cerr << name << ":  " << result.seconds * 1e6 << " us" << endl;
+}
+
+/*
+  About size bytes of text, made of our test messages.
+*/
+string sample_text(const size_t size) {
+  vector_string messages = test_text();
+  string text;
+  for (size_t i = 0; text.size() < size; ++i)
+    text += messages[i % messages.size()];
+  text.resize(size);
+  return text;
+}
+
+void bench_compression(const string &text) {
+  const Codec codecs[] = {Bzip2, Zstd, Lz4};
+  const char *names[] = {"bzip2", "zstd", "lz4"};
+  for (size_t i = 0; i < sizeof(codecs) / sizeof(codecs[0]); ++i) {
+    if (!codec_available(codecs[i]))
+      continue;
+    string compressed = compress(text, codecs[i]);
+    bench(string("compress/") + names[i], text.size(),
+          [&]() { compress(text, codecs[i]); });
+    bench(string("decompress/") + names[i], text.size(),
+          [&]() { decompress(compressed); });
+  }
+}
+
+void bench_encryption(const string &text) {
+  const string password = message_digest("bench");
+  CipherContext cipher(password);
+  string cipher_text = cipher.encrypt(text);
+  bool legacy;
+  bench("encrypt", text.size(), [&]() { cipher.encrypt(text); });
+  bench("decrypt", text.size(), [&]() {
+    cipher.decrypt(cipher_text.data(), cipher_text.size(), legacy);
+  });
+  // What every leaf paid before there was a CipherContext.
+  bench("decrypt/one-off", text.size(),
+        [&]() { decrypt(cipher_text, password); });
+  bench("message_digest", password.size(),
+        [&]() { message_digest(password); });
+}
+
+void bench_protobuf(const string &text, const size_t leaf_count) {
+  LeafData leaf_data;
+  leaf_data.set_key("a key of modest length");
+  leaf_data.set_payload(text);
+  string leaf_bytes;
+  leaf_data.SerializeToString(&leaf_bytes);
+  bench("leaf_data/serialize", leaf_bytes.size(),
+        [&]() { leaf_data.SerializeToString(&leaf_bytes); });
+  bench("leaf_data/parse", leaf_bytes.size(),
+        [&]() { leaf_data.ParseFromString(leaf_bytes); });
+
+  RootData root_data;
+  for (size_t i = 0; i < leaf_count; ++i) {
+    ostringstream key;
+    key << "key-" << i;
+    RootData_KeyData *key_data = root_data.add_keys();
+    key_data->set_proxy_name(message_digest(key.str(), true));
+    key_data->set_cached_key(key.str());
+  }
+  string root_bytes;
+  root_data.SerializeToString(&root_bytes);
+  ostringstream suffix;
+  suffix << "/keys=" << leaf_count;
+  bench("root_data/serialize" + suffix.str(), root_bytes.size(),
+        [&]() { root_data.SerializeToString(&root_bytes); });
+  bench("root_data/parse" + suffix.str(), root_bytes.size(),
+        [&]() { root_data.ParseFromString(root_bytes); });
+}
+
+void bench_file(const string &text) {
+  File file("bench-file", "");
+  string data(text);
+  bench("file/write", text.size(), [&]() { file.file_contents(data); });
+  bench("file/read", text.size(), [&]() { file.file_contents(); });
+  bench("file/view", text.size(), [&]() { file.file_view(); });
+  file.rm();
+}
+
+/*
+  Build a database of leaf_count leaves of a few hundred bytes each,
+  then time loading its root and searching every payload.
+*/
+void bench_database(const size_t leaf_count) {
+  ostringstream suffix;
+  suffix << "/leaves=" << leaf_count;
+  ostringstream pass;
+  pass << "bench-" << getpid() << "-" << leaf_count;
+  const string password = message_digest(pass.str());
+  vector_string messages = test_text();
+  {
+    Root root(password, "", true);
+    RootBatch batch(root);
+    for (size_t i = 0; i < leaf_count; ++i) {
+      ostringstream key;
+      key << "key-" << i;
+      batch.add_leaf(key.str(), messages[i % messages.size()] + key.str());
+    }
+    bench("database/build" + suffix.str(), 0, [&]() { batch.commit(); }, 0);
+  }
+
+  bench("root/load" + suffix.str(), 0, [&]() { Root root(password, ""); });
+
+  Root root(password, "");
+  const vector_string pattern(1, "no such text");
+  const size_t budget = leaf_cache().budget();
+  const unsigned int workers = worker_count();
+  // Cold:  every leaf is read, decrypted and decompressed.
+  bench("filter_payloads/cold" + suffix.str(), 0, [&]() {
+    leaf_cache().clear();
+    for (Root::iterator it = root.begin(); it != root.end(); ++it)
+      it->second.unload();
+    root.filter_payloads(pattern, false, IdentStringMatcher());
+  });
+  worker_count(0);
+  ostringstream jobs;
+  jobs << "/jobs=" << worker_count();
+  bench("filter_payloads/cold" + suffix.str() + jobs.str(), 0, [&]() {
+    leaf_cache().clear();
+    for (Root::iterator it = root.begin(); it != root.end(); ++it)
+      it->second.unload();
+    root.filter_payloads(pattern, false, IdentStringMatcher());
+  });
+  worker_count(workers);
+  // Warm:  leaves come from the cache, if it can hold them all.
+  leaf_cache().budget(256 * 1024 * 1024);
+  bench("filter_payloads/warm" + suffix.str(), 0, [&]() {
+    root.filter_payloads(pattern, false, IdentStringMatcher());
+  });
+  leaf_cache().budget(budget);
+}
+
+/*
+  JSON strings here are our own benchmark names, so there's nothing
+  to escape but quotes and backslashes.
+*/
+string json_string(const string &in) {
+  string out("\"");
+  for (size_t i = 0; i < in.size(); ++i) {
+    if ('"' == in[i] || '\\' == in[i])
+      out += '\\';
+    out += in[i];
+  }
+  return out + "\"";
+}
+
+void write_json(ostream &out) {
+  out << "{" << endl;
+  out << "  \"workers\": " << worker_count() << "," << endl;
+  out << "  \"results\": [" << endl;
+  for (size_t i = 0; i < results.size(); ++i) {
+    const Result &r = results[i];
+    out << "    {\"name\": " << json_string(r.name)
+        << ", \"iterations\": " << r.iterations
+        << ", \"seconds\": " << r.seconds;
+    if (r.bytes)
+      out << ", \"bytes\": " << r.bytes
+          << ", \"bytes_per_second\": " << r.bytes / r.seconds;
+    out << "}" << (i + 1 < results.size() ? "," : "") << endl;
+  }
+  out << "  ]" << endl;
+  out << "}" << endl;
+}
+}
+
+int main(int argc, char *argv[]) {
+  mode(Verbose, false);
+  mode(Testing, true);
+  mode(ReadOnly, false);
+
+  string output("bench.json");
+  vector<size_t> leaf_counts;
+  for (int i = 1; i < argc; ++i) {
+    if (string("-o") == argv[i] && i + 1 < argc)
+      output = argv[++i];
+    else
+      leaf_counts.push_back(strtoul(argv[i], NULL, 10));
+  }
+  if (leaf_counts.empty()) {
+    leaf_counts.push_back(1000);
+    leaf_counts.push_back(10000);
+    leaf_counts.push_back(100000);
+  }
+
+  try {
+    const string text = sample_text(16 * 1024);
+    bench_compression(text);
+    bench_encryption(text);
+    bench_protobuf(text, 10000);
+    bench_file(text);
+    for (size_t i = 0; i < leaf_counts.size(); ++i)
+      bench_database(leaf_counts[i]);
+  } catch (const exception &e) {
+    cerr << "Benchmark failed:  " << e.what() << endl;
+    return 1;
+  }
+
+  ofstream out(output.c_str());
+  write_json(out);
+  return out ? 0 : 1;
+}
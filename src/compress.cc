@@ -17,10 +17,20 @@
   along with srd.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <algorithm>
 #include <bzlib.h>
+#include <climits>
 #include <iostream>
 #include <stdexcept>
+#include <string.h>
 #include <string>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+#ifdef HAVE_LZ4
+#include <lz4.h>
+#include <lz4hc.h>
+#endif
 
 #include "srd.h"
 
@@ -28,111 +38,89 @@ using namespace srd;
 using namespace std;
 
 /*
-  The bzip2 package is documented at
+  Compressed data begins with a byte that says which codec made it,
+  with SizeFlag set when the exact uncompressed size follows as a
+  varint.  Knowing the size, we decompress once, into a buffer of
+  just the right size.  What follows is the codec's own format.
 
-  http://www.bzip.org/1.0.3/html/index.html
+  Data written before there were other codecs is bare bzip2, which
+  begins with the magic "BZh".  We don't know its size, so we
+  stream it.
 */
 
+namespace {
+Codec the_codec = Bzip2;
+int the_level = 0;
+
+const unsigned char SizeFlag = 0x80;
+const uint64_t UnknownSize = ~static_cast<uint64_t>(0);
+
 /*
-  Compress a string.
+  Lengths are written as varints:  seven bits per byte, least
+  significant first, high bit set on all but the last byte.
 */
-string srd::compress(const string &in_buf) {
-  // As documented at http://www.bzip.org/1.0.3/html/util-fns.html
-  unsigned int output_max_size =
-      static_cast<double>(in_buf.size()) * 1.06 + 600.5;
-  char out_buf_raw[output_max_size];
-
-  // For argument definitions, cf.
-  //   http://www.bzip.org/1.0.3/html/util-fns.html#bzbufftobuffdecompress
-  // and also
-  //   http://www.bzip.org/1.0.3/html/low-level.html#bzcompress-init
-  //
-  // Source string is not changed, one understands, but the C origin means
-  // a char * rather than a const char *.  So const_cast.
-  int ret = BZ2_bzBuffToBuffCompress(out_buf_raw, &output_max_size,
-                                     const_cast<char *>(in_buf.c_str()),
-                                     in_buf.size(),
-                                     1, // blockSize100k, in the range 1..9
-                                     (const bool)mode(Verbose),
-                                     0 // workFactor
-                                     );
-  string the_error;
-  switch (ret) {
-  case BZ_CONFIG_ERROR:
-    the_error = "The bzip2 library has been mis-compiled.";
-    cerr << the_error << endl;
-    throw(runtime_error(the_error));
-  case BZ_PARAM_ERROR:
-    the_error = "Parameter error in BZ2_bzBuffToBuffCompress";
-    cerr << the_error << endl;
-    cerr << "Cf. "
-            "http://www.bzip.org/1.0.3/html/util-fns.html#bzbufftobuffcompress"
-         << endl;
-    throw(invalid_argument(the_error));
-  case BZ_MEM_ERROR:
-    the_error = "Insufficient memory available for compression";
-    cerr << the_error << endl;
-    throw(length_error(the_error));
-  case BZ_OUTBUFF_FULL:
-    the_error = "The size of the compressed data exceeds *destLen";
-    cerr << the_error << endl;
-    throw(length_error(the_error));
-  case BZ_OK:
-    break;
-  default:
-    the_error = "Unexpected return from BZ2_bzBuffToBuffCompress";
-    cerr << the_error << endl;
-    throw(logic_error(the_error));
-  };
+void put_varint(string &out, uint64_t n) {
+  while (n >= 0x80) {
+    out += static_cast<char>(0x80 | (n & 0x7F));
+    n >>= 7;
+  }
+  out += static_cast<char>(n);
+}
 
-  string out_buf(out_buf_raw, output_max_size);
-  return (out_buf);
+uint64_t get_varint(const string &in, size_t &pos) {
+  uint64_t n = 0;
+  for (int shift = 0; shift < 64; shift += 7) {
+    if (pos >= in.size())
+      throw(domain_error("Compressed data ends unexpectedly."));
+    unsigned char byte = in[pos++];
+    n |= static_cast<uint64_t>(byte & 0x7F) << shift;
+    if (!(byte & 0x80))
+      return n;
+  }
+  throw(domain_error("Corrupt length in compressed data."));
 }
 
 /*
-  Decompress a string.
+  Return the start of a frame of size bytes compressed with codec.
 */
-string srd::decompress(const string &in_buf,
-                       unsigned int uncompressed_size_hint) {
-  if (0 == uncompressed_size_hint)
-    uncompressed_size_hint = 5 * in_buf.size();
-  char out_buf_raw[uncompressed_size_hint];
+string frame_header(const Codec codec, const uint64_t size) {
+  string header(1, static_cast<char>(codec | SizeFlag));
+  put_varint(header, size);
+  return header;
+}
 
-  // For argument definitions, cf.
-  //   http://www.bzip.org/1.0.3/html/util-fns.html#bzbufftobuffdecompress
-  // and also
-  //   http://www.bzip.org/1.0.3/html/low-level.html#bzDecompress-init
-  //
-  // Source string is not changed, one understands, but the C origin means
-  // a char * rather than a const char *.  So const_cast.
-  int ret = BZ2_bzBuffToBuffDecompress(out_buf_raw, &uncompressed_size_hint,
-                                       const_cast<char *>(in_buf.c_str()),
-                                       in_buf.size(),
-                                       false, // small is false: else slower
-                                       mode(Verbose));
+/*
+  The bzip2 package is documented at
 
+  http://www.bzip.org/1.0.3/html/index.html
+*/
+
+/*
+  Throw if ret, returned by the bzip2 function called function, is
+  an error.
+*/
+void bzip2_check(const int ret, const string &function) {
   string the_error;
   switch (ret) {
+  case BZ_OK:
+  case BZ_STREAM_END:
+    return;
   case BZ_CONFIG_ERROR:
     the_error = "The bzip2 library has been mis-compiled.";
     cerr << the_error << endl;
     throw(runtime_error(the_error));
   case BZ_PARAM_ERROR:
-    the_error = "Parameter error in BZ2_bzBuffToBuffDecompress";
+    the_error = "Parameter error in " + function;
     cerr << the_error << endl;
-    cerr << "Cf. "
-            "http://www.bzip.org/1.0.3/html/"
-            "util-fns.html#bzbufftobuffdecompress"
-         << endl;
     throw(invalid_argument(the_error));
   case BZ_MEM_ERROR:
-    the_error = "Insufficient memory available for decompression";
+    the_error = "Insufficient memory available for bzip2";
     cerr << the_error << endl;
     throw(length_error(the_error));
   case BZ_OUTBUFF_FULL:
-    cout << "The size of the compressed data exceeds *destLen, trying *= 2."
-         << endl;
-    return decompress(in_buf, 2 * uncompressed_size_hint);
+    the_error = "The size of the bzip2 output exceeds *destLen";
+    cerr << the_error << endl;
+    throw(length_error(the_error));
   case BZ_DATA_ERROR:
     the_error = "Data integrity error was detected in the compressed data.";
     cerr << the_error << endl;
@@ -145,14 +133,302 @@ string srd::decompress(const string &in_buf,
     the_error = "Compressed data ends unexpectedly.";
     cerr << the_error << endl;
     throw(domain_error(the_error));
-  case BZ_OK:
-    break;
   default:
-    the_error = "Unexpected return from BZ2_bzBuffToBuffDecompress";
+    the_error = "Unexpected return from " + function;
     cerr << the_error << endl;
     throw(logic_error(the_error));
   };
+}
 
-  string out_buf(out_buf_raw, uncompressed_size_hint);
-  return (out_buf);
+/*
+  Compress a string with bzip2.  The level is the block size, in
+  units of 100k, from 1 to 9.
+*/
+string bzip2_compress(const string &in_buf, const int level) {
+  if (in_buf.size() > UINT_MAX / 2)
+    throw(length_error("Too much data for bzip2."));
+  string out_buf = frame_header(Bzip2, in_buf.size());
+  size_t header = out_buf.size();
+  // As documented at http://www.bzip.org/1.0.3/html/util-fns.html
+  unsigned int output_max_size =
+      static_cast<double>(in_buf.size()) * 1.06 + 600.5;
+  out_buf.resize(header + output_max_size);
+
+  // For argument definitions, cf.
+  //   http://www.bzip.org/1.0.3/html/util-fns.html#bzbufftobuffdecompress
+  // and also
+  //   http://www.bzip.org/1.0.3/html/low-level.html#bzcompress-init
+  //
+  // Source string is not changed, one understands, but the C origin means
+  // a char * rather than a const char *.  So const_cast.
+  int ret = BZ2_bzBuffToBuffCompress(&out_buf[header], &output_max_size,
+                                     const_cast<char *>(in_buf.c_str()),
+                                     in_buf.size(),
+                                     level ? level : 1, // blockSize100k, 1..9
+                                     (const bool)mode(Verbose),
+                                     0 // workFactor
+                                     );
+  bzip2_check(ret, "BZ2_bzBuffToBuffCompress");
+  out_buf.resize(header + output_max_size);
+  return out_buf;
+}
+
+/*
+  Decompress the bzip2 stream at pos in in_buf, which we know
+  decompresses to size bytes.
+*/
+string bzip2_decompress(const string &in_buf, const size_t pos,
+                        const uint64_t size) {
+  if (size > UINT_MAX)
+    throw(domain_error("Corrupt length in compressed data."));
+  string out_buf(size, '\0');
+  unsigned int out_size = size;
+  int ret = BZ2_bzBuffToBuffDecompress(&out_buf[0], &out_size,
+                                       const_cast<char *>(in_buf.data() + pos),
+                                       in_buf.size() - pos,
+                                       false, // small is false: else slower
+                                       mode(Verbose));
+  if (BZ_OUTBUFF_FULL == ret || out_size != size)
+    throw(domain_error("Compressed data doesn't match its recorded length."));
+  bzip2_check(ret, "BZ2_bzBuffToBuffDecompress");
+  return out_buf;
+}
+
+/*
+  Decompress the bzip2 stream at pos in in_buf, whose size we don't
+  know.  Start with a buffer of hint bytes (or a guess) and grow it
+  as we go, which costs copies but never repeats decompression.
+*/
+string bzip2_decompress_stream(const string &in_buf, const size_t pos,
+                               const size_t hint) {
+  // Cf. http://www.bzip.org/1.0.3/html/low-level.html#bzDecompress-init
+  bz_stream stream;
+  memset(&stream, 0, sizeof(stream));
+  bzip2_check(BZ2_bzDecompressInit(&stream, mode(Verbose), 0),
+              "BZ2_bzDecompressInit");
+  stream.next_in = const_cast<char *>(in_buf.data() + pos);
+  stream.avail_in = in_buf.size() - pos;
+
+  string out_buf(max(hint ? hint : 4 * in_buf.size(), size_t(64)), '\0');
+  size_t done = 0;
+  int ret;
+  for (;;) {
+    if (done == out_buf.size())
+      out_buf.resize(2 * out_buf.size());
+    unsigned int room = min(out_buf.size() - done, size_t(UINT_MAX));
+    stream.next_out = &out_buf[done];
+    stream.avail_out = room;
+    ret = BZ2_bzDecompress(&stream);
+    done += room - stream.avail_out;
+    if (BZ_OK != ret)
+      break;
+    if (0 == stream.avail_in && 0 != stream.avail_out) {
+      ret = BZ_UNEXPECTED_EOF;
+      break;
+    }
+  }
+  BZ2_bzDecompressEnd(&stream);
+  bzip2_check(ret, "BZ2_bzDecompress");
+  out_buf.resize(done);
+  return out_buf;
+}
+
+#ifdef HAVE_ZSTD
+/*
+  Compress with zstd.  Level 0 is zstd's default.
+*/
+string zstd_compress(const string &in_buf, const int level) {
+  string out_buf = frame_header(Zstd, in_buf.size());
+  size_t header = out_buf.size();
+  size_t bound = ZSTD_compressBound(in_buf.size());
+  out_buf.resize(header + bound);
+  size_t ret = ZSTD_compress(&out_buf[header], bound, in_buf.data(),
+                             in_buf.size(), level);
+  if (ZSTD_isError(ret))
+    throw(runtime_error(string("zstd compression failed:  ") +
+                        ZSTD_getErrorName(ret)));
+  out_buf.resize(header + ret);
+  return out_buf;
+}
+
+/*
+  Frames written without their size have it in the zstd frame.
+*/
+string zstd_decompress(const string &in_buf, const size_t pos,
+                       uint64_t out_size) {
+  const char *data = in_buf.data() + pos;
+  size_t size = in_buf.size() - pos;
+  if (UnknownSize == out_size) {
+    out_size = ZSTD_getFrameContentSize(data, size);
+    if (ZSTD_CONTENTSIZE_ERROR == out_size ||
+        ZSTD_CONTENTSIZE_UNKNOWN == out_size)
+      throw(domain_error("Corrupt zstd frame."));
+  }
+  string out_buf(out_size, '\0');
+  size_t ret = ZSTD_decompress(&out_buf[0], out_size, data, size);
+  if (ZSTD_isError(ret) || ret != out_size)
+    throw(domain_error(string("zstd decompression failed:  ") +
+                       (ZSTD_isError(ret) ? ZSTD_getErrorName(ret)
+                                          : "wrong size")));
+  return out_buf;
+}
+#endif // HAVE_ZSTD
+
+#ifdef HAVE_LZ4
+/*
+  Compress with lz4.  Level 0 is lz4's fast mode, higher levels (up
+  to 12) use lz4hc.
+*/
+string lz4_compress(const string &in_buf, const int level) {
+  if (in_buf.size() > LZ4_MAX_INPUT_SIZE)
+    throw(length_error("Too much data for lz4."));
+  string out_buf = frame_header(Lz4, in_buf.size());
+  size_t header = out_buf.size();
+  int bound = LZ4_compressBound(in_buf.size());
+  out_buf.resize(header + bound);
+  int ret = level > 0 ? LZ4_compress_HC(in_buf.data(), &out_buf[header],
+                                        in_buf.size(), bound, level)
+                      : LZ4_compress_default(in_buf.data(), &out_buf[header],
+                                             in_buf.size(), bound);
+  if (ret <= 0)
+    throw(runtime_error("lz4 compression failed."));
+  out_buf.resize(header + ret);
+  return out_buf;
+}
+
+/*
+  The lz4 block format doesn't record its size, so lz4 frames always
+  carry it, even those written before SizeFlag existed.
+*/
+string lz4_decompress(const string &in_buf, size_t pos, uint64_t out_size) {
+  if (UnknownSize == out_size)
+    out_size = get_varint(in_buf, pos);
+  if (out_size > LZ4_MAX_INPUT_SIZE)
+    throw(domain_error("Corrupt lz4 length."));
+  string out_buf(out_size, '\0');
+  int ret = LZ4_decompress_safe(in_buf.data() + pos, &out_buf[0],
+                                in_buf.size() - pos, out_size);
+  if (ret < 0 || static_cast<uint64_t>(ret) != out_size)
+    throw(domain_error("lz4 decompression failed."));
+  return out_buf;
+}
+#endif // HAVE_LZ4
+}
+
+/*
+  Return true if we were built with codec.
+*/
+bool srd::codec_available(const Codec codec) {
+  switch (codec) {
+  case Bzip2:
+    return true;
+#ifdef HAVE_ZSTD
+  case Zstd:
+    return true;
+#endif
+#ifdef HAVE_LZ4
+  case Lz4:
+    return true;
+#endif
+  default:
+    return false;
+  }
+}
+
+/*
+  Return the codec called name.
+*/
+Codec srd::codec_named(const string &name) {
+  if ("bzip2" == name)
+    return Bzip2;
+  if ("zstd" == name)
+    return Zstd;
+  if ("lz4" == name)
+    return Lz4;
+  throw(runtime_error("Unknown codec \"" + name +
+                      "\" (expected bzip2, zstd or lz4)."));
+}
+
+/*
+  Choose the codec and level with which compress() compresses.
+*/
+void srd::compression(const Codec codec, const int level) {
+  if (!codec_available(codec))
+    throw(runtime_error("This srd was built without that codec."));
+  the_codec = codec;
+  the_level = level;
+}
+
+Codec srd::compression_codec() { return the_codec; }
+
+int srd::compression_level() { return the_level; }
+
+/*
+  Compress a string with the codec chosen by compression().
+*/
+string srd::compress(const string &in_buf) {
+  return compress(in_buf, the_codec, the_level);
+}
+
+/*
+  Compress a string with codec at level, where 0 means the codec's
+  default.
+*/
+string srd::compress(const string &in_buf, const Codec codec,
+                     const int level) {
+  switch (codec) {
+  case Bzip2:
+    return bzip2_compress(in_buf, level);
+#ifdef HAVE_ZSTD
+  case Zstd:
+    return zstd_compress(in_buf, level);
+#endif
+#ifdef HAVE_LZ4
+  case Lz4:
+    return lz4_compress(in_buf, level);
+#endif
+  default:
+    throw(runtime_error("This srd was built without that codec."));
+  }
+}
+
+/*
+  Decompress a string, whatever codec compressed it.  The hint, if
+  given, is where to start guessing the size of data that doesn't
+  record it.
+*/
+string srd::decompress(const string &in_buf,
+                       unsigned int uncompressed_size_hint) {
+  if (in_buf.empty())
+    throw(domain_error("No compressed data."));
+  StageTimer timer(StageDecompress);
+  timer.bytes(in_buf.size());
+  if ('B' == in_buf[0])
+    return bzip2_decompress_stream(in_buf, 0, uncompressed_size_hint);
+  const unsigned char tag = in_buf[0];
+  size_t pos = 1;
+  const uint64_t size =
+      (tag & SizeFlag) ? get_varint(in_buf, pos) : UnknownSize;
+  switch (tag & ~SizeFlag) {
+  case Bzip2:
+    if (UnknownSize == size)
+      return bzip2_decompress_stream(in_buf, pos, uncompressed_size_hint);
+    return bzip2_decompress(in_buf, pos, size);
+  case Zstd:
+#ifdef HAVE_ZSTD
+    return zstd_decompress(in_buf, pos, size);
+#else
+    throw(runtime_error("Data compressed with zstd, but this srd was built "
+                        "without it."));
+#endif
+  case Lz4:
+#ifdef HAVE_LZ4
+    return lz4_decompress(in_buf, pos, size);
+#else
+    throw(runtime_error("Data compressed with lz4, but this srd was built "
+                        "without it."));
+#endif
+  default:
+    throw(domain_error("Compressed data has an unknown codec tag."));
+  }
 }
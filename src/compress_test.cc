@@ -18,6 +18,7 @@
 */
 
 #include <algorithm>
+#include <bzlib.h>
 #include <iostream>
 #include <pstreams/pstream.h>
 #include <string>
@@ -57,6 +58,117 @@ int test_compress(const string message) {
   return ret;
 }
 
+/*
+  Round trip every message through every codec we have, at a couple
+  of levels, and make sure each says which codec it is.
+*/
+int test_codecs(const vector_string &messages) {
+  int ret = 0;
+  const Codec codecs[] = {Bzip2, Zstd, Lz4};
+  for (const Codec codec : codecs) {
+    if (!codec_available(codec))
+      continue;
+    for (int level = 0; level < 4; level += 3)
+      for (vector_string::const_iterator it = messages.begin();
+           it != messages.end(); ++it) {
+        string compressed = compress(*it, codec, level);
+        if (decompress(compressed) != *it) {
+          cout << "Codec " << codec << " level " << level
+               << " failed to round trip." << endl;
+          ret++;
+        }
+        if ((compressed[0] & 0x7F) != codec) {
+          cout << "Codec " << codec << " wrote the wrong tag." << endl;
+          ret++;
+        }
+      }
+    if (decompress(compress("", codec)) != "") {
+      cout << "Codec " << codec << " failed on empty input." << endl;
+      ret++;
+    }
+  }
+  // The default follows compression().
+  const Codec last = codec_available(Lz4) ? Lz4 : Bzip2;
+  compression(last, 1);
+  if (decompress(compress(messages[0])) != messages[0] ||
+      compression_codec() != last || compression_level() != 1) {
+    cout << "compression() not respected." << endl;
+    ret++;
+  }
+  compression(Bzip2);
+  try {
+    decompress(string(1, 0x7F) + "junk");
+    cout << "Unknown codec tag accepted." << endl;
+    ret++;
+  } catch (const exception &e) {
+    // As expected.
+  }
+  return ret;
+}
+
+/*
+  Confirm that we still read bare bzip2, as written before data
+  recorded its codec and size, even when the hint is far too small,
+  and that we reject data whose recorded size is wrong.
+*/
+int test_framing(const vector_string &messages) {
+  int ret = 0;
+  for (vector_string::const_iterator it = messages.begin();
+       it != messages.end(); ++it) {
+    unsigned int size = it->size() * 1.06 + 601;
+    vector<char> legacy(size);
+    if (BZ_OK != BZ2_bzBuffToBuffCompress(&legacy[0], &size,
+                                          const_cast<char *>(it->data()),
+                                          it->size(), 1, 0, 0)) {
+      cout << "Failed to make legacy bzip2." << endl;
+      return ret + 1;
+    }
+    string legacy_string(&legacy[0], size);
+    if (decompress(legacy_string) != *it ||
+        decompress(legacy_string, 1) != *it) {
+      cout << "Failed to read legacy bzip2." << endl;
+      ret++;
+    }
+    try {
+      decompress(legacy_string.substr(0, legacy_string.size() / 2));
+      cout << "Truncated legacy bzip2 accepted." << endl;
+      ret++;
+    } catch (const exception &e) {
+      // As expected.
+    }
+  }
+
+  const Codec codecs[] = {Bzip2, Zstd, Lz4};
+  for (const Codec codec : codecs) {
+    if (!codec_available(codec))
+      continue;
+    string compressed = compress(messages[1], codec);
+    if (!(compressed[0] & 0x80)) {
+      cout << "Codec " << codec << " didn't record the size." << endl;
+      ret++;
+    }
+    // A short message, so its size fits in one byte.
+    string longer(compressed), shorter(compressed);
+    longer[1] = static_cast<char>(longer[1] + 1);
+    shorter[1] = static_cast<char>(shorter[1] - 1);
+    try {
+      decompress(longer);
+      cout << "Codec " << codec << " accepted a long size." << endl;
+      ret++;
+    } catch (const exception &e) {
+      // As expected.
+    }
+    try {
+      decompress(shorter);
+      cout << "Codec " << codec << " accepted a short size." << endl;
+      ret++;
+    } catch (const exception &e) {
+      // As expected.
+    }
+  }
+  return ret;
+}
+
 }  // namespace
 
 int main(int argc, char *argv[]) {
@@ -68,6 +180,8 @@ int main(int argc, char *argv[]) {
   int err_count = 0;
   vector_string messages = test_text();
   err_count = count_if(messages.begin(), messages.end(), test_compress);
+  err_count += test_codecs(messages);
+  err_count += test_framing(messages);
 
   if (err_count)
     cout << "Errors (" << err_count << ") in test!!" << endl;
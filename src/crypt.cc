@@ -19,10 +19,13 @@
 
 #include <algorithm>
 #include <crypto++/base64.h>
+#include <crypto++/gcm.h>
 #include <crypto++/osrng.h>
 #include <crypto++/sha.h>
 #include <errno.h>
+#include <mutex>
 #include <sstream>
+#include <string.h>
 #include <stdexcept>
 
 // Modified from http://www.cryptopp.com/wiki/Hash_Functions
@@ -135,6 +138,17 @@ string srd::message_digest(const string &message, bool filesystem_safe) {
   return safe_name;
 }
 
+/*
+  Return the password for a pass phrase.  Iterate hash (arbitrarily)
+  50 times.  Motivated by gpg's behavior.
+*/
+string srd::password_from_pass_phrase(const string &pass_phrase) {
+  string digest(pass_phrase);
+  for (int i = 0; i < 50; i++)
+    digest = message_digest(digest, false);
+  return digest;
+}
+
 /*
   Return a string of length pseudo-random characters.
   Not necessarily human readable.
@@ -148,54 +162,170 @@ string srd::pseudo_random_string(int length) {
   return rand_str;
 }
 
-typedef CryptoPP::byte crypto_key_type[CryptoPP::CIPHER::DEFAULT_KEYLENGTH];
-typedef CryptoPP::byte crypto_iv_type[CryptoPP::CIPHER::BLOCKSIZE];
+typedef CryptoPP::GCM<CryptoPP::CIPHER>::Encryption GcmEncryption;
+typedef CryptoPP::GCM<CryptoPP::CIPHER>::Decryption GcmDecryption;
 
 namespace {
 
 /*
-  Initialize the key and iv given the password.
+  What we write is CIPHER in GCM mode, with a fresh random nonce for
+  each message:
+
+    magic | nonce | cipher text | authentication tag
+
+  Crypto++ uses AES-NI and CLMUL for this where the processor has
+  them.  Cipher text without the magic is in the older CIPHER_MODE
+  format, whose key and IV came from the password alone.
+*/
+const string GcmMagic("srd\x02", 4);
+const size_t GcmNonceSize = 12;
+const size_t GcmTagSize = 16;
+
+/*
+  The GCM key is a hash of the password, so that it differs from the
+  key the older format used.
+*/
+CryptoPP::SecByteBlock derive_gcm_key(const string &password) {
+  const string context("srd-gcm-key:");
+  CryptoPP::SecByteBlock key(CryptoPP::SHA256::DIGESTSIZE);
+  CryptoPP::SHA256 hash;
+  hash.Update(reinterpret_cast<const CryptoPP::byte *>(context.data()),
+              context.size());
+  hash.Update(reinterpret_cast<const CryptoPP::byte *>(password.data()),
+              password.size());
+  hash.Final(key);
+  return key;
+}
+
+/*
+  Initialize the key and iv given the password.  This is only for the
+  older format.
 */
-void init_key_iv(const string password, crypto_key_type &key,
-                 crypto_iv_type &iv) {
+void init_key_iv(const string password, CryptoPP::SecByteBlock &key,
+                 CryptoPP::SecByteBlock &iv) {
   // Key and IV setup.
   // IV is just hash of key
-  bzero(key, CryptoPP::CIPHER::DEFAULT_KEYLENGTH);
+  key.CleanNew(CryptoPP::CIPHER::DEFAULT_KEYLENGTH);
   size_t key_len = min(static_cast<size_t>(CryptoPP::CIPHER::DEFAULT_KEYLENGTH),
                        password.size());
   memcpy(key, password.c_str(), key_len);
 
-  bzero(iv, CryptoPP::CIPHER::BLOCKSIZE);
+  iv.CleanNew(CryptoPP::CIPHER::BLOCKSIZE);
   string iv_string = message_digest(password);
   size_t iv_len = min(static_cast<size_t>(CryptoPP::CIPHER::DEFAULT_KEYLENGTH),
                       iv_string.size());
   memcpy(iv, iv_string.c_str(), iv_len);
 }
+
+/*
+  Keyed ciphers not in use.  Keying a cipher expands the key schedule
+  and GCM's tables, so we do that once per cipher and only set a new
+  nonce per message.  A cipher serves one thread at a time, so each
+  thread borrows its own.
+*/
+template <class Cipher> class CipherPool {
+public:
+  explicit CipherPool(const CryptoPP::SecByteBlock &key) : m_key(key) {}
+  ~CipherPool() {
+    for (typename vector<Cipher *>::iterator it = m_idle.begin();
+         it != m_idle.end(); ++it)
+      delete *it;
+  }
+
+  Cipher *take() {
+    {
+      lock_guard<mutex> guard(m_mutex);
+      if (!m_idle.empty()) {
+        Cipher *cipher = m_idle.back();
+        m_idle.pop_back();
+        return cipher;
+      }
+    }
+    Cipher *cipher = new Cipher;
+    cipher->SetKey(m_key, m_key.size());
+    return cipher;
+  }
+
+  void give_back(Cipher *cipher) {
+    lock_guard<mutex> guard(m_mutex);
+    m_idle.push_back(cipher);
+  }
+
+private:
+  const CryptoPP::SecByteBlock &m_key;
+  mutex m_mutex;
+  vector<Cipher *> m_idle;
+};
+
+/*
+  A cipher borrowed from a pool for as long as we're in scope.
+*/
+template <class Cipher> class Borrowed {
+public:
+  explicit Borrowed(CipherPool<Cipher> &pool)
+      : m_pool(pool), m_cipher(pool.take()) {}
+  ~Borrowed() { m_pool.give_back(m_cipher); }
+  Cipher &operator*() { return *m_cipher; }
+  Cipher *operator->() { return m_cipher; }
+
+private:
+  Borrowed(const Borrowed &);
+  Borrowed &operator=(const Borrowed &);
+  CipherPool<Cipher> &m_pool;
+  Cipher *m_cipher;
+};
 }
 
+/*
+  Everything we derive from the password.  SecByteBlock and Crypto++'s
+  ciphers zero their keys when destroyed.
+*/
+struct srd::CipherContext::Keys {
+  explicit Keys(const string &password)
+      : gcm_key(derive_gcm_key(password)), encryptors(gcm_key),
+        decryptors(gcm_key) {
+    init_key_iv(password, legacy_key, legacy_iv);
+  }
+
+  CryptoPP::SecByteBlock gcm_key;
+  CryptoPP::SecByteBlock legacy_key;
+  CryptoPP::SecByteBlock legacy_iv;
+  CipherPool<GcmEncryption> encryptors;
+  CipherPool<GcmDecryption> decryptors;
+  mutex rng_mutex;
+  CryptoPP::AutoSeededRandomPool rng;
+};
+
+CipherContext::CipherContext(const string &password)
+    : m_keys(new Keys(password)) {}
+
+CipherContext::~CipherContext() {}
+
 /*
   Encrypt and return cipher text.
 */
-string srd::encrypt(const string &plain_text, const string &password) {
+string CipherContext::encrypt(const string &plain_text) const {
   try {
-    crypto_key_type key;
-    crypto_iv_type iv;
-    init_key_iv(password, key, iv);
+    CryptoPP::byte nonce[GcmNonceSize];
+    {
+      lock_guard<mutex> guard(m_keys->rng_mutex);
+      m_keys->rng.GenerateBlock(nonce, sizeof(nonce));
+    }
 
     // Cipher Text Sink
-    string cipher_text;
+    string cipher_text(GcmMagic);
+    cipher_text.append(reinterpret_cast<const char *>(nonce), sizeof(nonce));
 
     // Encryptor
-    CryptoPP::CIPHER_MODE<CryptoPP::CIPHER>::Encryption Encryptor(
-        key, sizeof(key), iv);
+    Borrowed<GcmEncryption> Encryptor(m_keys->encryptors);
+    Encryptor->Resynchronize(nonce, sizeof(nonce));
 
     // Encryption
-    CryptoPP::StreamTransformationFilter *source =
-        new CryptoPP::StreamTransformationFilter(
-            Encryptor,
-            new CryptoPP::StringSink(
-                cipher_text)); // StreamTransformationFilter
-    CryptoPP::StringSource(plain_text, true, source);
+    CryptoPP::StringSource(
+        plain_text, true,
+        new CryptoPP::AuthenticatedEncryptionFilter(
+            *Encryptor, new CryptoPP::StringSink(cipher_text), false,
+            GcmTagSize));
     return cipher_text;
 
   } catch (CryptoPP::Exception &e) {
@@ -209,29 +339,31 @@ string srd::encrypt(const string &plain_text, const string &password) {
 }
 
 /*
-  Decrypt and return plain text.
+  Decrypt and return plain text.  The cipher text is not copied,
+  so this is suitable for decrypting straight out of a FileView.
+  Set legacy if the cipher text was in the older format, so that
+  the caller can arrange to rewrite it.
+
+  Cipher text that begins with our magic but doesn't authenticate has
+  been altered, so we refuse it.  Older cipher text can begin with
+  our magic by chance, one time in 2^32, which mode(AllowLegacy) lets
+  us read.
 */
-string srd::decrypt(const string &cipher_text, const string &password) {
+string CipherContext::decrypt(const char *cipher_text, const size_t length,
+                              bool &legacy) const {
+  StageTimer timer(StageDecrypt);
+  timer.bytes(length);
+  legacy = false;
+  const bool gcm = length >= GcmMagic.size() + GcmNonceSize + GcmTagSize &&
+                   0 == memcmp(cipher_text, GcmMagic.data(), GcmMagic.size());
   try {
-    crypto_key_type key;
-    crypto_iv_type iv;
-    init_key_iv(password, key, iv);
-
-    // Recovered Text Sink
     string plain_text;
-
-    // Decryptor
-    CryptoPP::CIPHER_MODE<CryptoPP::CIPHER>::Decryption Decryptor(
-        key, sizeof(key), iv);
-
-    // Decryption
-    CryptoPP::StringSource(
-        cipher_text, true,
-        new CryptoPP::StreamTransformationFilter(
-            Decryptor,
-            new CryptoPP::StringSink(plain_text)) // StreamTransformationFilter
-        );                                        // StringSource
-    return plain_text;
+    if (gcm && gcm_decrypt(cipher_text, length, plain_text))
+      return plain_text;
+    if (!gcm || mode(AllowLegacy)) {
+      legacy = true;
+      return legacy_decrypt(cipher_text, length);
+    }
   } catch (CryptoPP::Exception &e) {
     cerr << e.what() << endl;
   }
@@ -239,5 +371,77 @@ string srd::decrypt(const string &cipher_text, const string &password) {
   catch (...) {
     cerr << "Unknown Error" << endl;
   }
+  if (gcm && !mode(AllowLegacy))
+    throw(runtime_error("Authentication failed, data has been altered.  "
+                        "(Use --allow-legacy if it predates "
+                        "authenticated encryption.)"));
   throw(runtime_error("decryption failed"));
 }
+
+/*
+  Decrypt GCM cipher text (including magic) into plain_text.  Return
+  false if it doesn't authenticate.
+*/
+bool CipherContext::gcm_decrypt(const char *cipher_text, const size_t length,
+                                string &plain_text) const {
+  const CryptoPP::byte *nonce =
+      reinterpret_cast<const CryptoPP::byte *>(cipher_text) + GcmMagic.size();
+  Borrowed<GcmDecryption> decryptor(m_keys->decryptors);
+  decryptor->Resynchronize(nonce, GcmNonceSize);
+  CryptoPP::AuthenticatedDecryptionFilter filter(
+      *decryptor, new CryptoPP::StringSink(plain_text),
+      CryptoPP::AuthenticatedDecryptionFilter::MAC_AT_END, GcmTagSize);
+  CryptoPP::StringSource(nonce + GcmNonceSize,
+                         length - GcmMagic.size() - GcmNonceSize, true,
+                         new CryptoPP::Redirector(filter));
+  if (filter.GetLastResult())
+    return true;
+  plain_text.clear();
+  return false;
+}
+
+/*
+  Decrypt cipher text in the older format.
+*/
+string CipherContext::legacy_decrypt(const char *cipher_text,
+                                     const size_t length) const {
+  // Recovered Text Sink
+  string plain_text;
+
+  // Decryptor
+  CryptoPP::CIPHER_MODE<CryptoPP::CIPHER>::Decryption Decryptor(
+      m_keys->legacy_key, m_keys->legacy_key.size(), m_keys->legacy_iv);
+
+  // Decryption
+  CryptoPP::StringSource(
+      reinterpret_cast<const CryptoPP::byte *>(cipher_text), length, true,
+      new CryptoPP::StreamTransformationFilter(
+          Decryptor,
+          new CryptoPP::StringSink(plain_text)) // StreamTransformationFilter
+      );                                        // StringSource
+  return plain_text;
+}
+
+/*
+  The functions that take a password are for one-off use.  Anything
+  that encrypts or decrypts more than once with a password should
+  keep a CipherContext.
+*/
+string srd::encrypt(const string &plain_text, const string &password) {
+  return CipherContext(password).encrypt(plain_text);
+}
+
+string srd::decrypt(const string &cipher_text, const string &password) {
+  return decrypt(cipher_text.data(), cipher_text.size(), password);
+}
+
+string srd::decrypt(const char *cipher_text, const size_t length,
+                    const string &password) {
+  bool legacy;
+  return decrypt(cipher_text, length, password, legacy);
+}
+
+string srd::decrypt(const char *cipher_text, const size_t length,
+                    const string &password, bool &legacy) {
+  return CipherContext(password).decrypt(cipher_text, length, legacy);
+}
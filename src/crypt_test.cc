@@ -35,6 +35,8 @@ namespace {
 int test_message_digest(const string message);
 int test_encryption(const string message);
 int test_lengths();
+int test_cipher_format();
+int test_cipher_context();
 
 /*
   Return the number of errors that occur.
@@ -83,6 +85,103 @@ int test_encryption(const string message) {
   return ret + 1;
 }
 
+/*
+  Check that each encryption uses its own nonce, that tampering is
+  detected, even where the older format could explain it, and that we
+  still read (and recognize) cipher text in the older format.
+*/
+int test_cipher_format() {
+  int ret = 0;
+  string password(message_digest("cipher format"));
+  // A length that the older format can't have.
+  string message("hello");
+  string first = encrypt(message, password);
+  string second = encrypt(message, password);
+  if (first == second) {
+    cout << "Encryption reused a nonce." << endl;
+    ret++;
+  }
+  bool legacy = true;
+  if (decrypt(second.data(), second.size(), password, legacy) != message ||
+      legacy) {
+    cout << "Failed to decrypt current format." << endl;
+    ret++;
+  }
+  for (size_t i = 0; i < first.size(); i += 7) {
+    string tampered(first);
+    tampered[i] ^= 0x01;
+    try {
+      decrypt(tampered, password);
+      cout << "Tampering at byte " << i << " not detected." << endl;
+      ret++;
+    } catch (const runtime_error &e) {
+      // As expected.
+    }
+  }
+
+  // Written by an older srd, with password the digest of
+  // "legacy passphrase".
+  const unsigned char old_cipher_text[] = {
+      0x64, 0xe3, 0x91, 0x40, 0xc3, 0xcc, 0x77, 0xf1, 0x9b, 0xe0, 0x97,
+      0xa2, 0x49, 0x07, 0x6f, 0x01, 0x61, 0xb9, 0xd5, 0x66, 0xea, 0xed,
+      0x26, 0xb2, 0xac, 0x09, 0x83, 0xf8, 0x63, 0x4a, 0xd9, 0x4c};
+  legacy = false;
+  if (decrypt(reinterpret_cast<const char *>(old_cipher_text),
+              sizeof(old_cipher_text), message_digest("legacy passphrase"),
+              legacy) != "Written by an older srd." ||
+      !legacy) {
+    cout << "Failed to decrypt older format." << endl;
+    ret++;
+  }
+
+  // Tampered cipher text of a length the older format can have must
+  // not pass for it.
+  string aligned = encrypt(string(16, 'a'), password);
+  aligned[aligned.size() - 1] ^= 0x01;
+  try {
+    decrypt(aligned, password);
+    cout << "Tampered cipher text passed for the older format." << endl;
+    ret++;
+  } catch (const runtime_error &e) {
+    if (string::npos == string(e.what()).find("Authentication")) {
+      cout << "Tampered cipher text not reported as such." << endl;
+      ret++;
+    }
+  }
+  return ret;
+}
+
+/*
+  Check that a CipherContext agrees with the one-off functions, and
+  that threads can share one.
+*/
+int test_cipher_context() {
+  int ret = 0;
+  const string password(message_digest("cipher context"));
+  CipherContext cipher(password);
+  vector_string messages = test_text();
+  vector<int> errors(messages.size(), 0);
+  worker_count(4);
+  parallel_for(messages.size(), [&](size_t i) {
+    bool legacy;
+    string cipher_text = cipher.encrypt(messages[i]);
+    if (decrypt(cipher_text, password) != messages[i])
+      errors[i]++;
+    cipher_text = encrypt(messages[i], password);
+    if (cipher.decrypt(cipher_text.data(), cipher_text.size(), legacy) !=
+            messages[i] ||
+        legacy)
+      errors[i]++;
+  });
+  worker_count(1);
+  for (size_t i = 0; i < errors.size(); ++i)
+    if (errors[i]) {
+      cout << "CipherContext failed on message " << i << endl;
+      ret += errors[i];
+    }
+  return ret;
+}
+
 /*
   Check that message_digest() and pseudo_random_string()
   return reasonable values.
@@ -130,11 +229,14 @@ int main(int argc, char *argv[]) {
 
   mode(Verbose, false);
   mode(Testing, true);
+  mode(AllowLegacy, false);
 
   int err_count = 0;
   vector_string messages = test_text();
   err_count = count_if(messages.begin(), messages.end(), test_message_digest);
   err_count += count_if(messages.begin(), messages.end(), test_encryption);
+  err_count += test_cipher_format();
+  err_count += test_cipher_context();
   err_count += test_lengths();
 
   if (err_count)
@@ -21,6 +21,7 @@
 #include <boost/date_time/posix_time/posix_time.hpp>
 #include <boost/interprocess/sync/file_lock.hpp>
 #include <errno.h>
+#include <fcntl.h>
 #include <fstream>
 #include <iostream>
 #include <stdexcept>
@@ -28,6 +29,7 @@
 #include <stdlib.h>
 #include <string>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <time.h>
@@ -66,7 +68,8 @@ void srd::set_base_dir(const std::string &in_dir) {
   Create a file if we know something about what to call it.
 */
 File::File(const string base_name, const string dir_name)
-    : m_dir_name(dir_name), m_base_name(base_name), m_dir_verified(false) {}
+    : m_dir_name(dir_name), m_base_name(base_name), m_dir_verified(false),
+      m_inode(0) {}
 
 /*
   Return the name of the directory in which the file lives or will live.
@@ -143,7 +146,7 @@ void File::file_contents_sub(string &data) {
   fs.close();
 
   rename(filename_new.c_str(), filename.c_str()); // guaranteed atomic
-  m_modtime = modtime(false);
+  note_version();
 }
 
 /*
@@ -154,8 +157,9 @@ string File::file_contents() {
   // There is a race condition here, someone could modify the
   // file between our stat and our read.  The result would be a
   // reread later (if we ever need it).
-  m_modtime = modtime(false);
+  note_version();
 
+  StageTimer timer(StageRead);
   ifstream fs(full_path().c_str(), ios::in | ios::binary | ios::ate);
   if (!fs.is_open()) {
     ostringstream oss(string("Failed to open file \""));
@@ -165,22 +169,42 @@ string File::file_contents() {
   size_t size = fs.tellg();
   if (0 == size)
     return string();
-  char *data = new char[size];
+  string data_str(size, '\0');
   fs.seekg(0, ios::beg);
-  fs.read(data, size);
+  fs.read(&data_str[0], size);
   fs.close();
-  string data_str(data, size);
+  timer.bytes(size);
   return data_str;
 }
 
 /*
-  Get the modification time of the file.
+  Return a view of the contents of the file.  This is file_contents()
+  without the copy, for when we only need to look.
+  It is an error for the file not to exist.
+*/
+boost::shared_ptr<FileView> File::file_view() {
+  // Same race as in file_contents().
+  note_version();
+  // A mapped file is mostly read as it's first touched, which is to
+  // say while decrypting.
+  StageTimer timer(StageRead);
+  boost::shared_ptr<FileView> view(new FileView(full_path()));
+  timer.bytes(view->size());
+  return view;
+}
+
+/*
+  Get the modification time of the file, and, if asked, its inode.
   If silent is false, complain if the file looks odd,
   notably if it is not a regular file.
 */
-time_pair File::modtime(const bool silent) {
+time_pair File::modtime(const bool silent, ino_t *inode) {
   struct stat stat_buf;
-  int ret = stat(full_path().c_str(), &stat_buf);
+  int ret;
+  {
+    StageTimer timer(StageStat);
+    ret = stat(full_path().c_str(), &stat_buf);
+  }
   if (ret) {
     cerr << "Failed to stat " << full_path() << ":" << endl;
     cerr << "  " << strerror(errno) << endl;
@@ -197,6 +221,8 @@ time_pair File::modtime(const bool silent) {
   else if (!S_ISREG(stat_buf.st_mode))
     cout << full_path() << " is not a regular file, odd things could happen."
          << endl;
+  if (inode)
+    *inode = stat_buf.st_ino;
 
 #if defined __USE_MISC || defined __USE_XOPEN2K8
   return time_pair(stat_buf.st_mtim.tv_sec, stat_buf.st_mtim.tv_nsec);
@@ -208,14 +234,39 @@ time_pair File::modtime(const bool silent) {
 /*
   Return true if file is modified since last we read it, false
   otherwise.
+
+  A file rewritten in quick succession can keep its modification
+  time, but we write by renaming a new file into place, so it doesn't
+  keep its inode.
 */
 bool File::underlying_is_modified() {
-  time_pair mt(modtime());
-  if (mt > m_modtime)
+  ino_t inode;
+  time_pair mt(modtime(true, &inode));
+  if (mt > m_modtime || inode != m_inode)
     return true;
   return false;
 }
 
+/*
+  Note the file's modification time and inode as of now, as
+  underlying_is_modified() compares them.
+*/
+void File::note_version() { m_modtime = modtime(false, &m_inode); }
+
+/*
+  Mark the file as changed without rewriting it, as when what it
+  stands for has changed elsewhere, so that others who read it notice
+  (cf. underlying_is_modified()).  We are up to date with the change.
+*/
+void File::touch() {
+  if (utimensat(AT_FDCWD, full_path().c_str(), NULL, 0)) {
+    ostringstream oss;
+    oss << "Failed to touch \"" << full_path() << "\": " << strerror(errno);
+    throw(runtime_error(oss.str()));
+  }
+  note_version();
+}
+
 /*
   Remove the underlying file.
   It is not an error later to rewrite the file, and the object remains
@@ -260,3 +311,71 @@ bool File::dir_is_writeable() {
   }
   return true;
 }
+
+/*
+  Map filename, or read it if it can't be mapped.
+  It is an error for the file not to exist.
+*/
+FileView::FileView(const string &filename)
+    : m_data(NULL), m_size(0), m_map(NULL) {
+  int fd = open(filename.c_str(), O_RDONLY);
+  if (-1 == fd) {
+    ostringstream oss;
+    oss << "Failed to open file \"" << filename
+        << "\" for reading: " << strerror(errno);
+    throw(runtime_error(oss.str()));
+  }
+  struct stat stat_buf;
+  if (0 == fstat(fd, &stat_buf) && S_ISREG(stat_buf.st_mode)) {
+    m_size = stat_buf.st_size;
+    if (0 == m_size) {
+      // Can't map nothing.
+      close(fd);
+      m_data = m_buffer.data();
+      return;
+    }
+    void *map = mmap(NULL, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (MAP_FAILED != map) {
+      close(fd); // The mapping outlives the descriptor.
+      m_map = map;
+      m_data = static_cast<const char *>(map);
+      return;
+    }
+    if (mode(Verbose))
+      cout << "Failed to map " << filename << ", reading instead." << endl;
+  }
+  // Not a regular file, or mmap() failed: read until there's no more.
+  char buf[16384];
+  ssize_t ret;
+  while ((ret = ::read(fd, buf, sizeof(buf))) != 0) {
+    if (-1 == ret) {
+      if (EINTR == errno)
+        continue;
+      int error = errno;
+      close(fd);
+      ostringstream oss;
+      oss << "Failed to read file \"" << filename << "\": " << strerror(error);
+      throw(runtime_error(oss.str()));
+    }
+    m_buffer.append(buf, ret);
+  }
+  close(fd);
+  m_data = m_buffer.data();
+  m_size = m_buffer.size();
+}
+
+/*
+  A view of length bytes of whole, starting at offset.
+*/
+FileView::FileView(boost::shared_ptr<FileView> whole, const size_t offset,
+                   const size_t length)
+    : m_data(NULL), m_size(length), m_map(NULL), m_whole(whole) {
+  if (offset > whole->size() || length > whole->size() - offset)
+    throw(runtime_error("File view slice exceeds file."));
+  m_data = whole->data() + offset;
+}
+
+FileView::~FileView() {
+  if (m_map)
+    munmap(m_map, m_size);
+}
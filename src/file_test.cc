@@ -21,6 +21,7 @@
 #include <boost/interprocess/sync/file_lock.hpp>
 #include <cerrno>
 #include <iostream>
+#include <sstream>
 #include <stdexcept>
 #include <string>
 #include <cstring>
@@ -66,6 +67,11 @@ int test_file(string message) {
       cout << "File write + read not identity!" << endl;
       ret++;
     }
+    boost::shared_ptr<FileView> view = my_file.file_view();
+    if (message != string(view->data(), view->size())) {
+      cout << "File write + view not identity!" << endl;
+      ret++;
+    }
   } catch (const runtime_error& e) {
     cerr << e.what() << endl;
     ret++;
@@ -83,6 +89,34 @@ int test_file(string message) {
   return ret;
 }
 
+/*
+  Check that viewing something we can't map (here, a pipe) falls
+  back to reading it.
+*/
+int test_view_unmappable() {
+  int fds[2];
+  if (pipe(fds)) {
+    cout << "Failed to create pipe:  " << strerror(errno) << endl;
+    return 1;
+  }
+  string message("Not a regular file.");
+  if (write(fds[1], message.data(), message.size()) !=
+      static_cast<ssize_t>(message.size())) {
+    cout << "Failed to write pipe." << endl;
+    return 1;
+  }
+  close(fds[1]);
+  ostringstream pipe_name;
+  pipe_name << "/proc/self/fd/" << fds[0];
+  FileView view(pipe_name.str());
+  close(fds[0]);
+  if (message != string(view.data(), view.size())) {
+    cout << "Pipe view not identity!" << endl;
+    return 1;
+  }
+  return 0;
+}
+
 /*
   Check that we can tell if a file has been modified.
 */
@@ -169,6 +203,7 @@ int main(int argc, char *argv[]) {
   err_count += count_if(messages.begin(), messages.end(), test_file);
 
   err_count += test_modified();
+  err_count += test_view_unmappable();
 
   err_count += test_is_writeable("/tmp", ".", true);
   err_count += test_is_writeable("/var/log", ".",
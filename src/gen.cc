@@ -0,0 +1,222 @@
+/*
+  Copyright 2026  Jeff Abrahamson
+
+  This file is part of srd.
+
+  srd is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  srd is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with srd.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+  Generate a database of made-up records, for seeing how srd behaves
+  at scale.  Try srd_gen --help.
+*/
+
+#include <boost/program_options.hpp>
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <stdlib.h>
+#include <string>
+
+#include "srd.h"
+#include "test_text.h"
+
+namespace BPO = boost::program_options;
+using namespace srd;
+using namespace std;
+
+namespace {
+
+/*
+  How big to make keys or payloads:  "N" for always N bytes,
+  "MIN-MAX" for uniformly between MIN and MAX, or "MIN-MAX/log" for
+  log-uniformly between them, so that most are small but a few are
+  large, as real records are.
+*/
+class SizeDistribution {
+public:
+  SizeDistribution(const string &spec) : m_log(false) {
+    string range(spec);
+    size_t slash = range.find('/');
+    if (string::npos != slash) {
+      if ("log" != range.substr(slash + 1))
+        throw(runtime_error("Unknown distribution in \"" + spec + "\"."));
+      m_log = true;
+      range.resize(slash);
+    }
+    char *end;
+    m_min = m_max = strtoul(range.c_str(), &end, 10);
+    if ('-' == *end)
+      m_max = strtoul(end + 1, &end, 10);
+    if (*end || range.empty() || m_max < m_min || (m_log && 0 == m_min))
+      throw(runtime_error("Bad size \"" + spec + "\"."));
+  }
+
+  size_t operator()(mt19937_64 &rng) const {
+    if (m_min == m_max)
+      return m_min;
+    if (!m_log)
+      return uniform_int_distribution<size_t>(m_min, m_max)(rng);
+    double size = exp(uniform_real_distribution<double>(
+        log(static_cast<double>(m_min)),
+        log(static_cast<double>(m_max) + 1))(rng));
+    return min(m_max, static_cast<size_t>(size));
+  }
+
+private:
+  size_t m_min;
+  size_t m_max;
+  bool m_log;
+};
+
+/*
+  Make up size bytes of content, either words from our test text
+  (which makes it searchable and compressible) or random bytes.
+*/
+class Content {
+public:
+  Content(const bool binary) : m_binary(binary) {
+    vector_string messages = test_text();
+    for (vector_string::const_iterator it = messages.begin();
+         it != messages.end(); ++it) {
+      istringstream words(*it);
+      string word;
+      while (words >> word)
+        m_words.push_back(word);
+    }
+  }
+
+  string operator()(mt19937_64 &rng, const size_t size) const {
+    string out;
+    out.reserve(size + 32);
+    if (m_binary) {
+      while (out.size() < size) {
+        uint64_t bits = rng();
+        out.append(reinterpret_cast<const char *>(&bits), sizeof(bits));
+      }
+    } else {
+      uniform_int_distribution<size_t> pick(0, m_words.size() - 1);
+      while (out.size() < size) {
+        if (!out.empty())
+          out += (0 == rng() % 12) ? '\n' : ' ';
+        out += m_words[pick(rng)];
+      }
+    }
+    out.resize(size);
+    return out;
+  }
+
+private:
+  bool m_binary;
+  vector_string m_words;
+};
+
+BPO::variables_map parse_options(int argc, char *argv[]) {
+  BPO::options_description options("Options");
+  options.add_options()("help,h", "Produce help message")(
+      "TEST,T", BPO::value<string>(),
+      "Use the test directory, with this password (as srd -T)")(
+      "pass-phrase", BPO::value<string>(),
+      "Pass phrase of the database, as one would type it to srd")(
+      "database-dir", BPO::value<string>(),
+      "Name of directory to use for database instead of default")(
+      "create", "Create the database rather than add to it")(
+      "leaves,n", BPO::value<size_t>()->default_value(1000),
+      "Number of records to add")(
+      "key-size", BPO::value<string>()->default_value("8-40"),
+      "Key sizes in bytes:  N, MIN-MAX (uniform) or MIN-MAX/log")(
+      "payload-size", BPO::value<string>()->default_value("100-10000/log"),
+      "Payload sizes in bytes, as --key-size")(
+      "binary", "Payloads of random bytes rather than text")(
+      "seed", BPO::value<unsigned long>()->default_value(1),
+      "Random seed, so that the same options make the same records")(
+      "batch", BPO::value<size_t>()->default_value(1000),
+      "Commit the root after every so many records")(
+      "pack", "Store records in a pack file (as srd --pack)")(
+      "inline", BPO::value<unsigned int>(),
+      "Store records of at most this many bytes in the root (as srd "
+      "--inline)")(
+      "codec", BPO::value<string>(), "Compress records with this codec")(
+      "verbose,v", "Emit debugging information");
+
+  BPO::variables_map opt_map;
+  BPO::store(BPO::parse_command_line(argc, argv, options), opt_map);
+  BPO::notify(opt_map);
+  if (opt_map.count("help")) {
+    cout << "Usage:  srd_gen [options]" << endl << options << endl;
+    exit(0);
+  }
+  if (opt_map.count("TEST") == opt_map.count("pass-phrase"))
+    throw(runtime_error("Need exactly one of --TEST and --pass-phrase."));
+  return opt_map;
+}
+}
+
+int main(int argc, char *argv[]) {
+  GOOGLE_PROTOBUF_VERIFY_VERSION;
+  try {
+    BPO::variables_map options = parse_options(argc, argv);
+    mode(Verbose, options.count("verbose") > 0);
+    mode(ReadOnly, false);
+    mode(Testing, options.count("TEST") > 0);
+    if (options.count("database-dir"))
+      set_base_dir(options["database-dir"].as<string>());
+    if (options.count("codec"))
+      compression(codec_named(options["codec"].as<string>()));
+    string password =
+        options.count("TEST")
+            ? options["TEST"].as<string>()
+            : password_from_pass_phrase(options["pass-phrase"].as<string>());
+
+    const size_t leaf_count = options["leaves"].as<size_t>();
+    const size_t batch_size = max(size_t(1), options["batch"].as<size_t>());
+    const SizeDistribution key_size(options["key-size"].as<string>());
+    const SizeDistribution payload_size(options["payload-size"].as<string>());
+    const Content key_content(false);
+    const Content payload_content(options.count("binary") > 0);
+    mt19937_64 rng(options["seed"].as<unsigned long>());
+
+    Root root(password, "", options.count("create") > 0);
+    if (options.count("pack"))
+      root.repack();
+    if (options.count("inline"))
+      root.inline_leaves(options["inline"].as<unsigned int>());
+    size_t start = root.size();
+    uint64_t payload_bytes = 0;
+    RootBatch batch(root);
+    for (size_t i = 0; i < leaf_count; ++i) {
+      // Number the keys, so that each is distinct.
+      ostringstream key;
+      key << key_content(rng, key_size(rng)) << " " << start + i;
+      string payload = payload_content(rng, payload_size(rng));
+      payload_bytes += payload.size();
+      batch.add_leaf(key.str(), payload);
+      if (batch.size() >= batch_size) {
+        batch.commit();
+        if (mode(Verbose))
+          cout << i + 1 << " records written." << endl;
+      }
+    }
+    batch.commit();
+    cout << "Added " << leaf_count << " records (" << payload_bytes
+         << " bytes of payload), " << root.size() << " in all." << endl;
+  } catch (const exception &e) {
+    cerr << e.what() << endl;
+    return 1;
+  }
+  google::protobuf::ShutdownProtobufLibrary();
+  return 0;
+}
@@ -0,0 +1,90 @@
+/*
+  Copyright 2026  Jeff Abrahamson
+
+  This file is part of srd.
+
+  srd is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  srd is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with srd.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <set>
+#include <string>
+#include <unordered_map>
+
+#include "srd.h"
+
+using namespace srd;
+using namespace std;
+
+/*
+  Note that proxy_name has key, whether it's new or had another key.
+  Entries that arrive in order (as when a root loads) go at the end
+  in constant time.
+*/
+void KeyIndex::set(const string &proxy_name, const string &key) {
+  remove(proxy_name);
+  const Entry entry(key, proxy_name);
+  const_iterator hint = m_entries.end();
+  if (!m_entries.empty() && entry < *m_entries.rbegin())
+    hint = m_entries.lower_bound(entry);
+  m_positions[proxy_name] = m_entries.insert(hint, entry);
+}
+
+void KeyIndex::remove(const string &proxy_name) {
+  unordered_map<string, const_iterator>::iterator found =
+      m_positions.find(proxy_name);
+  if (m_positions.end() == found)
+    return;
+  m_entries.erase(found->second);
+  m_positions.erase(found);
+}
+
+void KeyIndex::clear() {
+  m_entries.clear();
+  m_positions.clear();
+}
+
+/*
+  Return the entries whose keys begin with prefix.
+*/
+KeyIndex::Range KeyIndex::prefix(const string &prefix) const {
+  return range(prefix, prefix_end(prefix));
+}
+
+/*
+  Return the least key past every key that begins with prefix, or the
+  empty string if there is none.  That's the prefix with its last
+  byte incremented, ignoring trailing bytes that can't be.
+*/
+string KeyIndex::prefix_end(const string &prefix) {
+  string past(prefix);
+  while (!past.empty() && '\xff' == past[past.size() - 1])
+    past.erase(past.size() - 1);
+  if (!past.empty())
+    past[past.size() - 1] = past[past.size() - 1] + 1;
+  return past;
+}
+
+/*
+  Return the entries whose keys k satisfy low <= k < high, or if high
+  is empty, low <= k.
+*/
+KeyIndex::Range KeyIndex::range(const string &low, const string &high) const {
+  const_iterator first = m_entries.lower_bound(Entry(low, string()));
+  if (high.empty())
+    return Range(first, m_entries.end());
+  const_iterator last = m_entries.lower_bound(Entry(high, string()));
+  if (high < low)
+    last = first;
+  return Range(first, last);
+}
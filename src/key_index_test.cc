@@ -0,0 +1,117 @@
+/*
+  Copyright 2026  Jeff Abrahamson
+
+  This file is part of srd.
+
+  srd is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  srd is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with srd.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <iostream>
+#include <string>
+
+#include "srd.h"
+
+using namespace srd;
+using namespace std;
+
+namespace {
+
+/*
+  Return the keys in range, joined by commas.
+*/
+string keys(const KeyIndex::Range &range) {
+  string out;
+  for (KeyIndex::const_iterator it = range.first; it != range.second; ++it) {
+    if (!out.empty())
+      out += ",";
+    out += it->first;
+  }
+  return out;
+}
+
+int expect(const string &what, const string &got, const string &want) {
+  if (got == want)
+    return 0;
+  cout << what << ":  got \"" << got << "\", expected \"" << want << "\"."
+       << endl;
+  return 1;
+}
+
+/*
+  Confirm that entries stay in key order as they come, go, and change
+  key.
+*/
+int test_order() {
+  int ret = 0;
+  KeyIndex index;
+  index.set("n1", "pear");
+  index.set("n2", "apple");
+  index.set("n3", "fig");
+  index.set("n4", "fig");
+  ret += expect("Order", keys(KeyIndex::Range(index.begin(), index.end())),
+                "apple,fig,fig,pear");
+  index.set("n2", "quince");
+  index.remove("n3");
+  index.remove("no such name");
+  ret += expect("Order after changes",
+                keys(KeyIndex::Range(index.begin(), index.end())),
+                "fig,pear,quince");
+  if (index.size() != 3 || index.begin()->second != "n4") {
+    cout << "Wrong size or name." << endl;
+    ret++;
+  }
+  index.clear();
+  if (index.size() || index.begin() != index.end()) {
+    cout << "Clear failed." << endl;
+    ret++;
+  }
+  return ret;
+}
+
+int test_prefix_and_range() {
+  int ret = 0;
+  KeyIndex index;
+  const char *const words[] = {"ant", "apple", "apples", "apricot", "b",
+                               "banana", "ap\xff", "ap\xff\xff", "aq"};
+  for (size_t i = 0; i < sizeof(words) / sizeof(words[0]); ++i)
+    index.set(string("n") + words[i], words[i]);
+  ret += expect("Prefix", keys(index.prefix("app")), "apple,apples");
+  ret += expect("Prefix of all", keys(index.prefix("")),
+                keys(KeyIndex::Range(index.begin(), index.end())));
+  ret += expect("Prefix of none", keys(index.prefix("c")), "");
+  ret += expect("Prefix ending in 0xff", keys(index.prefix("ap\xff")),
+                "ap\xff,ap\xff\xff");
+  ret += expect("Range", keys(index.range("apple", "b")),
+                "apple,apples,apricot,ap\xff,ap\xff\xff,aq");
+  ret += expect("Open range", keys(index.range("b", "")), "b,banana");
+  ret += expect("Empty range", keys(index.range("b", "a")), "");
+  ret += expect("End of prefix", KeyIndex::prefix_end("ab\xff"), "ac");
+  ret += expect("End of all", KeyIndex::prefix_end("\xff"), "");
+  return ret;
+}
+}
+
+int main(int argc, char *argv[]) {
+  cout << "Testing key_index.cpp" << endl;
+
+  int err_count = 0;
+  err_count += test_order();
+  err_count += test_prefix_and_range();
+
+  if (err_count)
+    cout << "Errors (" << err_count << ") in test!!" << endl;
+  else
+    cout << "All tests passed!" << endl;
+  return 0 != err_count;
+}
@@ -39,13 +39,24 @@ using namespace std;
   If load == false, we don't actually load the leaf's contents.
   Don't do this.  It's just a hook for removing leaves that we
   haven't loaded.  The only usage should be leaf_proxy::erase().
+
+  If location names a pack, our cipher text lives there rather than
+  in our own file.  We still have a basename, since that's how the
+  root knows us.
 */
 Leaf::Leaf(const string &pass, const string base_name, const string dir_name,
-           const bool do_load)
-    : m_password(pass), m_modified(false), m_loaded(false) {
+           const bool do_load, const PackLocation &location)
+    : Leaf(boost::shared_ptr<CipherContext>(new CipherContext(pass)),
+           base_name, dir_name, do_load, location) {}
+
+Leaf::Leaf(const boost::shared_ptr<CipherContext> &cipher,
+           const string base_name, const string dir_name, const bool do_load,
+           const PackLocation &location)
+    : m_cipher(cipher), m_location(location), m_modified(false),
+      m_loaded(false) {
   basename(base_name); // If empty, will be computed for us
   dirname(dir_name);   // If empty, will be computed for us
-  if (!exists()) {
+  if (!persisted()) {
     // If never persisted, then ok to return empty leaf.
     m_loaded = true;
     return;
@@ -87,18 +98,36 @@ Leaf::~Leaf() { commit(); }
 void Leaf::load() {
   if (m_loaded)
     return;
+  time_pair the_version = version();
+  if (leaf_cache().get(basename(), the_version, m_node_key, m_node_payload)) {
+    stats_count(CountCacheHits);
+    m_loaded = true;
+    return;
+  }
   if (mode(Verbose))
     cout << "Loading leaf:  " << basename() << endl;
-  string plain_text = decrypt(file_contents(), m_password);
+  boost::shared_ptr<FileView> view = cipher_view();
+  bool legacy;
+  string plain_text = m_cipher->decrypt(view->data(), view->size(), legacy);
   string big_text = decompress(plain_text);
   LeafData leaf_data;
-  if (!leaf_data.ParseFromString(big_text)) {
+  bool parsed;
+  {
+    StageTimer timer(StageParse);
+    timer.bytes(big_text.size());
+    parsed = leaf_data.ParseFromString(big_text);
+  }
+  if (!parsed) {
     cerr << "Failed to deserialize leaf." << endl;
     throw(runtime_error("Failed to deserialize leaf"));
   }
+  stats_count(CountLeavesLoaded);
   m_node_key = leaf_data.key();
   m_node_payload = leaf_data.payload();
   m_loaded = true;
+  // A leaf in the older cipher format is rewritten in the current one
+  // when it next changes.  Reading alone never writes.
+  leaf_cache().put(basename(), the_version, m_node_key, m_node_payload);
 }
 
 /*
@@ -117,9 +146,14 @@ void Leaf::commit() {
     throw(runtime_error("Failed to serialize leaf."));
   }
   string plain_text = compress(big_text);
-  string cipher_text = encrypt(plain_text, m_password);
-  file_contents(cipher_text);
+  string cipher_text = m_cipher->encrypt(plain_text);
+  if (m_location.pack) {
+    m_location.offset = m_location.pack->append(cipher_text);
+    m_location.length = cipher_text.size();
+  } else
+    file_contents(cipher_text);
   m_modified = false;
+  leaf_cache().put(basename(), version(), m_node_key, m_node_payload);
   validate();
   if (mode(Verbose))
     cout << "leaf committed" << endl;
@@ -128,20 +162,65 @@ void Leaf::commit() {
 /*
   Remove the underlying file.  We mark as unmodified so that we won't
   try to repersist at destruction time.
+
+  A packed leaf just forgets where it was.  The bytes stay in the pack
+  until the next Root::repack().
 */
 void Leaf::erase() {
   validate();
-  rm();
+  if (m_location.pack) {
+    m_location.offset = 0;
+    m_location.length = 0;
+  } else
+    rm();
+  leaf_cache().erase(basename());
   m_modified = false;
   validate();
 }
 
+/*
+  Return our persisted (encrypted) bytes, wherever they live.
+  It is an error if we've never been persisted.
+*/
+string Leaf::cipher_text() {
+  boost::shared_ptr<FileView> view = cipher_view();
+  return string(view->data(), view->size());
+}
+
+/*
+  As cipher_text(), but without copying.
+*/
+boost::shared_ptr<FileView> Leaf::cipher_view() {
+  if (m_location.pack)
+    return m_location.pack->view(m_location.offset, m_location.length);
+  return file_view();
+}
+
+/*
+  Return something that changes whenever our persisted bytes do.
+  Cf. LeafCache.
+*/
+time_pair Leaf::version() {
+  if (m_location.pack)
+    return time_pair(m_location.offset, m_location.length);
+  return modtime(false);
+}
+
+/*
+  Return true if we have been persisted, false otherwise.
+*/
+bool Leaf::persisted() {
+  if (m_location.pack)
+    return m_location.length > 0;
+  return exists();
+}
+
 /*
   Check that all is in order.  If not, assert and die.
   All should be in order!
 */
 void Leaf::validate() {
-  assert(m_password.size() > 0);
+  assert(m_cipher);
   assert(basename().size() > 0);
   assert(dirname().size() > 0);
 }
@@ -0,0 +1,164 @@
+/*
+  Copyright 2026  Jeff Abrahamson
+
+  This file is part of srd.
+
+  srd is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  srd is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with srd.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <iostream>
+#include <mutex>
+#include <string>
+
+#include "srd.h"
+
+using namespace srd;
+using namespace std;
+
+namespace {
+
+/*
+  Overwrite the string's bytes.  The volatile keeps the compiler
+  from deciding that writes to memory about to be freed don't matter.
+*/
+void secure_wipe(string &s) {
+  volatile char *p = s.empty() ? NULL : &s[0];
+  for (size_t i = 0; i < s.size(); ++i)
+    p[i] = 0;
+}
+
+/*
+  What an entry costs against the budget.  The constant is a rough
+  guess at list, map, and string overhead.
+*/
+size_t entry_size(const string &name, const string &key,
+                  const string &payload) {
+  return name.size() + key.size() + payload.size() + 128;
+}
+}
+
+LeafCache::LeafCache(const size_t in_budget)
+    : m_budget(in_budget), m_size(0) {}
+
+LeafCache::~LeafCache() { clear(); }
+
+/*
+  Change the budget, evicting as needed.  A budget of zero disables
+  the cache.
+*/
+void LeafCache::budget(const size_t bytes) {
+  lock_guard<mutex> guard(m_mutex);
+  m_budget = bytes;
+  trim();
+}
+
+/*
+  If we have name at version, set key and payload and return true.
+  Otherwise return false and leave key and payload alone.
+
+  An entry at some other version is stale, so drop it.
+*/
+bool LeafCache::get(const string &name, const time_pair &version, string &key,
+                    string &payload) {
+  lock_guard<mutex> guard(m_mutex);
+  unordered_map<string, EntryList::iterator>::iterator found =
+      m_index.find(name);
+  if (m_index.end() == found)
+    return false;
+  EntryList::iterator it = found->second;
+  if (it->version != version) {
+    evict(it);
+    return false;
+  }
+  m_entries.splice(m_entries.begin(), m_entries, it);
+  key = it->key;
+  payload = it->payload;
+  return true;
+}
+
+/*
+  Remember that name at version has key and payload, replacing
+  whatever we knew about name before.
+*/
+void LeafCache::put(const string &name, const time_pair &version,
+                    const string &key, const string &payload) {
+  lock_guard<mutex> guard(m_mutex);
+  unordered_map<string, EntryList::iterator>::iterator found =
+      m_index.find(name);
+  if (m_index.end() != found)
+    evict(found->second);
+  size_t cost = entry_size(name, key, payload);
+  if (cost > m_budget)
+    // Also covers a budget of zero.
+    return;
+  // Build the entry in place, so there's no temporary copy of the
+  // plain text to leave lying about.
+  m_entries.push_front(Entry());
+  Entry &entry = m_entries.front();
+  entry.name = name;
+  entry.version = version;
+  entry.key = key;
+  entry.payload = payload;
+  m_index[name] = m_entries.begin();
+  m_size += cost;
+  trim();
+}
+
+/*
+  Forget name, if we know it.
+*/
+void LeafCache::erase(const string &name) {
+  lock_guard<mutex> guard(m_mutex);
+  unordered_map<string, EntryList::iterator>::iterator found =
+      m_index.find(name);
+  if (m_index.end() != found)
+    evict(found->second);
+}
+
+/*
+  Forget everything.
+*/
+void LeafCache::clear() {
+  lock_guard<mutex> guard(m_mutex);
+  while (!m_entries.empty())
+    evict(m_entries.begin());
+}
+
+/*
+  Wipe and drop one entry.  The caller holds m_mutex.
+*/
+void LeafCache::evict(EntryList::iterator it) {
+  m_size -= entry_size(it->name, it->key, it->payload);
+  m_index.erase(it->name);
+  secure_wipe(it->key);
+  secure_wipe(it->payload);
+  m_entries.erase(it);
+}
+
+/*
+  Evict least recently used entries until we're within budget.
+  The caller holds m_mutex.
+*/
+void LeafCache::trim() {
+  while (m_size > m_budget && !m_entries.empty()) {
+    if (mode(Verbose))
+      cout << "Evicting cached leaf:  " << m_entries.back().name << endl;
+    evict(--m_entries.end());
+  }
+}
+
+LeafCache &srd::leaf_cache() {
+  static LeafCache cache;
+  return cache;
+}
@@ -0,0 +1,187 @@
+/*
+  Copyright 2026  Jeff Abrahamson
+
+  This file is part of srd.
+
+  srd is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  srd is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with srd.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include "srd.h"
+#include "test_text.h"
+
+using namespace srd;
+using namespace std;
+
+namespace {
+
+/*
+  Put and get, and confirm that a different version misses and that
+  a miss leaves key and payload alone.
+*/
+int test_get_put() {
+  int ret = 0;
+  LeafCache cache;
+  cache.put("leaf", time_pair(1, 2), "key", "payload");
+  string key, payload;
+  if (!cache.get("leaf", time_pair(1, 2), key, payload) || key != "key" ||
+      payload != "payload") {
+    cout << "Failed to get what we put." << endl;
+    ret++;
+  }
+  key = "unchanged";
+  if (cache.get("leaf", time_pair(1, 3), key, payload)) {
+    cout << "Got stale version." << endl;
+    ret++;
+  }
+  if (key != "unchanged") {
+    cout << "Miss modified key." << endl;
+    ret++;
+  }
+  if (cache.get("leaf", time_pair(1, 2), key, payload)) {
+    cout << "Stale entry survived a miss." << endl;
+    ret++;
+  }
+  cache.put("leaf", time_pair(1, 2), "key", "payload");
+  cache.erase("leaf");
+  if (cache.get("leaf", time_pair(1, 2), key, payload)) {
+    cout << "Got erased entry." << endl;
+    ret++;
+  }
+  if (0 != cache.size()) {
+    cout << "Empty cache has size " << cache.size() << endl;
+    ret++;
+  }
+  return ret;
+}
+
+/*
+  Fill a small cache and confirm that it stays within budget and
+  evicts least recently used first.
+*/
+int test_budget() {
+  int ret = 0;
+  const string payload(1000, 'x');
+  LeafCache cache(10 * 1000);
+  string key, got_payload;
+  for (int i = 0; i < 100; ++i) {
+    ostringstream name;
+    name << "leaf-" << i;
+    cache.put(name.str(), time_pair(i, 0), "key", payload);
+    // Keep leaf-0 in use, so it should never be evicted.
+    if (!cache.get("leaf-0", time_pair(0, 0), key, got_payload)) {
+      cout << "Recently used leaf-0 evicted at " << i << endl;
+      ret++;
+      break;
+    }
+    if (cache.size() > cache.budget()) {
+      cout << "Cache size " << cache.size() << " exceeds budget "
+           << cache.budget() << endl;
+      ret++;
+    }
+  }
+  if (cache.get("leaf-1", time_pair(1, 0), key, got_payload)) {
+    cout << "Least recently used leaf-1 not evicted." << endl;
+    ret++;
+  }
+  if (!cache.get("leaf-99", time_pair(99, 0), key, got_payload)) {
+    cout << "Most recent leaf-99 evicted." << endl;
+    ret++;
+  }
+  cache.budget(0);
+  if (0 != cache.size() ||
+      cache.get("leaf-99", time_pair(99, 0), key, got_payload)) {
+    cout << "Zero budget cache not empty." << endl;
+    ret++;
+  }
+  cache.put("leaf", time_pair(0, 0), "key", payload);
+  if (cache.get("leaf", time_pair(0, 0), key, got_payload)) {
+    cout << "Zero budget cache cached." << endl;
+    ret++;
+  }
+  return ret;
+}
+
+/*
+  Confirm that leaves find themselves in the process-wide cache and
+  that a rewritten leaf isn't served stale.
+*/
+int test_leaf_cached(const string &message) {
+  int ret = 0;
+  string password = message_digest(message);
+  string base_name;
+  {
+    Leaf leaf(password, "", "");
+    leaf.key("key");
+    leaf.payload(message);
+    leaf.commit();
+    base_name = leaf.basename();
+  }
+  string key, payload;
+  {
+    Leaf leaf(password, base_name, "");
+    if (leaf.payload() != message) {
+      cout << "Leaf mismatch" << endl;
+      ret++;
+    }
+    // The file's version, since that's what the leaf checked.
+    File file(base_name, leaf.dirname());
+    if (!leaf_cache().get(base_name, file.modtime(), key, payload) ||
+        payload != message) {
+      cout << "Loaded leaf not in cache." << endl;
+      ret++;
+    }
+    // Commit writes through to the cache at the new version.
+    leaf.payload(message + " again");
+    leaf.commit();
+  }
+  {
+    Leaf leaf(password, base_name, "");
+    if (leaf.payload() != message + " again") {
+      cout << "Rewritten leaf served stale." << endl;
+      ret++;
+    }
+    leaf.erase();
+  }
+  if (leaf_cache().get(base_name, time_pair(0, 0), key, payload)) {
+    cout << "Erased leaf still in cache." << endl;
+    ret++;
+  }
+  return ret;
+}
+}
+
+int main(int argc, char *argv[]) {
+  cout << "Testing leaf_cache.cpp" << endl;
+
+  mode(Verbose, false);
+  mode(Testing, true);
+  mode(ReadOnly, false);
+
+  int err_count = 0;
+  err_count += test_get_put();
+  err_count += test_budget();
+  vector_string messages = test_text();
+  err_count += count_if(messages.begin(), messages.end(), test_leaf_cached);
+
+  if (err_count)
+    cout << "Errors (" << err_count << ") in test!!" << endl;
+  else
+    cout << "All tests passed!" << endl;
+  return 0 != err_count;
+}
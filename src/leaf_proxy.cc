@@ -37,6 +37,7 @@ using namespace std;
 */
 LeafProxy::LeafProxy() {
   the_leaf = NULL;
+  inlined = false;
   valid = false; // check that we've followed on with an assignment or copy
 }
 
@@ -46,9 +47,21 @@ LeafProxy::LeafProxy() {
   created if needed.
 */
 LeafProxy::LeafProxy(const string &pass, const string base, const string dir)
-    : password(pass), input_base_name(base), input_dir_name(dir) {
-  assert(!password.empty());
+    : LeafProxy(boost::shared_ptr<CipherContext>(new CipherContext(pass)), base,
+                dir) {
+  assert(!pass.empty());
+}
+
+/*
+  As above, sharing cipher (and so the work of deriving keys) with
+  other proxies.
+*/
+LeafProxy::LeafProxy(const boost::shared_ptr<CipherContext> &in_cipher,
+                     const string base, const string dir)
+    : cipher(in_cipher), input_base_name(base), input_dir_name(dir) {
+  assert(cipher);
   the_leaf = NULL;
+  inlined = false;
   valid = true;
   validate();
 }
@@ -59,9 +72,12 @@ LeafProxy::LeafProxy(const string &pass, const string base, const string dir)
   operator=() about why.
 */
 LeafProxy::LeafProxy(const LeafProxy &other)
-    : password(other.password), input_base_name(other.input_base_name),
-      input_dir_name(other.input_dir_name), valid(other.valid),
-      cached_key(other.cached_key), the_leaf(NULL) {
+    : cipher(other.cipher), input_base_name(other.input_base_name),
+      input_dir_name(other.input_dir_name), location(other.location),
+      valid(other.valid),
+      cached_key(other.cached_key), cached_folded_key(other.cached_folded_key),
+      the_leaf(NULL), inlined(other.inlined),
+      inline_payload(other.inline_payload), filter(other.filter) {
   validate();
 }
 
@@ -73,21 +89,27 @@ LeafProxy::LeafProxy(const LeafProxy &other)
   other gets destroyed and so writes itself.
 */
 LeafProxy &LeafProxy::operator=(const LeafProxy &other) {
-  password = other.password;
+  cipher = other.cipher;
   if (other.the_leaf) {
     // If we've loaded the leaf, use its location
     // information, since it may have been computed at
     // instantiation time.
     input_base_name = other.the_leaf->basename();
     input_dir_name = other.the_leaf->dirname();
+    location = other.the_leaf->location();
   } else {
     // Otherwise, what we have will surely work.
     input_base_name = other.input_base_name;
     input_dir_name = other.input_dir_name;
+    location = other.location;
   }
   valid = other.valid;
   cached_key = other.cached_key;
+  cached_folded_key = other.cached_folded_key;
   the_leaf = NULL;
+  inlined = other.inlined;
+  inline_payload = other.inline_payload;
+  filter = other.filter;
 
   validate();
   return *this;
@@ -103,11 +125,19 @@ LeafProxy &LeafProxy::operator=(const LeafProxy &other) {
   take action if needed.
 */
 bool LeafProxy::set(const string &in_key, const string &in_payload) {
+  bool key_changed = (cached_key != in_key);
+  filter.reset();
+  if (inlined) {
+    cached_key = in_key;
+    cached_folded_key.clear();
+    inline_payload = in_payload;
+    return key_changed;
+  }
   init_leaf();
   the_leaf->key(in_key);
   the_leaf->payload(in_payload);
-  bool key_changed = (cached_key != in_key);
   cached_key = in_key;
+  cached_folded_key.clear();
   commit();
   validate();
   return key_changed;
@@ -121,9 +151,15 @@ bool LeafProxy::set(const string &in_key, const string &in_payload) {
 */
 void LeafProxy::key(const string &in_key) {
   validate();
+  if (inlined) {
+    cached_key = in_key;
+    cached_folded_key.clear();
+    return;
+  }
   init_leaf();
   the_leaf->key(in_key);
   cached_key = in_key;
+  cached_folded_key.clear();
   commit();
   validate();
 }
@@ -133,7 +169,7 @@ void LeafProxy::key(const string &in_key) {
 */
 string LeafProxy::key() const {
   validate();
-  if (cached_key.empty()) {
+  if (cached_key.empty() && !inlined) {
     // Trust not an empty cached_key
     init_leaf();
     return the_leaf->key();
@@ -141,6 +177,17 @@ string LeafProxy::key() const {
   return cached_key;
 }
 
+/*
+  Return the leaf's key, case folded.  Case insensitive key searches
+  compare against this, so they fold each key once rather than once
+  per pattern per search.
+*/
+const string &LeafProxy::folded_key() const {
+  if (cached_folded_key.empty())
+    cached_folded_key = fold_case(key());
+  return cached_folded_key;
+}
+
 /*
   Set the leaf's payload.
 
@@ -149,6 +196,11 @@ string LeafProxy::key() const {
 */
 void LeafProxy::payload(const string &in_payload) {
   validate();
+  filter.reset();
+  if (inlined) {
+    inline_payload = in_payload;
+    return;
+  }
   init_leaf();
   the_leaf->payload(in_payload);
   commit();
@@ -160,6 +212,8 @@ void LeafProxy::payload(const string &in_payload) {
 */
 string LeafProxy::payload() const {
   validate();
+  if (inlined)
+    return inline_payload;
   init_leaf();
   validate();
   return the_leaf->payload();
@@ -180,11 +234,34 @@ void LeafProxy::print_key() const {
 void LeafProxy::print_payload(const string &pattern) const {
   validate();
   string prefix = "  "; // Someday make this an option maybe
-  stringstream payload_ss(payload());
-  string line;
-  while (getline(payload_ss, line, '\n'))
-    if (0 == pattern.size() || string::npos != line.find(pattern))
+  const string text = payload();
+  if (pattern.empty()) {
+    stringstream payload_ss(text);
+    string line;
+    while (getline(payload_ss, line, '\n'))
       cout << prefix << line << endl;
+    return;
+  }
+  // No line contains a newline.
+  if (string::npos != pattern.find('\n'))
+    return;
+  // Search the whole payload rather than line by line, then print
+  // the line around each match.
+  size_t from = 0;
+  while (from < text.size()) {
+    const size_t found = find_substring(text, pattern, from);
+    if (string::npos == found)
+      return;
+    size_t begin = text.rfind('\n', found);
+    begin = string::npos == begin ? 0 : begin + 1;
+    size_t end = text.find('\n', found);
+    if (string::npos == end)
+      end = text.size();
+    cout << prefix;
+    cout.write(text.data() + begin, end - begin);
+    cout << endl;
+    from = end + 1;
+  }
 }
 
 /*
@@ -197,6 +274,8 @@ string LeafProxy::basename() const {
   // If the leaf is loaded, we can return the basename.  If not,
   // don't load just to compute the name.  Rather, init without
   // loading, compute the name, and then toss the pointer.
+  if (inlined)
+    return input_base_name;
   if (the_leaf)
     return the_leaf->basename();
   init_leaf(false);
@@ -205,14 +284,76 @@ string LeafProxy::basename() const {
   return out_base_name;
 }
 
+/*
+  Say where the leaf lives.  A leaf we've already instantiated
+  would still think it lives where it used to, so let it go.
+*/
+void LeafProxy::pack_location(const PackLocation &in) {
+  delete_leaf();
+  location = in;
+}
+
+/*
+  Hold key and payload ourselves rather than in a leaf.  We keep our
+  name, or make one up if we have none, since the root knows us by it.
+
+  A leaf we had already written stays where it was, so the caller
+  should erase it once the root no longer needs it.
+*/
+void LeafProxy::set_inline(const string &in_key, const string &in_payload) {
+  validate();
+  if (!inlined && input_base_name.empty())
+    input_base_name = the_leaf ? the_leaf->basename() : File().basename();
+  delete_leaf();
+  location = PackLocation();
+  inlined = true;
+  cached_key = in_key;
+  cached_folded_key.clear();
+  inline_payload = in_payload;
+  filter.reset();
+  validate();
+}
+
+/*
+  Return the leaf's cipher text without decrypting it.  This is for
+  moving leaves between files and packs, which needn't know what
+  they're moving.  An inline leaf has none.
+*/
+string LeafProxy::cipher_text() const {
+  validate();
+  if (inlined)
+    throw(runtime_error("Inline leaf has no cipher text."));
+  if (the_leaf)
+    return the_leaf->cipher_text();
+  init_leaf(false);
+  string out_cipher_text(the_leaf->cipher_text());
+  delete_leaf();
+  return out_cipher_text;
+}
+
+/*
+  Forget the loaded leaf, if any, so that the next access goes back
+  to the leaf's file (or to the leaf cache, which checks the file's
+  version).  This is for long-lived clients, since another process
+  may rewrite the leaf.
+*/
+void LeafProxy::unload() const {
+  validate();
+  delete_leaf();
+}
+
 /*
   Commit any changes to the leaf.
   If we haven't loaded a leaf, just return without doing anything.
+
+  A packed leaf moves on every commit, so take note of where it went.
+  The root must then persist the new location.
 */
 void LeafProxy::commit() {
   validate();
   if (the_leaf && !mode(ReadOnly)) {
     the_leaf->commit();
+    location = the_leaf->location();
     validate();
     if (mode(Verbose))
       cout << "leaf committed" << endl;
@@ -224,13 +365,21 @@ void LeafProxy::commit() {
   process, load the leaf if we need to.  If we later try to read from
   the leaf, we'll get an error, but writing will succeed (and will
   recreate the leaf).
+
+  An inline leaf has nothing to remove but what we hold.
 */
 void LeafProxy::erase() {
   validate();
+  if (inlined) {
+    inline_payload.clear();
+    return;
+  }
   if (!the_leaf)
     // Initialize without loading
-    the_leaf = new Leaf(password, input_base_name, input_dir_name, false);
+    the_leaf =
+        new Leaf(cipher, input_base_name, input_dir_name, false, location);
   the_leaf->erase();
+  location = the_leaf->location();
   the_leaf = NULL;
   validate();
   if (mode(Verbose))
@@ -244,7 +393,8 @@ void LeafProxy::init_leaf(bool do_load) const {
   validate();
   if (the_leaf)
     return;
-  the_leaf = new Leaf(password, input_base_name, input_dir_name, do_load);
+  the_leaf =
+      new Leaf(cipher, input_base_name, input_dir_name, do_load, location);
   validate();
 }
 
@@ -264,6 +414,10 @@ void LeafProxy::delete_leaf() const {
   does load and is consistent.
 */
 void LeafProxy::validate(bool force_load) const {
+  if (inlined) {
+    assert(!the_leaf);
+    return;
+  }
   if (force_load) {
     init_leaf(); // which will in turn re-call validate()
     return;
@@ -272,10 +426,10 @@ void LeafProxy::validate(bool force_load) const {
     return;
   assert(valid);
   assert((void *)the_leaf > (void *)0x1FF); // kludge, catch some bad pointers
-  // Is it worth making a password accessor in leaf just to check this?
+  // Is it worth making a cipher accessor in leaf just to check this?
   // Indeed, does it even need to be true?  We could, in priciple, have
   // different passwords for each leaf.
-  // assert(password == the_leaf->password);
+  // assert(cipher == the_leaf->cipher);
   if (the_leaf->is_loaded() &&
       ("" != cached_key && cached_key != the_leaf->key()))
     throw(runtime_error("Bad cached key."));
@@ -20,6 +20,9 @@
 #include "srd.h"
 
 #include <iostream>
+#include <iterator>
+#include <set>
+#include <vector>
 
 using namespace srd;
 using namespace std;
@@ -31,6 +34,9 @@ using namespace std;
   always begin by doing key search.
 
   Key search is always a disjunction on the pattern space.
+
+  The filters copy what they find.  To search without copying, or to
+  combine searches in one pass, use LeafQuery.
 */
 LeafProxyMap LeafProxyMap::filter_keys(const srd::vector_string &patterns,
                                        const bool exact,
@@ -38,20 +44,44 @@ LeafProxyMap LeafProxyMap::filter_keys(const srd::vector_string &patterns,
   if (0 == patterns.size())
     // Empty pattern set should pass everything rather than exclude everything.
     return *this;
-  LeafProxyMap results = LeafProxyMap();
-  for (iterator it = begin(); it != end(); it++) {
-    LeafProxy &proxy = (*it).second;
-    bool found_in_this_proxy = false;
-    for (vector_string::const_iterator pat_it = patterns.begin();
-         !found_in_this_proxy && pat_it != patterns.end(); pat_it++) {
-      if ((exact && in_matcher(*pat_it, proxy.key())) ||
-          (!exact && in_matcher.contains(proxy.key(), *pat_it))) {
-        found_in_this_proxy = true;
-        results[it->first] = proxy;
-      }
+  return subset(LeafQuery(*this, in_matcher).keys(patterns, exact).run());
+}
+
+/*
+  If we have an index, set names to the leaves whose payloads might
+  match patterns and return true.  If we can't narrow the search,
+  return false.
+
+  Patterns too short to have trigrams could match anywhere, so they
+  don't narrow a conjunction and they defeat a disjunction.
+*/
+bool LeafProxyMap::index_candidates(const vector_string &patterns,
+                                    const bool disjunction,
+                                    set<string> &names) const {
+  if (!payload_index)
+    return false;
+  bool narrowed = false;
+  for (vector_string::const_iterator pat_it = patterns.begin();
+       pat_it != patterns.end(); pat_it++) {
+    set<string> these;
+    if (!payload_index->candidates(*pat_it, these)) {
+      if (disjunction)
+        return false;
+      continue;
+    }
+    if (!narrowed)
+      names.swap(these);
+    else if (disjunction)
+      names.insert(these.begin(), these.end());
+    else {
+      set<string> both;
+      set_intersection(names.begin(), names.end(), these.begin(),
+                       these.end(), inserter(both, both.begin()));
+      names.swap(both);
     }
+    narrowed = true;
   }
-  return results;
+  return narrowed;
 }
 
 /*
@@ -66,37 +96,17 @@ LeafProxyMap LeafProxyMap::filter_payloads(const vector_string &patterns,
   if (0 == patterns.size())
     // Empty pattern set should pass everything rather than exclude everything.
     return *this;
-  LeafProxyMap results = LeafProxyMap();
-  for (iterator it = begin(); it != end(); it++) {
-    LeafProxy &proxy = (*it).second;
-    if (disjunction) {
-      // disjunction
-      bool found_in_this_proxy = false;
-      for (vector_string::const_iterator pat_it = patterns.begin();
-           !found_in_this_proxy && pat_it != patterns.end(); pat_it++) {
-        if (in_matcher.contains(proxy.payload(), *pat_it)) {
-          found_in_this_proxy = true;
-          results[it->first] = proxy;
-        }
-      }
-    } else {
-      // conjunction
-      bool found_in_this_proxy = true;
-      for (vector_string::const_iterator pat_it = patterns.begin();
-           found_in_this_proxy && pat_it != patterns.end(); pat_it++) {
-        if (!in_matcher.contains(proxy.payload(), *pat_it))
-          found_in_this_proxy = false;
-      }
-      if (found_in_this_proxy)
-        results[it->first] = proxy;
-    }
-  }
-  return results;
+  return subset(
+      LeafQuery(*this, in_matcher).payloads(patterns, disjunction).run());
 }
 
 /*
   Return leaf proxies for all leaves whose key matches key_pattern or
   whose payload matches payload_pattern.
+
+  Keys are cheap, so we check them first.  Only leaves whose keys
+  don't match (and that the index, if any, doesn't rule out) need
+  loading.
 */
 LeafProxyMap
 LeafProxyMap::filter_keys_or_payloads(const vector_string &patterns,
@@ -105,27 +115,19 @@ LeafProxyMap::filter_keys_or_payloads(const vector_string &patterns,
   if (0 == patterns.size())
     // Empty pattern set should pass everything rather than exclude everything.
     return *this;
+  return subset(
+      LeafQuery(*this, in_matcher).keys_or_payloads(patterns, exact).run());
+}
 
+/*
+  Return a map of copies of leaves, which share our index.
+*/
+LeafProxyMap LeafProxyMap::subset(const vector<iterator> &leaves) const {
   LeafProxyMap results = LeafProxyMap();
-  for (iterator it = begin(); it != end(); it++) {
-    LeafProxy &proxy = (*it).second;
-    bool found_in_this_proxy = false;
-    for (vector_string::const_iterator pat_it = patterns.begin();
-         !found_in_this_proxy && pat_it != patterns.end(); pat_it++) {
-      if ((exact && in_matcher(proxy.key(), *pat_it)) ||
-          (!exact && in_matcher.contains(proxy.key(), *pat_it))) {
-        found_in_this_proxy = true;
-        results[it->first] = proxy;
-      }
-    }
-    for (vector_string::const_iterator pat_it = patterns.begin();
-         !found_in_this_proxy && pat_it != patterns.end(); pat_it++) {
-      if (in_matcher.contains(proxy.payload(), *pat_it)) {
-        found_in_this_proxy = true;
-        results[it->first] = proxy;
-      }
-    }
-  }
+  results.payload_index = payload_index;
+  for (vector<iterator>::const_iterator it = leaves.begin();
+       it != leaves.end(); ++it)
+    results[(*it)->first] = (*it)->second;
   return results;
 }
 
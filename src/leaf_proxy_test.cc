@@ -82,6 +82,30 @@ int test_leaf_proxy(const string message) {
 
   return ret;
 }
+
+/*
+  Confirm that the folded key follows the key.
+*/
+int test_folded_key() {
+  int ret = 0;
+  LeafProxy proxy(pseudo_random_string(20), "", "");
+  proxy.set_inline("Mixed Case key", "payload");
+  if (proxy.folded_key() != "MIXED CASE KEY") {
+    cout << "Folded key is \"" << proxy.folded_key() << "\"." << endl;
+    ret++;
+  }
+  proxy.key("another Key");
+  if (proxy.folded_key() != "ANOTHER KEY") {
+    cout << "Folded key didn't follow key." << endl;
+    ret++;
+  }
+  LeafProxy copy(proxy);
+  if (copy.folded_key() != "ANOTHER KEY") {
+    cout << "Folded key wasn't copied." << endl;
+    ret++;
+  }
+  return ret;
+}
 }
 
 int main(int argc, char *argv[]) {
@@ -94,6 +118,7 @@ int main(int argc, char *argv[]) {
   int err_count = 0;
   vector_string messages = test_text();
   err_count = count_if(messages.begin(), messages.end(), test_leaf_proxy);
+  err_count += test_folded_key();
 
   if (err_count)
     cout << "Errors (" << err_count << ") in test!!" << endl;
@@ -0,0 +1,254 @@
+/*
+  Copyright 2026  Jeff Abrahamson
+
+  This file is part of srd.
+
+  srd is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  srd is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with srd.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "srd.h"
+
+using namespace srd;
+using namespace std;
+
+LeafQuery::LeafQuery(LeafProxyMap &leaves, const StringMatcher &matcher)
+    : m_leaves(leaves), m_matcher(matcher), m_within(false) {}
+
+LeafQuery &LeafQuery::keys(const vector_string &patterns, const bool exact) {
+  add(Keys, patterns, exact, true);
+  return *this;
+}
+
+LeafQuery &LeafQuery::payloads(const vector_string &patterns,
+                               const bool disjunction) {
+  add(Payloads, patterns, false, disjunction);
+  return *this;
+}
+
+LeafQuery &LeafQuery::keys_or_payloads(const vector_string &patterns,
+                                       const bool exact) {
+  add(KeysOrPayloads, patterns, exact, true);
+  return *this;
+}
+
+LeafQuery &LeafQuery::within(const Results &leaves) {
+  m_within = true;
+  m_candidates = leaves;
+  return *this;
+}
+
+/*
+  An empty pattern set passes everything rather than excluding
+  everything, so it isn't a predicate at all.
+*/
+void LeafQuery::add(const Kind kind, const vector_string &patterns,
+                    const bool exact, const bool disjunction) {
+  if (patterns.empty())
+    return;
+  Predicate predicate;
+  predicate.kind = kind;
+  predicate.patterns = patterns;
+  predicate.exact = exact;
+  predicate.disjunction = disjunction;
+  predicate.narrowed = false;
+  if (m_matcher.folds_case())
+    for (vector_string::const_iterator it = patterns.begin();
+         it != patterns.end(); ++it)
+      predicate.folded.push_back(fold_case(*it));
+  if (m_matcher.substring())
+    predicate.compiled.reset(new PatternSet(patterns, m_matcher.folds_case()));
+  m_predicates.push_back(predicate);
+}
+
+/*
+  Return the leaves that satisfy every predicate.
+
+  Each leaf is decided by one worker, start to finish, so no two
+  threads touch the same proxy.  We note matches by position and only
+  then gather them, so results don't depend on which thread finished
+  first.
+*/
+LeafQuery::Results LeafQuery::run() {
+  StageTimer timer(StageFilter);
+  stable_sort(m_predicates.begin(), m_predicates.end(),
+              [](const Predicate &a, const Predicate &b) {
+                return a.kind < b.kind;
+              });
+  bool any_keys = false;
+  for (vector<Predicate>::iterator it = m_predicates.begin();
+       it != m_predicates.end(); ++it) {
+    if (Payloads != it->kind)
+      any_keys = true;
+    if (Keys == it->kind)
+      continue;
+    // The index and payload filters know substrings, so ask them
+    // about what every match must contain.
+    it->literals.clear();
+    for (vector_string::const_iterator pat = it->patterns.begin();
+         pat != it->patterns.end(); ++pat)
+      it->literals.push_back(m_matcher.literal(*pat));
+    it->narrowed = m_leaves.index_candidates(
+        it->literals, Payloads == it->kind ? it->disjunction : true,
+        it->names);
+  }
+
+  Results leaves;
+  if (m_within)
+    leaves.swap(m_candidates);
+  else {
+    leaves.reserve(m_leaves.size());
+    for (LeafProxyMap::iterator it = m_leaves.begin(); it != m_leaves.end();
+         ++it)
+      leaves.push_back(it);
+  }
+  if (any_keys)
+    stats_count(CountKeysExamined, leaves.size());
+  vector<char> matched(leaves.size(), false);
+  parallel_for(leaves.size(),
+               [&](size_t i) { matched[i] = matches(*leaves[i]); });
+
+  Results results;
+  for (size_t i = 0; i < leaves.size(); ++i)
+    if (matched[i])
+      results.push_back(leaves[i]);
+  return results;
+}
+
+/*
+  Order results by key, as we display them.
+*/
+void LeafQuery::sort_by_key(Results &results) {
+  stable_sort(results.begin(), results.end(),
+              [](const LeafProxyMap::iterator &a,
+                 const LeafProxyMap::iterator &b) {
+                return a->second.key() < b->second.key();
+              });
+}
+
+/*
+  Return true if text contains all (if all) or any of the predicate's
+  patterns.  If we could compile the patterns, that's one pass over
+  text, else one per pattern.
+*/
+bool LeafQuery::contains(const Predicate &predicate, const string &text,
+                         const bool all) const {
+  if (predicate.compiled)
+    return predicate.compiled->matches(text, all);
+  for (vector_string::const_iterator it = predicate.patterns.begin();
+       it != predicate.patterns.end(); ++it) {
+    bool found = m_matcher.contains(text, *it);
+    if (found && !all)
+      return true;
+    if (!found && all)
+      return false;
+  }
+  return all;
+}
+
+/*
+  If the matcher folds case, key is already folded, so an exact match
+  is a plain comparison with the folded patterns.
+*/
+bool LeafQuery::key_matches(const Predicate &predicate,
+                            const string &key) const {
+  if (!predicate.exact)
+    return contains(predicate, key, false);
+  if (m_matcher.folds_case())
+    return predicate.folded.end() !=
+           find(predicate.folded.begin(), predicate.folded.end(), key);
+  for (vector_string::const_iterator it = predicate.patterns.begin();
+       it != predicate.patterns.end(); ++it)
+    if (m_matcher(key, *it))
+      return true;
+  return false;
+}
+
+bool LeafQuery::payload_matches(const Predicate &predicate,
+                                const string &payload) const {
+  return contains(predicate, payload, !predicate.disjunction);
+}
+
+/*
+  Return false if the leaf's payload filter, if it has one, says its
+  payload can't match the predicate's patterns.
+*/
+bool LeafQuery::filter_allows(const Predicate &predicate,
+                              const LeafProxy &proxy) const {
+  const boost::shared_ptr<const PayloadFilter> &filter =
+      proxy.payload_filter();
+  if (!filter)
+    return true;
+  const bool all = Payloads == predicate.kind && !predicate.disjunction;
+  for (vector_string::const_iterator it = predicate.literals.begin();
+       it != predicate.literals.end(); ++it)
+    if (filter->might_contain(*it) != all)
+      return !all;
+  return all;
+}
+
+/*
+  Decide one leaf.  First settle everything the key, the index, and
+  the payload filter can, then load the payload, once, for whatever
+  remains.
+*/
+bool LeafQuery::matches(LeafProxyMap::value_type &leaf) const {
+  LeafProxy &proxy = leaf.second;
+  // The key, folded if the matcher folds case, fetched once if needed.
+  string plain_key;
+  const string *key = NULL;
+  // What the key and filter don't settle.  Only allocated when we'll
+  // load the payload anyway, which costs far more.
+  vector<const Predicate *> remaining;
+  for (vector<Predicate>::const_iterator it = m_predicates.begin();
+       it != m_predicates.end(); ++it) {
+    if (Payloads != it->kind && !key) {
+      if (m_matcher.folds_case())
+        key = &proxy.folded_key();
+      else {
+        plain_key = proxy.key();
+        key = &plain_key;
+      }
+    }
+    if (Keys == it->kind) {
+      if (!key_matches(*it, *key))
+        return false;
+    } else if (KeysOrPayloads == it->kind && key_matches(*it, *key))
+      continue;
+    else if (it->narrowed && !it->names.count(leaf.first))
+      return false;
+    else if (!filter_allows(*it, proxy)) {
+      stats_count(CountPayloadsFiltered);
+      return false;
+    } else
+      remaining.push_back(&*it);
+  }
+  if (remaining.empty())
+    return true;
+
+  stats_count(CountPayloadsExamined);
+  const string payload = proxy.payload();
+  for (vector<const Predicate *>::const_iterator it = remaining.begin();
+       it != remaining.end(); ++it) {
+    if (!payload_matches(**it, payload)) {
+      proxy.unload();
+      return false;
+    }
+  }
+  return true;
+}
@@ -0,0 +1,249 @@
+/*
+  Copyright 2026  Jeff Abrahamson
+
+  This file is part of srd.
+
+  srd is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  srd is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with srd.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include "srd.h"
+#include "test_text.h"
+
+using namespace srd;
+using namespace std;
+
+namespace {
+
+/*
+  Make a root of a few copies of our test text, keyed by copy and
+  size, and return its password.
+*/
+string make_root() {
+  string password = pseudo_random_string(20);
+  Root root(password, "", true);
+  vector_string messages = test_text();
+  for (int copy = 0; copy < 3; ++copy)
+    for (size_t i = 0; i < messages.size(); ++i) {
+      ostringstream key;
+      key << "copy " << copy << ", size " << messages[i].size();
+      root.add_leaf(key.str(), messages[i], false);
+    }
+  root.commit();
+  return password;
+}
+
+/*
+  Confirm that a query finds what the filters, one after another,
+  find.
+*/
+int check_query(Root &root, const vector_string &keys,
+                const vector_string &payloads, const vector_string &either,
+                const bool disjunction, const StringMatcher &matcher) {
+  LeafProxyMap expected = root.filter_keys(keys, false, matcher);
+  if (!payloads.empty())
+    expected = expected.filter_payloads(payloads, disjunction, matcher);
+  if (!either.empty())
+    expected = expected.filter_keys_or_payloads(either, false, matcher);
+  LeafQuery::Results results = LeafQuery(root, matcher)
+                                   .keys(keys, false)
+                                   .payloads(payloads, disjunction)
+                                   .keys_or_payloads(either, false)
+                                   .run();
+  bool same = results.size() == expected.size();
+  for (size_t i = 0; same && i < results.size(); ++i)
+    same = expected.end() != expected.find(results[i]->first);
+  if (same)
+    return 0;
+  cout << "Query found " << results.size() << " leaves, filters found "
+       << expected.size() << "." << endl;
+  return 1;
+}
+
+int test_queries(Root &root) {
+  int ret = 0;
+  vector_string none;
+  vector_string copy_one(1, "copy 1");
+  vector_string forest(1, "forest");
+  vector_string forest_ocean;
+  forest_ocean.push_back("forest");
+  forest_ocean.push_back("ocean");
+  vector_string size_or_woman;
+  size_or_woman.push_back("size 0");
+  size_or_woman.push_back("woman");
+
+  ret += check_query(root, none, none, none, false, IdentStringMatcher());
+  ret += check_query(root, copy_one, none, none, false, IdentStringMatcher());
+  ret += check_query(root, none, forest, none, false, IdentStringMatcher());
+  ret += check_query(root, copy_one, forest_ocean, none, false,
+                     IdentStringMatcher());
+  ret += check_query(root, copy_one, forest_ocean, none, true,
+                     IdentStringMatcher());
+  ret += check_query(root, none, none, size_or_woman, false,
+                     IdentStringMatcher());
+  ret += check_query(root, copy_one, forest, size_or_woman, true,
+                     UpperStringMatcher());
+  return ret;
+}
+
+/*
+  Confirm that a query decrypts each leaf at most once, that key
+  predicates spare us loading, and that what matched stays loaded.
+*/
+int test_loading(Root &root) {
+  int ret = 0;
+  const size_t budget = leaf_cache().budget();
+  leaf_cache().budget(0);
+  for (Root::iterator it = root.begin(); it != root.end(); ++it)
+    it->second.unload();
+  stats(true);
+  stats_clear();
+
+  vector_string forest(1, "forest");
+  vector_string ocean(1, "ocean");
+  LeafQuery::Results results = LeafQuery(root, IdentStringMatcher())
+                                   .payloads(forest, false)
+                                   .keys_or_payloads(ocean, false)
+                                   .payloads(forest, true)
+                                   .run();
+  if (stats_calls(StageDecrypt) > root.size()) {
+    cout << "Query decrypted " << stats_calls(StageDecrypt) << " times for "
+         << root.size() << " leaves." << endl;
+    ret++;
+  }
+  if (results.empty()) {
+    cout << "Query found nothing." << endl;
+    ret++;
+  }
+  stats_clear();
+  for (size_t i = 0; i < results.size(); ++i)
+    results[i]->second.payload();
+  if (stats_calls(StageDecrypt)) {
+    cout << "Results were not kept loaded." << endl;
+    ret++;
+  }
+
+  vector_string no_key(1, "no such key");
+  LeafQuery(root, IdentStringMatcher())
+      .payloads(forest, false)
+      .keys(no_key, false)
+      .run();
+  if (stats_counter(CountPayloadsExamined)) {
+    cout << "Query loaded payloads its key predicate ruled out." << endl;
+    ret++;
+  }
+
+  stats(false);
+  leaf_cache().budget(budget);
+  return ret;
+}
+
+/*
+  Confirm that payload filters spare us loading leaves that can't
+  match.
+*/
+int test_filtering(Root &root) {
+  int ret = 0;
+  stats(true);
+  stats_clear();
+  vector_string nowhere(1, "no such payload");
+  LeafQuery::Results results =
+      LeafQuery(root, IdentStringMatcher()).payloads(nowhere, false).run();
+  if (!results.empty() ||
+      stats_counter(CountPayloadsFiltered) < root.size() / 2 ||
+      stats_counter(CountPayloadsFiltered) +
+              stats_counter(CountPayloadsExamined) !=
+          root.size()) {
+    cout << "Filters ruled out " << stats_counter(CountPayloadsFiltered)
+         << " of " << root.size() << " leaves." << endl;
+    ret++;
+  }
+  stats(false);
+  return ret;
+}
+
+/*
+  Confirm that results sort by key.
+*/
+int test_sort(Root &root) {
+  vector_string all(1, "");
+  LeafQuery::Results results =
+      LeafQuery(root, IdentStringMatcher()).keys(all, false).run();
+  LeafQuery::sort_by_key(results);
+  for (size_t i = 1; i < results.size(); ++i)
+    if (results[i - 1]->second.key() > results[i]->second.key()) {
+      cout << "Results out of order." << endl;
+      return 1;
+    }
+  return results.size() == root.size() ? 0 : 1;
+}
+
+/*
+  Confirm that a query within some leaves looks only at them, and
+  keeps their order.
+*/
+int test_within(Root &root) {
+  LeafQuery::Results some;
+  for (Root::iterator it = root.begin(); it != root.end(); ++it)
+    if (some.size() < 4)
+      some.insert(some.begin(), it);
+  vector_string all(1, "");
+  LeafQuery::Results results = LeafQuery(root, IdentStringMatcher())
+                                   .keys(all, false)
+                                   .within(some)
+                                   .run();
+  if (results != some) {
+    cout << "Query within leaves found " << results.size() << " of "
+         << some.size() << "." << endl;
+    return 1;
+  }
+  return 0;
+}
+}
+
+int main(int argc, char *argv[]) {
+  cout << "Testing leaf_query.cpp" << endl;
+
+  mode(Verbose, false);
+  mode(Testing, true);
+  mode(ReadOnly, false);
+
+  int err_count = 0;
+  string password = make_root();
+  {
+    Root root(password, "");
+    err_count += test_queries(root);
+    err_count += test_loading(root);
+    err_count += test_sort(root);
+    err_count += test_within(root);
+    worker_count(4);
+    err_count += test_queries(root);
+    err_count += test_loading(root);
+    root.filter_leaves(0.01, 1024);
+    err_count += test_queries(root);
+    err_count += test_filtering(root);
+    root.build_index();
+    err_count += test_queries(root);
+    worker_count(1);
+  }
+
+  if (err_count)
+    cout << "Errors (" << err_count << ") in test!!" << endl;
+  else
+    cout << "All tests passed!" << endl;
+  return 0 != err_count;
+}
@@ -21,6 +21,7 @@
 #include <fstream>
 #include <iomanip>
 #include <iostream>
+#include <sstream>
 #include <stdexcept>
 #include <stdio.h>
 #include <stdlib.h>
@@ -40,19 +41,38 @@ class help_exception : public exception {};
 namespace {
 string get_password(const string prompt = "Password:  ");
 
-BPO::variables_map parse_options(int argc, char *argv[]) {
+BPO::variables_map parse_options(const vector_string &args) {
   BPO::options_description general("General options");
   general.add_options()("help,h", "Produce help message")(
       "read-only,R", "Read-only, do not persist data")(
       "database-dir", BPO::value<string>(),
       "Name of directory to use for database instead of default")(
+      "cache-size", BPO::value<unsigned int>(),
+      "Megabytes of decrypted records to keep in memory while running "
+      "(default 16, 0 to disable)")(
+      "jobs,j", BPO::value<unsigned int>(),
+      "Number of threads with which to load and search records "
+      "(default 1, 0 for one per processor)")(
+      "codec", BPO::value<string>(),
+      "Compress records written from now on with this codec:  bzip2 "
+      "(the default), zstd or lz4, if built in")(
+      "codec-level", BPO::value<int>(),
+      "Compression level for --codec (default 0, the codec's default)")(
+      "stats", "On exit, report where time went (reading, decrypting, "
+               "matching, ...) and how many records were loaded")(
+      "allow-legacy", "Read records that fail authentication as written "
+                      "by an older srd, rather than refusing them")(
       "verbose,v", "Emit debugging information");
 
   BPO::options_description actions("Actions (if none, then match)");
-  actions.add_options()
-      /*("shell,s",
-        "Run interactive shell")*/
-      ("edit,e", "Edit record")(
+  actions.add_options()(
+      "shell,s", "Run interactive shell:  enter the password once, then "
+                 "read queries, one per line, written as on the command "
+                 "line (e.g., -m foo -f).  \"quit\" ends the session.")(
+      "socket", BPO::value<string>(),
+      "With --shell, answer queries sent to a UNIX socket at this path "
+      "(one query per connection) rather than from standard input.")(
+      "edit,e", "Edit record")(
           "delete,x", "Delete the results of an (exact) key match.  "
                       "Conceptually -E -m arg, can be used with -mDd.")(
           "delete-all,X",
@@ -69,7 +89,27 @@ BPO::variables_map parse_options(int argc, char *argv[]) {
           "by -f:  each line must either be \"[KEY]\" "
           "for key KEY or else begin with two spaces of indent (which are "
           "disgarded during the input) for data (payload) portion associated "
-          "with the most recent key line.")
+          "with the most recent key line.")(
+          "pack", "Store all records in a single pack file rather than one "
+                  "file per record, which is faster for large databases.  "
+                  "On a database that is already packed, reclaim the space "
+                  "left by edited and deleted records.")(
+          "inline", BPO::value<unsigned int>(),
+          "Store records of at most this many bytes of data with the list "
+          "of keys rather than on their own, so that reading them loads "
+          "no more files.  0 moves every record back out.")(
+          "index", "Maintain an index of record contents, so that searching "
+                   "data (-d, -D) only loads records that might match.  "
+                   "The index is encrypted with the list of keys.  On an "
+                   "indexed database, rebuild the index.")(
+          "filter", BPO::value<double>(),
+          "Keep a filter of each record's data, with this rate of false "
+          "positives (e.g., 0.01), so that searching data (-d, -D) skips "
+          "most records that don't match without loading them.  The "
+          "filters are encrypted with the list of keys.  0 removes them.")(
+          "filter-size", BPO::value<unsigned int>(),
+          "With --filter, the most bytes a record's filter may take "
+          "(default 1024).  Larger records get more false positives.")
 #if LATER_URL_EXPORT
           ("export-as-url", BPO::value<string>(),
            "Produce a URL of the form srd://d/ url, the tail of which (after "
@@ -107,7 +147,15 @@ BPO::variables_map parse_options(int argc, char *argv[]) {
       "match-data,d", BPO::value<vector_string>(),
       "Restrict to records whose data match all patterns (cf. -J)")(
       "exact-match,E", "Exact key match")(
+      "prefix", BPO::value<vector_string>(),
+      "Restrict to records whose keys begin with this (case sensitive)")(
+      "from", BPO::value<string>(),
+      "Restrict to records whose keys sort at or after this")(
+      "before", BPO::value<string>(),
+      "Restrict to records whose keys sort before this")(
       "ignore-case,i", "Match without case.  (Does not affect -g,--grep.)")(
+      "regex,r", "Patterns (-m, -d, -D) are regular expressions "
+                 "(ECMAScript).  With -E, keys must match entirely.")(
       "disjunction,J",
       "When matching multiple patterns against payloads with "
       "-d, --match-data, use inclusive or (any hit is sufficient)");
@@ -133,7 +181,7 @@ BPO::variables_map parse_options(int argc, char *argv[]) {
   pos.add("match-key", -1);
 
   BPO::variables_map opt_map;
-  BPO::store(BPO::command_line_parser(argc, argv)
+  BPO::store(BPO::command_line_parser(args)
                  .options(options)
                  .positional(pos)
                  .run(),
@@ -150,6 +198,11 @@ BPO::variables_map parse_options(int argc, char *argv[]) {
          << endl;
     cout << "  Key-match-pattern, if present, is the same as specifying -m."
          << endl;
+    cout << "  Multiple prefixes (--prefix) match as inclusive or.  Prefixes"
+         << endl;
+    cout << "    and ranges (--from, --before) look keys up in order rather"
+         << endl;
+    cout << "    than scanning them." << endl;
     cout << "  To create a new record, use -e with no pattern." << endl;
     cout << endl;
 
@@ -179,10 +232,7 @@ string get_password(const string prompt) {
   tcsetattr(STDIN_FILENO, TCSANOW, &before);
   cout << endl;
 
-  // Iterate hash (arbitrarily) 50 times.  Motivated by gpg's behavior.
-  string digest(pass_phrase);
-  for (int i = 0; i < 50; i++)
-    digest = message_digest(digest, false);
+  string digest = password_from_pass_phrase(pass_phrase);
 
   // Clear original pass phrase to minimize risk of seeing it in a swap or core
   // image
@@ -191,19 +241,133 @@ string get_password(const string prompt) {
   return digest;
 }
 
+void run_query(Root &root, const BPO::variables_map &options,
+               const bool interactive);
+
+/*
+  For --stats, report on the way out, whichever way that is.  Stats
+  go to stderr, so as not to mix with records.
+*/
+void report_stats() { print_stats(cerr); }
+
+/*
+  Options that only make sense once per process.
+*/
+const char *const session_excluded_options[] = {
+    "read-only", "database-dir", "cache-size", "jobs",   "codec",
+    "codec-level", "stats",      "verbose",    "passwd", "create",
+    "import",    "pack",         "inline",     "index",  "filter",
+    "filter-size", "shell",      "socket",     "allow-legacy", "TEST"};
+
+/*
+  Run one line of a shell session against root.
+  Return false if the session should end.
+
+  Errors are reported and the session continues.  The root checks
+  for external modification before each query, and we commit after
+  each one, so that other processes see what we do.
+*/
+bool session_query(Root &root, const string &line, const bool interactive) {
+  vector_string args;
+  BPO::variables_map options;
+  try {
+    args = split_command_line(line);
+    if (args.empty())
+      return true;
+    if (1 == args.size() && ("quit" == args[0] || "exit" == args[0]))
+      return false;
+    options = parse_options(args);
+  } catch (const help_exception &) {
+    return true;
+  } catch (const exception &e) {
+    cerr << e.what() << endl;
+    return true;
+  }
+  for (const char *name : session_excluded_options)
+    if (options.count(name)) {
+      cerr << "--" << name << " is not available in a shell session." << endl;
+      return true;
+    }
+  try {
+    if (root.refresh() && mode(Verbose))
+      cout << "Database changed on disk, reloaded." << endl;
+    if (options.count("validate"))
+      root.validate(true);
+    else if (options.count("checksum"))
+      root.checksum(true);
+    else
+      run_query(root, options, interactive);
+    root.commit();
+  } catch (const runtime_error &e) {
+    cerr << e.what() << endl;
+  }
+  return true;
+}
+
+/*
+  While alive, send everything written to cout and cerr to out, and
+  give cin nothing to read, so that a query can't prompt a socket
+  client.
+*/
+class StreamCapture {
+public:
+  StreamCapture(ostringstream &out)
+      : old_cout(cout.rdbuf(out.rdbuf())), old_cerr(cerr.rdbuf(out.rdbuf())),
+        old_cin(cin.rdbuf(no_input.rdbuf())) {}
+  ~StreamCapture() {
+    cout.rdbuf(old_cout);
+    cerr.rdbuf(old_cerr);
+    cin.rdbuf(old_cin);
+    cin.clear();
+  }
+
+private:
+  istringstream no_input;
+  streambuf *old_cout;
+  streambuf *old_cerr;
+  streambuf *old_cin;
+};
+
 /*
-  Authenticate once, then permit multiple queries.
-  If we implement this, we'll need to do a bit more work
-  to protect against leaves being modified externally.
-  In addition, the root currently protects itself by emitting
-  a warning about what has happened and then throwing (and
-  so exiting).  That's perhaps fine for the unlikely scenario
-  in a CLI program, but not so much if we are going to be persistant.
-  Cf. issue #1.
+  Authenticate once, then answer many queries.
+
+  Loading the root (deriving its name from the password, decrypting
+  and parsing it) is the bulk of a typical query's cost, so a session
+  only pays it when the root changes on disk.  Leaves stay in the
+  leaf cache.
+
+  Queries come from standard input unless socket_path is given, in
+  which case each connection to the socket carries one query and
+  gets back its output.  Editing needs a terminal, so isn't possible
+  over the socket.
 */
-void do_shell(const string &password) {
-  // ################
-  cout << "do_shell() not yet implemented." << endl;
+void do_shell(const string &password, const string &socket_path) {
+  Root root(password, "");
+  if (socket_path.empty()) {
+    const bool prompt = isatty(STDIN_FILENO);
+    string line;
+    while (true) {
+      if (prompt)
+        cout << "srd> " << flush;
+      if (!getline(cin, line))
+        break;
+      if (!session_query(root, line, true))
+        break;
+    }
+    return;
+  }
+  cout << "Listening on " << socket_path << endl;
+  serve_unix_socket(socket_path,
+                    [&root](const string &request, string &response) {
+                      ostringstream out;
+                      bool more;
+                      {
+                        StreamCapture capture(out);
+                        more = session_query(root, request, false);
+                      }
+                      response = out.str();
+                      return more;
+                    });
 }
 
 /*
@@ -254,11 +418,26 @@ bool change_password(const string &password) {
    **********************************************************************
    */
 
-LeafProxyMap get_leaf_proxy_map(Root &root, const vector_string &match_key,
-                                const vector_string &match_data,
-                                const vector_string &match_or,
-                                const bool match_exact, const bool disjunction,
-                                const StringMatcher &in_matcher);
+/*
+  The keys a query is restricted to, which we find in the root's key
+  index rather than by looking at every key.
+*/
+struct KeyScope {
+  vector_string prefixes; // Any of these, if any.
+  string from;            // At or after this.
+  string before;          // Before this, if not empty.
+
+  bool empty() const {
+    return prefixes.empty() && from.empty() && before.empty();
+  }
+};
+
+LeafQuery::Results query_leaves(Root &root, const vector_string &match_key,
+                               const vector_string &match_data,
+                               const vector_string &match_or,
+                               const bool match_exact, const bool disjunction,
+                               const KeyScope &scope,
+                               const StringMatcher &in_matcher);
 void user_add(Root &root);
 bool user_edit(string &key, string &payload);
 
@@ -266,7 +445,8 @@ class LeafVisitor {
 
 public:
   virtual ~LeafVisitor(){};
-  virtual void operator()(const LeafProxyMap &lpm) const = 0;
+  // Results are in key order.
+  virtual void operator()(const LeafQuery::Results &leaves) const = 0;
 };
 
 /*
@@ -279,7 +459,7 @@ public:
                    const string in_grep)
       : keys_only(in_keys_only), full_display(in_full_display), grep(in_grep){};
 
-  void operator()(const LeafProxyMap &lpm) const {
+  void operator()(const LeafQuery::Results &leaves) const {
     /*
       If one hit
       ...and key_display, display only key.
@@ -291,14 +471,13 @@ public:
       ...and full_display, display all data.
       ...else display only keys.
     */
-    bool full_display_on =
-        ((full_display && lpm.size() > 1) || (!keys_only && 1 == lpm.size()));
-    LeafProxyMap::LPM_Set leaves = lpm.as_set();
-    for (LeafProxyMap::LPM_Set::iterator it = leaves.begin();
+    bool full_display_on = ((full_display && leaves.size() > 1) ||
+                            (!keys_only && 1 == leaves.size()));
+    for (LeafQuery::Results::const_iterator it = leaves.begin();
          it != leaves.end(); ++it) {
-      (*it).print_key();
+      (*it)->second.print_key();
       if (full_display_on)
-        (*it).print_payload(grep);
+        (*it)->second.print_payload(grep);
     }
   }
 
@@ -319,13 +498,13 @@ class LeafDeleteVisitor : public LeafVisitor {
 public:
   LeafDeleteVisitor(Root &in_root) : the_root(in_root){};
 
-  void operator()(const LeafProxyMap &lpm) const {
-    if (0 == lpm.size()) {
+  void operator()(const LeafQuery::Results &leaves) const {
+    if (0 == leaves.size()) {
       cout << "Nothing to delete." << endl;
       return;
     }
-    if (lpm.size() > 1) {
-      cout << "Delete " << lpm.size() << " items?  (yes/no)  ";
+    if (leaves.size() > 1) {
+      cout << "Delete " << leaves.size() << " items?  (yes/no)  ";
       string response;
       cin >> response;
       if ("y" != response && "Y" != response && "yes" != response &&
@@ -334,8 +513,11 @@ public:
         return;
       }
     }
-    for (LeafProxyMap::const_iterator it = lpm.begin(); it != lpm.end(); ++it)
-      the_root.rm_leaf(it->first);
+    RootBatch batch(the_root);
+    for (LeafQuery::Results::const_iterator it = leaves.begin();
+         it != leaves.end(); ++it)
+      batch.rm_leaf((*it)->first);
+    batch.commit();
   }
 
 private:
@@ -350,13 +532,12 @@ class LeafChecksumVisitor : public LeafVisitor {
 public:
   LeafChecksumVisitor(){};
 
-  void operator()(const LeafProxyMap &lpm) const {
-    LeafProxyMap::LPM_Set leaves = lpm.as_set();
-    for (LeafProxyMap::LPM_Set::iterator it = leaves.begin();
+  void operator()(const LeafQuery::Results &leaves) const {
+    for (LeafQuery::Results::const_iterator it = leaves.begin();
          it != leaves.end(); ++it) {
-      cout << "[" << (*it).key() << "]";
+      cout << "[" << (*it)->second.key() << "]";
       cout << "  ";
-      cout << message_digest((*it).payload()) << endl;
+      cout << message_digest((*it)->second.payload()) << endl;
     }
   }
 };
@@ -370,7 +551,7 @@ class LeafURLExporter : public LeafVisitor {
 public:
   LeafURLExporter(const string &filename) : filename_(filename){};
 
-  void operator()(const LeafProxyMap &lpm) const {
+  void operator()(const LeafQuery::Results &leaves) const {
     string url_password = get_password("Enter URL password:  ");
     string url_password2 = get_password("Retype URL password:  ");
     if (url_password != url_password2) {
@@ -378,11 +559,10 @@ public:
       return;
     }
     map<string, string> to_export;
-    LeafProxyMap::LPM_Set leaves = lpm.as_set();
-    for (const LeafProxy &leaf_proxy : leaves) {
-      to_export[leaf_proxy.key()] = leaf_proxy.payload();
+    for (const LeafProxyMap::iterator &it : leaves) {
+      to_export[it->second.key()] = it->second.payload();
       if (mode(Verbose))
-        cout << leaf_proxy.key() << endl;
+        cout << it->second.key() << endl;
     }
 
     string big_text(big_text_stream.str());
@@ -412,56 +592,56 @@ private:
 
 /*
   Utility function to provide a reference to a StringMatcher (via operator*).
+  A regex matcher compiles patterns, all of the query's, up front.
 */
 const boost::shared_ptr<StringMatcher>
-string_matcher(const bool case_sensitive) {
+string_matcher(const bool case_sensitive, const bool regex,
+               const vector_string &patterns) {
+  if (regex)
+    return boost::shared_ptr<RegexStringMatcher>(
+        new RegexStringMatcher(patterns, case_sensitive));
   if (case_sensitive)
     return boost::shared_ptr<IdentStringMatcher>(new IdentStringMatcher());
   return boost::shared_ptr<UpperStringMatcher>(new UpperStringMatcher());
 }
 
-void do_edit(const string &password, const vector_string &match_key,
+void do_edit(Root &root, const vector_string &match_key,
              const vector_string &match_payload, const vector_string &match_or,
              const bool match_exact, const bool disjunction,
-             const StringMatcher &in_matcher) {
+             const KeyScope &scope, const StringMatcher &in_matcher) {
   if (mode(ReadOnly)) {
-    cerr << "Database is read-only.  Edit not permitted." << endl;
-    return;
-  }
-  Root root(password, "");
-  if (mode(ReadOnly)) {
-    // Maybe instantiating the root discovered
-    // that we don't have write permission.
+    // Either we were asked to be read-only or else instantiating
+    // the root discovered that we don't have write permission.
     cerr << "Database is read-only.  Edit not permitted." << endl;
     return;
   }
 
   if (0 == match_key.size() && 0 == match_payload.size() &&
-      0 == match_or.size()) {
+      0 == match_or.size() && scope.empty()) {
     // Edit request with no search criteria means create new
     user_add(root);
     return;
   }
-  LeafProxyMap lpm =
-      get_leaf_proxy_map(root, match_key, match_payload, match_or, match_exact,
-                         disjunction, in_matcher);
-  if (0 == lpm.size()) {
+  LeafQuery::Results leaves =
+      query_leaves(root, match_key, match_payload, match_or, match_exact,
+                   disjunction, scope, in_matcher);
+  if (0 == leaves.size()) {
     cout << "No record matches." << endl;
     return;
   }
-  if (1 == lpm.size()) {
-    string proxy_key = lpm.begin()->first;
-    LeafProxy lp = lpm.begin()->second;
-    string key = lp.key();
-    string payload = lp.payload();
+  if (1 == leaves.size()) {
+    string proxy_key = leaves[0]->first;
+    string key = leaves[0]->second.key();
+    string payload = leaves[0]->second.payload();
     if (!user_edit(key, payload))
       return;
     root.set_leaf(proxy_key, key, payload);
     return;
   }
 
-  for (LeafProxyMap::iterator it = lpm.begin(); it != lpm.end(); ++it)
-    it->second.print_key();
+  for (LeafQuery::Results::iterator it = leaves.begin(); it != leaves.end();
+       ++it)
+    (*it)->second.print_key();
 
   return;
 }
@@ -469,31 +649,45 @@ void do_edit(const string &password, const vector_string &match_key,
 void do_match(Root &root, const vector_string &match_key,
               const vector_string &match_payload, const vector_string &match_or,
               const bool match_exact, const bool disjunction,
-              const StringMatcher &in_matcher, LeafVisitor *visitor) {
+              const KeyScope &scope, const StringMatcher &in_matcher,
+              LeafVisitor *visitor) {
   if (0 == match_key.size() && 0 == match_payload.size() &&
-      0 == match_or.size()) {
+      0 == match_or.size() && scope.empty()) {
     cerr << "No match criteria provided." << endl;
     cerr << "To match all records, use an empty key (\"\")." << endl;
     return;
   }
-  LeafProxyMap lpm =
-      get_leaf_proxy_map(root, match_key, match_payload, match_or, match_exact,
-                         disjunction, in_matcher);
+  LeafQuery::Results leaves =
+      query_leaves(root, match_key, match_payload, match_or, match_exact,
+                   disjunction, scope, in_matcher);
 
-  (*visitor)(lpm);
+  (*visitor)(leaves);
 }
 
-LeafProxyMap get_leaf_proxy_map(Root &root, const vector_string &match_key,
+/*
+  Return the root's leaves that match, in key order.  Every criterion
+  must hold, and we check them all in one pass over the root, or if
+  the query has a key scope, over the leaves in scope, which come in
+  key order already.
+*/
+LeafQuery::Results query_leaves(Root &root, const vector_string &match_key,
                                 const vector_string &match_payload,
                                 const vector_string &match_or,
                                 const bool match_exact, const bool disjunction,
+                                const KeyScope &scope,
                                 const StringMatcher &in_matcher) {
-  LeafProxyMap lpm = root.filter_keys(match_key, match_exact, in_matcher);
-  if (match_payload.size())
-    lpm = lpm.filter_payloads(match_payload, disjunction, in_matcher);
-  if (match_or.size())
-    lpm = lpm.filter_keys_or_payloads(match_or, match_exact, in_matcher);
-  return lpm;
+  LeafQuery query(root, in_matcher);
+  query.keys(match_key, match_exact)
+      .payloads(match_payload, disjunction)
+      .keys_or_payloads(match_or, match_exact);
+  if (scope.empty()) {
+    LeafQuery::Results leaves = query.run();
+    root.sort_by_key(leaves);
+    return leaves;
+  }
+  return query
+      .within(root.keys_within(scope.prefixes, scope.from, scope.before))
+      .run();
 }
 
 /*
@@ -595,12 +789,88 @@ bool do_import(const string &password, const string &filename) {
   }
 
   Root root(password, "");
+  RootBatch batch(root);
   for (vector<pair<string, string>>::const_iterator it = incoming.begin();
        it != incoming.end(); ++it)
-    root.add_leaf(it->first, it->second, false); // commit at end of scope
+    batch.add_leaf(it->first, it->second);
+  batch.commit();
   return true;
 }
 
+/*
+  Move the database into a (new) pack file.
+
+  Return 0 on success.
+  Return 1 on failure.
+*/
+bool do_pack(const string &password) {
+  try {
+    Root root(password, "");
+    root.repack();
+  } catch (const runtime_error &e) {
+    cerr << "Failed to pack database." << endl;
+    cerr << e.what() << endl;
+    return 1;
+  }
+  return 0;
+}
+
+/*
+  Move small records into the root, and others out of it.
+
+  Return 0 on success.
+  Return 1 on failure.
+*/
+bool do_inline(const string &password, const unsigned int max_size) {
+  try {
+    Root root(password, "");
+    root.inline_leaves(max_size);
+  } catch (const runtime_error &e) {
+    cerr << "Failed to inline records." << endl;
+    cerr << e.what() << endl;
+    return 1;
+  }
+  return 0;
+}
+
+/*
+  Index the database's payloads.
+
+  Return 0 on success.
+  Return 1 on failure.
+*/
+bool do_index(const string &password) {
+  try {
+    Root root(password, "");
+    root.build_index();
+  } catch (const runtime_error &e) {
+    cerr << "Failed to index database." << endl;
+    cerr << e.what() << endl;
+    return 1;
+  }
+  return 0;
+}
+
+/*
+  Filter the database's payloads, or stop filtering them if
+  error_rate is zero.
+
+  Return 0 on success.
+  Return 1 on failure.
+*/
+bool do_filter(const string &password, const double error_rate,
+               const unsigned int max_size) {
+  try {
+    Root root(password, "");
+    root.filter_leaves(error_rate, max_size);
+  } catch (const runtime_error &e) {
+    cerr << "Failed to filter records." << endl;
+    cerr << e.what() << endl;
+    return 1;
+  }
+  return 0;
+}
+
 /*
   Read and parse the import file.
 
@@ -738,76 +1008,41 @@ bool do_checksum(const string &password) {
   }
   return 0;
 }
-}
 
 /*
-  Do that thing that we do.
+  Return the matcher for a query's patterns, or null, having said
+  why, if they won't do.
 */
-int main(int argc, char *argv[]) {
-  GOOGLE_PROTOBUF_VERIFY_VERSION;
-  BPO::variables_map options;
+boost::shared_ptr<StringMatcher>
+query_matcher(const BPO::variables_map &options, const vector_string &match_key,
+              const vector_string &match_data, const vector_string &match_or) {
+  vector_string patterns(match_key);
+  patterns.insert(patterns.end(), match_data.begin(), match_data.end());
+  patterns.insert(patterns.end(), match_or.begin(), match_or.end());
   try {
-    options = parse_options(argc, argv);
-  } catch (const help_exception&) {
-    return 0; // User asked for help, done
-  } catch (const exception &e) {
-    // Something went wrong.  Say so and exit with error.
+    return string_matcher(options.count("ignore-case") == 0,
+                          options.count("regex") > 0, patterns);
+  } catch (const runtime_error &e) {
     cerr << e.what() << endl;
-    // Options aren't available, so be verbose to be clear.
-    cerr << "(Error is fatal, quitting before doing anything.)" << endl;
-    return 1;
+    return boost::shared_ptr<StringMatcher>();
   }
+}
 
-  const bool verbose = (options.count("verbose") > 0);
-  mode(Verbose, verbose);
-  mode(ReadOnly, options.count("read-only") > 0);
-
-  bool is_test = options.count("TEST") > 0;
-  mode(Testing, is_test);
-  bool match_case_sensitive = (options.count("ignore-case") == 0);
+/*
+  Match (and print, delete, edit, or checksum) according to options.
+  If interactive is false, we have no terminal for the user's editor.
+*/
+void run_query(Root &root, const BPO::variables_map &options,
+               const bool interactive) {
   bool disjunction = (options.count("disjunction") > 0);
 
-  if (options.count("database-dir"))
-    set_base_dir(options["database-dir"].as<string>());
-
-  string passwd;
-  if (is_test)
-    passwd = options["TEST"].as<string>();
-  else
-    passwd = get_password();
-
-  // Do something.
-  if (options.count("create") > 0)
-    if (do_create(passwd))
-      return 1; // Password mismatch.
-
-  if (options.count("validate") > 0)
-    return (do_validate(passwd));
-
-  if (options.count("checksum") > 0)
-    return (do_checksum(passwd));
-
-  if (options.count("shell")) {
-    do_shell(passwd);
-    return 0;
-  }
-  if (options.count("passwd")) {
-    change_password(passwd);
-    return 0;
-  }
-  if (options.count("import")) {
-    string filename = options["import"].as<string>();
-    do_import(passwd, filename);
-    return 0;
-  }
-
   // We need to match, either to edit a record or else to
   // display or delete records.
   vector_string match_key, match_or, match_data;
   bool match_exact = false;
   if (options.count("match-key")) {
     match_key = options["match-key"].as<vector_string>();
-    if (verbose) {
+    if (mode(Verbose)) {
       cout << "match-key=";
       copy(match_key.begin(), match_key.end(),
            ostream_iterator<string>(cout, ","));
@@ -816,7 +1051,7 @@ int main(int argc, char *argv[]) {
   }
   if (options.count("match-data-or-key")) {
     match_or = options["match-data-or-key"].as<vector_string>();
-    if (verbose) {
+    if (mode(Verbose)) {
       cout << "match-data-or-key=";
       copy(match_or.begin(), match_or.end(),
            ostream_iterator<string>(cout, ","));
@@ -825,7 +1060,7 @@ int main(int argc, char *argv[]) {
   }
   if (options.count("match-data")) {
     match_data = options["match-data"].as<vector_string>();
-    if (verbose) {
+    if (mode(Verbose)) {
       cout << "match-data=";
       copy(match_data.begin(), match_data.end(),
            ostream_iterator<string>(cout, ","));
@@ -834,18 +1069,30 @@ int main(int argc, char *argv[]) {
   }
   match_exact =
       (options.count("exact-match") > 0) || (options.count("delete") > 0);
-  if (verbose)
+  if (mode(Verbose))
     cout << "match-exact=" << match_exact << endl;
+  KeyScope scope;
+  if (options.count("prefix"))
+    scope.prefixes = options["prefix"].as<vector_string>();
+  if (options.count("from"))
+    scope.from = options["from"].as<string>();
+  if (options.count("before"))
+    scope.before = options["before"].as<string>();
 
   if (options.count("edit")) {
-    do_edit(passwd, match_key, match_data, match_or, match_exact, disjunction,
-            *string_matcher(match_case_sensitive));
-    return 0;
+    if (!interactive) {
+      cerr << "Editing is not available over a socket." << endl;
+      return;
+    }
+    boost::shared_ptr<StringMatcher> matcher =
+        query_matcher(options, match_key, match_data, match_or);
+    if (matcher)
+      do_edit(root, match_key, match_data, match_or, match_exact, disjunction,
+              scope, *matcher);
+    return;
   }
 
   LeafVisitor *lv;
-
-  Root root(passwd, "");
   if (options.count("delete")) {
     match_exact = true;
     lv = new LeafDeleteVisitor(root);
@@ -867,9 +1114,118 @@ int main(int argc, char *argv[]) {
         options.count("keys-only") > 0, options.count("full-display") > 0,
         (options.count("grep") > 0) ? options["grep"].as<string>() : string());
   }
-  do_match(root, match_key, match_data, match_or, match_exact, disjunction,
-           *string_matcher(match_case_sensitive), lv);
+  boost::shared_ptr<StringMatcher> matcher =
+      query_matcher(options, match_key, match_data, match_or);
+  if (matcher)
+    do_match(root, match_key, match_data, match_or, match_exact, disjunction,
+             scope, *matcher, lv);
   delete lv;
+}
+}
+
+/*
+  Do that thing that we do.
+*/
+int main(int argc, char *argv[]) {
+  GOOGLE_PROTOBUF_VERIFY_VERSION;
+  BPO::variables_map options;
+  try {
+    options = parse_options(vector_string(argv + 1, argv + argc));
+  } catch (const help_exception&) {
+    return 0; // User asked for help, done
+  } catch (const exception &e) {
+    // Something went wrong.  Say so and exit with error.
+    cerr << e.what() << endl;
+    // Options aren't available, so be verbose to be clear.
+    cerr << "(Error is fatal, quitting before doing anything.)" << endl;
+    return 1;
+  }
+
+  const bool verbose = (options.count("verbose") > 0);
+  mode(Verbose, verbose);
+  mode(ReadOnly, options.count("read-only") > 0);
+  mode(AllowLegacy, options.count("allow-legacy") > 0);
+
+  bool is_test = options.count("TEST") > 0;
+  mode(Testing, is_test);
+  if (options.count("database-dir"))
+    set_base_dir(options["database-dir"].as<string>());
+  if (options.count("cache-size"))
+    leaf_cache().budget(static_cast<size_t>(
+                            options["cache-size"].as<unsigned int>()) *
+                        1024 * 1024);
+  if (options.count("jobs"))
+    worker_count(options["jobs"].as<unsigned int>());
+  if (options.count("stats")) {
+    stats(true);
+    atexit(report_stats);
+  }
+  if (options.count("codec") || options.count("codec-level")) {
+    try {
+      compression(options.count("codec")
+                      ? codec_named(options["codec"].as<string>())
+                      : compression_codec(),
+                  options.count("codec-level")
+                      ? options["codec-level"].as<int>()
+                      : 0);
+    } catch (const runtime_error &e) {
+      cerr << e.what() << endl;
+      return 1;
+    }
+  }
+
+  string passwd;
+  if (is_test)
+    passwd = options["TEST"].as<string>();
+  else
+    passwd = get_password();
+
+  // Do something.
+  if (options.count("create") > 0)
+    if (do_create(passwd))
+      return 1; // Password mismatch.
+
+  if (options.count("validate") > 0)
+    return (do_validate(passwd));
+
+  if (options.count("checksum") > 0)
+    return (do_checksum(passwd));
+
+  if (options.count("shell") || options.count("socket")) {
+    try {
+      do_shell(passwd, options.count("socket") ? options["socket"].as<string>()
+                                               : string());
+    } catch (const runtime_error &e) {
+      cerr << e.what() << endl;
+      return 1;
+    }
+    return 0;
+  }
+  if (options.count("passwd")) {
+    change_password(passwd);
+    return 0;
+  }
+  if (options.count("import")) {
+    string filename = options["import"].as<string>();
+    do_import(passwd, filename);
+    return 0;
+  }
+  if (options.count("pack"))
+    return (do_pack(passwd));
+  if (options.count("inline"))
+    return (do_inline(passwd, options["inline"].as<unsigned int>()));
+  if (options.count("index"))
+    return (do_index(passwd));
+  if (options.count("filter"))
+    return (do_filter(passwd, options["filter"].as<double>(),
+                      options.count("filter-size")
+                          ? options["filter-size"].as<unsigned int>()
+                          : 1024));
+
+  {
+    Root root(passwd, "");
+    run_query(root, options, true);
+  }
   google::protobuf::ShutdownProtobufLibrary();
   return 0;
 }
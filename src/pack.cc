@@ -0,0 +1,102 @@
+/*
+  Copyright 2026  Jeff Abrahamson
+
+  This file is part of srd.
+
+  srd is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  srd is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with srd.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "srd.h"
+
+using namespace srd;
+using namespace std;
+
+/*
+  As with File, if we don't provide a name, one is generated.
+*/
+Pack::Pack(const string base_name, const string dir_name)
+    : File(base_name, dir_name) {}
+
+/*
+  Return a view of length bytes starting at offset.
+
+  We map the pack once and hand out slices of the mapping, since
+  loading a database means many small reads.  If we're asked for
+  bytes we haven't mapped, the pack has grown, so map it again.
+*/
+boost::shared_ptr<FileView> Pack::view(const uint64_t offset,
+                                       const uint64_t length) {
+  lock_guard<mutex> guard(m_view_mutex);
+  if (!m_view || offset + length > m_view->size())
+    m_view = file_view();
+  if (offset + length > m_view->size()) {
+    ostringstream oss;
+    oss << "Failed to read " << length << " bytes at offset " << offset
+        << " from pack \"" << full_path() << "\" of " << m_view->size()
+        << " bytes.";
+    throw(runtime_error(oss.str()));
+  }
+  return boost::shared_ptr<FileView>(new FileView(m_view, offset, length));
+}
+
+/*
+  Append data to the pack, creating the pack if needed.
+  Return the offset at which data begins.
+*/
+uint64_t Pack::append(const string &data) {
+  Lock L(full_path() + ".lck");
+  int fd = open(full_path().c_str(), O_WRONLY | O_CREAT | O_APPEND, 0600);
+  if (-1 == fd) {
+    ostringstream oss;
+    oss << "Failed to open pack \"" << full_path()
+        << "\" for writing: " << strerror(errno);
+    throw(runtime_error(oss.str()));
+  }
+  // Under the lock, no one else is appending, so the current size
+  // is where our data will land.
+  struct stat stat_buf;
+  if (fstat(fd, &stat_buf)) {
+    int error = errno;
+    close(fd);
+    throw(runtime_error(string("Failed to stat pack:  ") + strerror(error)));
+  }
+  uint64_t offset = stat_buf.st_size;
+  size_t done = 0;
+  while (done < data.size()) {
+    ssize_t ret = write(fd, data.data() + done, data.size() - done);
+    if (-1 == ret && EINTR == errno)
+      continue;
+    if (-1 == ret) {
+      int error = errno;
+      close(fd);
+      throw(
+          runtime_error(string("Failed to write pack:  ") + strerror(error)));
+    }
+    done += ret;
+  }
+  close(fd);
+  return offset;
+}
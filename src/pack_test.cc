@@ -0,0 +1,126 @@
+/*
+  Copyright 2026  Jeff Abrahamson
+
+  This file is part of srd.
+
+  srd is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  srd is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with srd.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "srd.h"
+#include "test_text.h"
+
+using namespace srd;
+using namespace std;
+
+namespace {
+
+/*
+  Append every message to one pack, then read them all back,
+  in reverse order for good measure.
+*/
+int test_pack_append_read(const vector_string &messages) {
+  int ret = 0;
+  boost::shared_ptr<Pack> pack(new Pack("", "/tmp"));
+  vector<uint64_t> offsets;
+  for (vector_string::const_iterator it = messages.begin();
+       it != messages.end(); ++it)
+    offsets.push_back(pack->append(*it));
+  for (int i = messages.size() - 1; i >= 0; --i) {
+    boost::shared_ptr<FileView> view =
+        pack->view(offsets[i], messages[i].size());
+    if (string(view->data(), view->size()) != messages[i]) {
+      cout << "Pack read does not match append (" << i << ")." << endl;
+      ret++;
+    }
+  }
+  try {
+    pack->view(offsets.back() + messages.back().size(), 1);
+    cout << "Read past end of pack did not fail." << endl;
+    ret++;
+  } catch (const runtime_error &e) {
+    // As expected.
+  }
+  pack->rm();
+  return ret;
+}
+
+/*
+  Persist leaves to a pack and reconstitute them from their locations.
+  Then erase one and confirm that it is gone.
+*/
+int test_packed_leaf(const vector_string &messages) {
+  int ret = 0;
+  boost::shared_ptr<Pack> pack(new Pack());
+  vector<PackLocation> locations;
+  vector<string> base_names;
+  for (vector_string::const_iterator it = messages.begin();
+       it != messages.end(); ++it) {
+    string password = message_digest(*it);
+    Leaf leaf(password, "", "", true, PackLocation(pack));
+    leaf.key(message_digest(password));
+    leaf.payload(*it);
+    leaf.commit();
+    if (leaf.exists()) {
+      cout << "Packed leaf has its own file." << endl;
+      ret++;
+    }
+    locations.push_back(leaf.location());
+    base_names.push_back(leaf.basename());
+  }
+  for (unsigned int i = 0; i < messages.size(); ++i) {
+    string password = message_digest(messages[i]);
+    Leaf leaf(password, base_names[i], "", true, locations[i]);
+    if (leaf.key() != message_digest(password) ||
+        leaf.payload() != messages[i]) {
+      cout << "Packed leaf mismatch (" << i << ")." << endl;
+      ret++;
+    }
+    if (0 == i) {
+      leaf.erase();
+      Leaf erased(password, base_names[i], "", true, leaf.location());
+      if (erased.key() != "" || erased.payload() != "") {
+        cout << "Failed to erase packed leaf." << endl;
+        ret++;
+      }
+    }
+  }
+  pack->rm();
+  return ret;
+}
+}
+
+int main(int argc, char *argv[]) {
+  cout << "Testing pack.cpp" << endl;
+
+  mode(Verbose, false);
+  mode(Testing, true);
+  mode(ReadOnly, false);
+
+  int err_count = 0;
+  vector_string messages = test_text();
+  err_count += test_pack_append_read(messages);
+  err_count += test_packed_leaf(messages);
+
+  if (err_count)
+    cout << "Errors (" << err_count << ") in test!!" << endl;
+  else
+    cout << "All tests passed!" << endl;
+  return 0 != err_count;
+}
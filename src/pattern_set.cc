@@ -0,0 +1,181 @@
+/*
+  Copyright 2026  Jeff Abrahamson
+
+  This file is part of srd.
+
+  srd is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  srd is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with srd.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "srd.h"
+
+using namespace srd;
+using namespace std;
+
+namespace {
+const int32_t kNoState = -1;
+const size_t kAlphabet = 256;
+// With this few patterns, a vector scan per pattern beats one pass
+// through the automaton a byte at a time.
+const size_t kKernelPatterns = 4;
+}
+
+/*
+  Build the trie of distinct patterns, then walk it breadth first to
+  find each state's failure link (the state of its longest proper
+  suffix in the trie), filling in missing transitions from the
+  failure state's and collecting the patterns that end there too.
+*/
+PatternSet::PatternSet(const vector_string &patterns, const bool fold_case)
+    : m_fold_case(fold_case), m_distinct(0) {
+  for (size_t c = 0; c < kAlphabet; ++c)
+    m_fold[c] = fold_case ? srd::fold_case(c) : c;
+  add_state();
+
+  map<string, uint32_t> ids;
+  for (vector_string::const_iterator it = patterns.begin();
+       it != patterns.end(); ++it) {
+    string pattern(*it);
+    for (size_t i = 0; i < pattern.size(); ++i)
+      pattern[i] = m_fold[static_cast<unsigned char>(pattern[i])];
+    map<string, uint32_t>::const_iterator found = ids.find(pattern);
+    if (ids.end() != found) {
+      m_pattern_ids.push_back(found->second);
+      continue;
+    }
+    const uint32_t id = m_distinct++;
+    ids[pattern] = id;
+    m_patterns.push_back(pattern);
+    m_pattern_ids.push_back(id);
+
+    int32_t state = 0;
+    for (size_t i = 0; i < pattern.size(); ++i) {
+      const unsigned char c = pattern[i];
+      if (kNoState == m_next[state * kAlphabet + c]) {
+        const int32_t child = add_state();
+        m_next[state * kAlphabet + c] = child;
+      }
+      state = m_next[state * kAlphabet + c];
+    }
+    m_out[state].push_back(id);
+  }
+
+  vector<int32_t> fail(m_out.size(), 0);
+  deque<int32_t> pending;
+  for (size_t c = 0; c < kAlphabet; ++c) {
+    int32_t &next = m_next[c];
+    if (kNoState == next)
+      next = 0;
+    else
+      pending.push_back(next);
+  }
+  while (!pending.empty()) {
+    const int32_t state = pending.front();
+    pending.pop_front();
+    const vector<uint32_t> &inherited = m_out[fail[state]];
+    m_out[state].insert(m_out[state].end(), inherited.begin(),
+                        inherited.end());
+    for (size_t c = 0; c < kAlphabet; ++c) {
+      int32_t &next = m_next[state * kAlphabet + c];
+      const int32_t fallback = m_next[fail[state] * kAlphabet + c];
+      if (kNoState == next)
+        next = fallback;
+      else {
+        fail[next] = fallback;
+        pending.push_back(next);
+      }
+    }
+  }
+}
+
+int32_t PatternSet::add_state() {
+  m_next.resize(m_next.size() + kAlphabet, kNoState);
+  m_out.push_back(vector<uint32_t>());
+  return m_out.size() - 1;
+}
+
+/*
+  Return true if text contains distinct pattern id, searching for it
+  alone.
+*/
+bool PatternSet::contains(const string &text, const uint32_t id) const {
+  const string &pattern = m_patterns[id];
+  return string::npos != (m_fold_case ? find_folded(text, pattern)
+                                      : find_substring(text, pattern));
+}
+
+bool PatternSet::matches(const string &text, const bool all) const {
+  if (m_distinct <= kKernelPatterns) {
+    for (uint32_t id = 0; id < m_distinct; ++id)
+      if (contains(text, id) != all)
+        return !all;
+    return all;
+  }
+  vector<char> found(m_distinct, false);
+  const size_t count = scan(text, found, !all);
+  return all ? m_distinct == count : count > 0;
+}
+
+size_t PatternSet::find(const string &text, vector<char> &found) const {
+  vector<char> distinct(m_distinct, false);
+  if (m_distinct <= kKernelPatterns)
+    for (uint32_t id = 0; id < m_distinct; ++id)
+      distinct[id] = contains(text, id);
+  else
+    scan(text, distinct, false);
+  found.assign(m_pattern_ids.size(), false);
+  size_t count = 0;
+  for (size_t i = 0; i < m_pattern_ids.size(); ++i)
+    if ((found[i] = distinct[m_pattern_ids[i]]))
+      ++count;
+  return count;
+}
+
+/*
+  Mark in found the distinct patterns that text contains, and return
+  how many.  We stop as soon as we've found them all, or (if
+  stop_at_first) any.
+*/
+size_t PatternSet::scan(const string &text, vector<char> &found,
+                        const bool stop_at_first) const {
+  size_t count = 0;
+  // Empty patterns end at the root, before we read anything.
+  for (vector<uint32_t>::const_iterator it = m_out[0].begin();
+       it != m_out[0].end(); ++it)
+    if (!found[*it]) {
+      found[*it] = true;
+      ++count;
+    }
+  if (m_distinct == count || (count && stop_at_first))
+    return count;
+
+  int32_t state = 0;
+  const int32_t *next = m_next.data();
+  for (string::const_iterator it = text.begin(); it != text.end(); ++it) {
+    state = next[state * kAlphabet + m_fold[static_cast<unsigned char>(*it)]];
+    const vector<uint32_t> &out = m_out[state];
+    for (vector<uint32_t>::const_iterator id = out.begin(); id != out.end();
+         ++id)
+      if (!found[*id]) {
+        found[*id] = true;
+        if (++count == m_distinct || stop_at_first)
+          return count;
+      }
+  }
+  return count;
+}
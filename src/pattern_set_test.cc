@@ -0,0 +1,145 @@
+/*
+  Copyright 2026  Jeff Abrahamson
+
+  This file is part of srd.
+
+  srd is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  srd is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with srd.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "srd.h"
+#include "test_text.h"
+
+using namespace srd;
+using namespace std;
+
+namespace {
+
+/*
+  Confirm that a pattern set finds in text just what a matcher finds
+  one pattern at a time.
+*/
+int check(const vector_string &patterns, const string &text,
+          const StringMatcher &matcher) {
+  int ret = 0;
+  PatternSet set(patterns, matcher.folds_case());
+  vector<char> found;
+  const size_t count = set.find(text, found);
+  size_t expected_count = 0;
+  for (size_t i = 0; i < patterns.size(); ++i) {
+    const bool expected = matcher.contains(text, patterns[i]);
+    if (expected)
+      ++expected_count;
+    if (expected != static_cast<bool>(found[i])) {
+      cout << "Pattern \"" << patterns[i] << "\" "
+           << (expected ? "not found" : "found") << "." << endl;
+      ret++;
+    }
+  }
+  if (count != expected_count) {
+    cout << "Found " << count << " patterns, expected " << expected_count
+         << "." << endl;
+    ret++;
+  }
+  if (set.matches(text, false) != (expected_count > 0)) {
+    cout << "Disjunction mismatch." << endl;
+    ret++;
+  }
+  if (set.matches(text, true) != (expected_count == patterns.size())) {
+    cout << "Conjunction mismatch." << endl;
+    ret++;
+  }
+  return ret;
+}
+
+/*
+  The textbook example, whose patterns overlap and are suffixes of
+  one another.
+*/
+int test_overlap() {
+  int ret = 0;
+  vector_string patterns;
+  patterns.push_back("he");
+  patterns.push_back("she");
+  patterns.push_back("his");
+  patterns.push_back("hers");
+  ret += check(patterns, "ushers", IdentStringMatcher());
+  ret += check(patterns, "ahishers", IdentStringMatcher());
+  ret += check(patterns, "USHERS", IdentStringMatcher());
+  ret += check(patterns, "USHERS", UpperStringMatcher());
+  ret += check(patterns, "", IdentStringMatcher());
+  return ret;
+}
+
+/*
+  Duplicate and empty patterns, and no patterns at all.
+*/
+int test_edges() {
+  int ret = 0;
+  vector_string patterns;
+  patterns.push_back("forest");
+  patterns.push_back("");
+  patterns.push_back("forest");
+  patterns.push_back("Forest");
+  ret += check(patterns, "a forest", IdentStringMatcher());
+  ret += check(patterns, "a forest", UpperStringMatcher());
+  ret += check(patterns, "", IdentStringMatcher());
+
+  PatternSet none(vector_string(), false);
+  if (none.matches("text", false) || !none.matches("text", true)) {
+    cout << "Empty pattern set mismatch." << endl;
+    ret++;
+  }
+  return ret;
+}
+
+/*
+  Many patterns, drawn from the test text itself and at random,
+  against each message of the test text.
+*/
+int test_text_patterns() {
+  int ret = 0;
+  vector_string messages = test_text();
+  vector_string patterns;
+  for (size_t i = 0; i < messages.size(); ++i) {
+    const string &message = messages[i];
+    if (message.size() > 20)
+      patterns.push_back(message.substr(message.size() / 3, 3 + i % 7));
+    patterns.push_back(pseudo_random_string(2 + i % 3));
+  }
+  for (size_t i = 0; i < messages.size(); ++i) {
+    ret += check(patterns, messages[i], IdentStringMatcher());
+    ret += check(patterns, messages[i], UpperStringMatcher());
+  }
+  return ret;
+}
+}
+
+int main(int argc, char *argv[]) {
+  cout << "Testing pattern_set.cpp" << endl;
+
+  int err_count = 0;
+  err_count += test_overlap();
+  err_count += test_edges();
+  err_count += test_text_patterns();
+
+  if (err_count)
+    cout << "Errors (" << err_count << ") in test!!" << endl;
+  else
+    cout << "All tests passed!" << endl;
+  return 0 != err_count;
+}
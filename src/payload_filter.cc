@@ -0,0 +1,139 @@
+/*
+  Copyright 2026  Jeff Abrahamson
+
+  This file is part of srd.
+
+  srd is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  srd is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with srd.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "srd.h"
+
+using namespace srd;
+using namespace std;
+
+namespace {
+
+const unsigned int max_hashes = 32;
+
+/*
+  Return the hash of the (upper cased) trigram at text, FNV-1a.
+*/
+uint64_t trigram_hash(const char *text) {
+  uint64_t hash = 14695981039346656037ULL;
+  for (int i = 0; i < 3; ++i) {
+    hash ^= fold_case(static_cast<unsigned char>(text[i]));
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+/*
+  Return the distinct hashes of text's trigrams.
+*/
+vector<uint64_t> trigram_hashes(const string &text) {
+  vector<uint64_t> hashes;
+  for (size_t i = 0; i + 3 <= text.size(); ++i)
+    hashes.push_back(trigram_hash(text.data() + i));
+  sort(hashes.begin(), hashes.end());
+  hashes.erase(unique(hashes.begin(), hashes.end()), hashes.end());
+  return hashes;
+}
+}
+
+/*
+  Summarize payload in as many bits as a filter with error_rate false
+  positives needs, but no more than max_size bytes.
+*/
+PayloadFilter::PayloadFilter(const string &payload, const double error_rate,
+                             const uint32_t max_size)
+    : m_hashes(1) {
+  const vector<uint64_t> hashes = trigram_hashes(payload);
+  if (hashes.empty())
+    return;
+  const double n = hashes.size();
+  const double bits = ceil(-n * log(error_rate) / (M_LN2 * M_LN2));
+  const double size = min<double>(floor((bits + 7) / 8), max(max_size, 1U));
+  m_bits.assign(static_cast<size_t>(size), '\0');
+  // The number of hashes that minimizes false positives for the bits
+  // we got, which is fewer if max_size cut us short.
+  m_hashes = static_cast<unsigned int>(
+      min<double>(max_hashes, max(1.0, round(m_bits.size() * 8 / n * M_LN2))));
+  for (vector<uint64_t>::const_iterator it = hashes.begin();
+       it != hashes.end(); ++it)
+    for (unsigned int i = 0; i < m_hashes; ++i) {
+      const size_t bit = position(*it, i);
+      m_bits[bit / 8] |= 1 << (bit % 8);
+    }
+}
+
+/*
+  Return the filter that data() returned.
+*/
+boost::shared_ptr<const PayloadFilter>
+PayloadFilter::parse(const string &data) {
+  if (data.empty() || 0 == data[0] ||
+      static_cast<unsigned char>(data[0]) > max_hashes)
+    throw(runtime_error("Corrupt payload filter."));
+  boost::shared_ptr<PayloadFilter> filter(new PayloadFilter());
+  filter->m_hashes = static_cast<unsigned char>(data[0]);
+  filter->m_bits = data.substr(1);
+  return filter;
+}
+
+/*
+  Our persistent form:  the number of hashes, in a byte, then the
+  bits.
+*/
+string PayloadFilter::data() const {
+  return string(1, static_cast<char>(m_hashes)) + m_bits;
+}
+
+/*
+  Return false if the payload surely doesn't contain pattern (with or
+  without case).  A pattern too short to have trigrams might be
+  anywhere, but a payload too short to have any contains no pattern
+  that has one.
+*/
+bool PayloadFilter::might_contain(const string &pattern) const {
+  if (pattern.size() < 3)
+    return true;
+  if (m_bits.empty())
+    return false;
+  for (size_t i = 0; i + 3 <= pattern.size(); ++i) {
+    const uint64_t hash = trigram_hash(pattern.data() + i);
+    for (unsigned int j = 0; j < m_hashes; ++j) {
+      const size_t bit = position(hash, j);
+      if (!(m_bits[bit / 8] & (1 << (bit % 8))))
+        return false;
+    }
+  }
+  return true;
+}
+
+/*
+  Return the i'th bit that hash sets, deriving our hashes from two
+  halves of one.
+*/
+size_t PayloadFilter::position(const uint64_t hash,
+                               const unsigned int i) const {
+  const uint32_t low = hash;
+  const uint32_t high = (hash >> 32) | 1;
+  return (low + static_cast<uint64_t>(i) * high) % (m_bits.size() * 8);
+}
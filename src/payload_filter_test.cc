@@ -0,0 +1,125 @@
+/*
+  Copyright 2026  Jeff Abrahamson
+
+  This file is part of srd.
+
+  srd is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  srd is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with srd.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+#include "srd.h"
+#include "test_text.h"
+
+using namespace srd;
+using namespace std;
+
+namespace {
+
+/*
+  Confirm that the filter of each message might contain every piece
+  of the message, with and without case, and so does the filter we
+  persist.
+*/
+int test_no_false_negatives() {
+  int ret = 0;
+  vector_string messages = test_text();
+  for (size_t i = 0; i < messages.size(); ++i) {
+    const string &message = messages[i];
+    const PayloadFilter filter(message, 0.01, 1024);
+    boost::shared_ptr<const PayloadFilter> parsed =
+        PayloadFilter::parse(filter.data());
+    for (size_t at = 0; at < message.size(); at += 5)
+      for (size_t size = 1; size < 12 && at + size <= message.size();
+           size += 2) {
+        const string piece = message.substr(at, size);
+        if (!filter.might_contain(piece) ||
+            !filter.might_contain(fold_case(piece)) ||
+            !parsed->might_contain(piece)) {
+          cout << "Filter of message " << i << " lacks \"" << piece << "\"."
+               << endl;
+          ret++;
+        }
+      }
+  }
+  return ret;
+}
+
+/*
+  Confirm that the false positive rate is near what we asked for.
+*/
+int test_false_positives() {
+  string payload;
+  vector_string messages = test_text();
+  for (size_t i = 0; i < messages.size(); ++i)
+    payload += messages[i];
+  const double rate = 0.01;
+  const PayloadFilter filter(payload, rate, 1 << 20);
+  int trials = 0, positives = 0;
+  while (trials < 4000) {
+    const string pattern = pseudo_random_string(3);
+    if (string::npos != find_folded(payload, pattern))
+      continue;
+    trials++;
+    if (filter.might_contain(pattern))
+      positives++;
+  }
+  if (positives < 3 * rate * trials)
+    return 0;
+  cout << "False positive rate " << double(positives) / trials
+       << ", expected about " << rate << "." << endl;
+  return 1;
+}
+
+int test_sizes() {
+  int ret = 0;
+  const string payload("The quick brown fox jumps over the lazy dog.");
+  if (PayloadFilter(payload, 0.01, 16).size() > 16 ||
+      PayloadFilter(payload, 0.01, 1024).size() >=
+          PayloadFilter(payload, 0.0001, 1024).size()) {
+    cout << "Filter sizes don't follow the limit and error rate." << endl;
+    ret++;
+  }
+  const PayloadFilter small("ab", 0.01, 1024);
+  if (small.might_contain("abc") || !small.might_contain("ab") ||
+      !small.might_contain("")) {
+    cout << "Filter of a short payload failed." << endl;
+    ret++;
+  }
+  try {
+    PayloadFilter::parse(string());
+    cout << "Parsed an empty filter." << endl;
+    ret++;
+  } catch (const runtime_error &) {
+  }
+  return ret;
+}
+}
+
+int main(int argc, char *argv[]) {
+  cout << "Testing payload_filter.cpp" << endl;
+
+  int err_count = 0;
+  err_count += test_no_false_negatives();
+  err_count += test_false_positives();
+  err_count += test_sizes();
+
+  if (err_count)
+    cout << "Errors (" << err_count << ") in test!!" << endl;
+  else
+    cout << "All tests passed!" << endl;
+  return 0 != err_count;
+}
@@ -0,0 +1,105 @@
+/*
+  Copyright 2026  Jeff Abrahamson
+
+  This file is part of srd.
+
+  srd is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  srd is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with srd.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <iterator>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "srd.h"
+
+using namespace srd;
+using namespace std;
+
+namespace {
+
+/*
+  Return the distinct trigrams of text, upper cased as by
+  UpperStringMatcher.
+*/
+set<string> trigrams(const string &text) {
+  string folded = fold_case(text);
+  set<string> out;
+  for (size_t i = 0; i + 3 <= folded.size(); ++i)
+    out.insert(folded.substr(i, 3));
+  return out;
+}
+}
+
+/*
+  Index payload under proxy_name.  To reindex a leaf whose payload has
+  changed, remove() it first.
+*/
+void PayloadIndex::add(const string &proxy_name, const string &payload) {
+  set<string> grams = trigrams(payload);
+  for (set<string>::const_iterator it = grams.begin(); it != grams.end();
+       ++it)
+    m_postings[*it].insert(proxy_name);
+}
+
+/*
+  Forget proxy_name.  We don't know its trigrams, so check them all,
+  which is fine as long as leaves change rarely compared to how often
+  we search.
+*/
+void PayloadIndex::remove(const string &proxy_name) {
+  for (Postings::iterator it = m_postings.begin(); it != m_postings.end();) {
+    it->second.erase(proxy_name);
+    if (it->second.empty())
+      it = m_postings.erase(it);
+    else
+      ++it;
+  }
+}
+
+/*
+  Set names to the leaves whose payloads might contain pattern (with
+  or without case) and return true.  If pattern is too short to have
+  trigrams, any leaf might contain it, so return false.
+*/
+bool PayloadIndex::candidates(const string &pattern,
+                              set<string> &names) const {
+  set<string> grams = trigrams(pattern);
+  if (grams.empty())
+    return false;
+  // Intersect the shortest postings first, so the work shrinks fast.
+  vector<const set<string> *> lists;
+  for (set<string>::const_iterator it = grams.begin(); it != grams.end();
+       ++it) {
+    Postings::const_iterator found = m_postings.find(*it);
+    if (m_postings.end() == found) {
+      names.clear();
+      return true;
+    }
+    lists.push_back(&found->second);
+  }
+  sort(lists.begin(), lists.end(),
+       [](const set<string> *a, const set<string> *b) {
+         return a->size() < b->size();
+       });
+  names = *lists[0];
+  for (size_t i = 1; i < lists.size() && !names.empty(); ++i) {
+    set<string> both;
+    set_intersection(names.begin(), names.end(), lists[i]->begin(),
+                     lists[i]->end(), inserter(both, both.begin()));
+    names.swap(both);
+  }
+  return true;
+}
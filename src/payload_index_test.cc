@@ -0,0 +1,138 @@
+/*
+  Copyright 2026  Jeff Abrahamson
+
+  This file is part of srd.
+
+  srd is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  srd is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with srd.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <iostream>
+#include <set>
+#include <sstream>
+#include <string>
+
+#include "srd.h"
+#include "test_text.h"
+
+using namespace srd;
+using namespace std;
+
+namespace {
+
+/*
+  Confirm that pattern's candidates are exactly expected, a space
+  separated list of names.
+*/
+int check_candidates(const PayloadIndex &index, const string &pattern,
+                     const string &expected) {
+  set<string> names;
+  if (!index.candidates(pattern, names)) {
+    cout << "No candidates for \"" << pattern << "\"" << endl;
+    return 1;
+  }
+  istringstream iss(expected);
+  set<string> expected_names;
+  string name;
+  while (iss >> name)
+    expected_names.insert(name);
+  if (names != expected_names) {
+    cout << "Wrong candidates for \"" << pattern << "\":";
+    for (set<string>::iterator it = names.begin(); it != names.end(); ++it)
+      cout << " " << *it;
+    cout << endl;
+    return 1;
+  }
+  return 0;
+}
+
+int test_candidates() {
+  int ret = 0;
+  PayloadIndex index;
+  index.add("a", "The quick brown fox");
+  index.add("b", "jumps over the lazy dog");
+  index.add("c", "and the QUICK cat");
+  ret += check_candidates(index, "the", "a b c");
+  ret += check_candidates(index, "quick", "a c");
+  ret += check_candidates(index, "Quick brown", "a");
+  ret += check_candidates(index, "lazy fox", "");
+  ret += check_candidates(index, "xyzzy", "");
+  set<string> names;
+  if (index.candidates("qu", names)) {
+    cout << "Short pattern narrowed the search." << endl;
+    ret++;
+  }
+
+  index.remove("a");
+  ret += check_candidates(index, "quick", "c");
+  ret += check_candidates(index, "brown", "");
+  index.remove("c");
+  index.add("c", "a brown cat");
+  ret += check_candidates(index, "quick", "");
+  ret += check_candidates(index, "brown", "c");
+  index.remove("b");
+  index.remove("c");
+  if (!index.postings().empty()) {
+    cout << "Empty index has " << index.postings().size() << " postings."
+         << endl;
+    ret++;
+  }
+  return ret;
+}
+
+/*
+  Every substring of a message must find the message.
+*/
+int test_substrings(const vector_string &messages) {
+  int ret = 0;
+  PayloadIndex index;
+  for (size_t i = 0; i < messages.size(); ++i) {
+    ostringstream name;
+    name << i;
+    index.add(name.str(), messages[i]);
+  }
+  for (size_t i = 0; i < messages.size(); ++i) {
+    ostringstream name;
+    name << i;
+    for (size_t start = 0; start + 3 <= messages[i].size(); start += 7) {
+      set<string> names;
+      index.candidates(messages[i].substr(start, 12), names);
+      if (0 == names.count(name.str())) {
+        cout << "Message " << i << " missing from candidates at " << start
+             << endl;
+        ret++;
+        break;
+      }
+    }
+  }
+  return ret;
+}
+}
+
+int main(int argc, char *argv[]) {
+  cout << "Testing payload_index.cpp" << endl;
+
+  mode(Verbose, false);
+  mode(Testing, true);
+  mode(ReadOnly, false);
+
+  int err_count = 0;
+  err_count += test_candidates();
+  err_count += test_substrings(test_text());
+
+  if (err_count)
+    cout << "Errors (" << err_count << ") in test!!" << endl;
+  else
+    cout << "All tests passed!" << endl;
+  return 0 != err_count;
+}
@@ -0,0 +1,187 @@
+/*
+  Copyright 2026  Jeff Abrahamson
+
+  This file is part of srd.
+
+  srd is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  srd is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with srd.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <boost/regex.hpp>
+#include <cctype>
+#include <stdexcept>
+#include <string>
+
+#include "srd.h"
+
+using namespace srd;
+using namespace std;
+
+struct RegexStringMatcher::Compiled {
+  Compiled(const string &pattern, const bool case_sensitive)
+      : literal(required_literal(pattern)) {
+    // As std::regex's ECMAScript:  ^ and $ anchor the whole text, and
+    // . doesn't match a newline.
+    boost::regex::flag_type flags =
+        boost::regex::ECMAScript | boost::regex::no_mod_m |
+        boost::regex::no_mod_s;
+    if (!case_sensitive)
+      flags |= boost::regex::icase;
+    try {
+      expression.assign(pattern, flags);
+    } catch (const boost::regex_error &e) {
+      throw runtime_error("Bad regular expression \"" + pattern +
+                          "\": " + e.what());
+    }
+  }
+
+  // Boost's matcher doesn't recurse, so a long payload can't exhaust
+  // the stack, as std::regex's can.
+  boost::regex expression;
+  string literal;
+};
+
+RegexStringMatcher::RegexStringMatcher(const vector_string &patterns,
+                                       const bool case_sensitive)
+    : m_case_sensitive(case_sensitive) {
+  for (vector_string::const_iterator it = patterns.begin();
+       it != patterns.end(); ++it)
+    if (!m_compiled.count(*it))
+      m_compiled[*it].reset(new Compiled(*it, case_sensitive));
+}
+
+/*
+  Return the compiled pattern.  A pattern we weren't given up front
+  we compile now, every time, which is correct but slow.
+*/
+boost::shared_ptr<const RegexStringMatcher::Compiled>
+RegexStringMatcher::compiled(const string &pattern) const {
+  map<string, boost::shared_ptr<const Compiled>>::const_iterator it =
+      m_compiled.find(pattern);
+  if (m_compiled.end() != it)
+    return it->second;
+  return boost::shared_ptr<const Compiled>(
+      new Compiled(pattern, m_case_sensitive));
+}
+
+/*
+  Return false if text can't match, because it lacks the literal
+  every match contains.
+*/
+bool RegexStringMatcher::prefilter(const Compiled &pattern,
+                                   const string &text) const {
+  if (pattern.literal.empty())
+    return true;
+  return string::npos !=
+         (m_case_sensitive ? find_substring(text, pattern.literal)
+                           : find_folded(text, pattern.literal));
+}
+
+/*
+  A pattern too costly to match against some text throws, rather than
+  hanging or exhausting memory.
+*/
+const bool RegexStringMatcher::operator()(const string &in_a,
+                                          const string &in_b) const {
+  boost::shared_ptr<const Compiled> pattern = compiled(in_b);
+  if (!prefilter(*pattern, in_a))
+    return false;
+  try {
+    return boost::regex_match(in_a, pattern->expression);
+  } catch (const runtime_error &e) {
+    throw runtime_error("Regular expression \"" + in_b + "\" failed: " +
+                        e.what());
+  }
+}
+
+const bool RegexStringMatcher::contains(const string &in_a,
+                                        const string &in_b) const {
+  boost::shared_ptr<const Compiled> pattern = compiled(in_b);
+  if (!prefilter(*pattern, in_a))
+    return false;
+  try {
+    return boost::regex_search(in_a, pattern->expression);
+  } catch (const runtime_error &e) {
+    throw runtime_error("Regular expression \"" + in_b + "\" failed: " +
+                        e.what());
+  }
+}
+
+const string RegexStringMatcher::literal(const string &pattern) const {
+  return compiled(pattern)->literal;
+}
+
+/*
+  Return the longest run of literal characters that every match of
+  pattern must contain, or the empty string if we can't tell.
+
+  We only look at the top level of the pattern: groups and classes
+  end a run, as do anchors and wildcards, and we give up on
+  alternation.  A character that may repeat ends a run after it, and
+  one that may be absent is no part of any run.
+*/
+string RegexStringMatcher::required_literal(const string &pattern) {
+  string best, run;
+  bool last_literal = false;
+  int depth = 0;
+  const size_t size = pattern.size();
+  for (size_t i = 0; i < size; ++i) {
+    const char c = pattern[i];
+    if ('\\' == c && i + 1 < size) {
+      const char escaped = pattern[++i];
+      if (0 == depth && !isalnum(static_cast<unsigned char>(escaped))) {
+        run += escaped;
+        last_literal = true;
+        continue;
+      }
+      // A class (\d), assertion (\b), back reference (\1), or
+      // character code (\x41), whose digits we skip.
+      if ('x' == escaped)
+        i += 2;
+      else if ('u' == escaped)
+        i += 4;
+      else if ('c' == escaped)
+        i += 1;
+    } else if ('[' == c) {
+      // Skip the class.
+      size_t j = i + 1;
+      while (j < size && ']' != pattern[j])
+        j += ('\\' == pattern[j]) ? 2 : 1;
+      i = j;
+    } else if ('(' == c)
+      ++depth;
+    else if (')' == c) {
+      if (depth > 0)
+        --depth;
+    } else if (0 < depth)
+      continue;
+    else if ('|' == c)
+      return string();
+    else if ('*' == c || '?' == c || '{' == c || '+' == c) {
+      if (last_literal && '+' != c)
+        run.erase(run.size() - 1);
+      if ('{' == c)
+        while (i < size && '}' != pattern[i])
+          ++i;
+    } else if ('.' != c && '^' != c && '$' != c) {
+      run += c;
+      last_literal = true;
+      continue;
+    }
+    if (run.size() > best.size())
+      best = run;
+    run.clear();
+    last_literal = false;
+  }
+  return run.size() > best.size() ? run : best;
+}
@@ -0,0 +1,208 @@
+/*
+  Copyright 2026  Jeff Abrahamson
+
+  This file is part of srd.
+
+  srd is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  srd is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with srd.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <iostream>
+#include <regex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+#include "srd.h"
+#include "test_text.h"
+
+using namespace srd;
+using namespace std;
+
+namespace {
+
+int check_literal(const string &pattern, const string &expected) {
+  const string literal = RegexStringMatcher::required_literal(pattern);
+  if (literal == expected)
+    return 0;
+  cout << "Literal of \"" << pattern << "\" is \"" << literal
+       << "\", expected \"" << expected << "\"." << endl;
+  return 1;
+}
+
+int test_literals() {
+  int ret = 0;
+  ret += check_literal("forest", "forest");
+  ret += check_literal("", "");
+  ret += check_literal("for.st fire", "st fire");
+  ret += check_literal("^forests?$", "forest");
+  ret += check_literal("fo+rest", "rest");
+  ret += check_literal("fo*rest", "rest");
+  ret += check_literal("ab{2,3}cdef", "cdef");
+  ret += check_literal("a\\.b\\d+c", "a.b");
+  ret += check_literal("(forest|ocean) fire", " fire");
+  ret += check_literal("forest|ocean", "");
+  ret += check_literal("[(|]forest[)]", "forest");
+  ret += check_literal("\\x41BC\\bdefg", "defg");
+  ret += check_literal("ab(c)*", "ab");
+  return ret;
+}
+
+/*
+  Confirm that the matcher agrees with std::regex, with and without
+  case, on the test text.
+*/
+int test_matching() {
+  int ret = 0;
+  vector_string patterns;
+  patterns.push_back("f[a-z]+st");
+  patterns.push_back("THE");
+  patterns.push_back("(wo)?man");
+  patterns.push_back("^\\w+ ");
+  patterns.push_back("o+d");
+  vector_string messages = test_text();
+  for (int sensitive = 0; sensitive < 2; ++sensitive) {
+    RegexStringMatcher matcher(patterns, sensitive);
+    regex::flag_type flags = regex::ECMAScript;
+    if (!sensitive)
+      flags |= regex::icase;
+    for (size_t p = 0; p < patterns.size(); ++p) {
+      const regex expression(patterns[p], flags);
+      for (size_t i = 0; i < messages.size(); ++i) {
+        const string &message = messages[i];
+        if (matcher.contains(message, patterns[p]) !=
+            regex_search(message, expression)) {
+          cout << "Search for \"" << patterns[p] << "\" disagrees." << endl;
+          ret++;
+        }
+        if (matcher(message, patterns[p]) !=
+            regex_match(message, expression)) {
+          cout << "Match of \"" << patterns[p] << "\" disagrees." << endl;
+          ret++;
+        }
+      }
+    }
+  }
+  RegexStringMatcher matcher(vector_string(), true);
+  if (!matcher("forest", "f.*t") || matcher("forests", "f.*t")) {
+    cout << "Match of pattern compiled late failed." << endl;
+    ret++;
+  }
+  return ret;
+}
+
+/*
+  Confirm that a pattern that scans far matches a long text rather
+  than exhausting the stack.
+*/
+int test_long_text() {
+  int ret = 0;
+  RegexStringMatcher matcher(vector_string(1, "x.*y"), true);
+  string text = "x" + string(2 << 20, 'a');
+  if (matcher.contains(text, "x.*y")) {
+    cout << "Long text matched without its y." << endl;
+    ret++;
+  }
+  text += "y";
+  if (!matcher.contains(text, "x.*y") || !matcher(text, "x.*y") ||
+      !matcher(text, "xa*y")) {
+    cout << "Long text did not match." << endl;
+    ret++;
+  }
+  return ret;
+}
+
+int test_bad_regex() {
+  try {
+    RegexStringMatcher(vector_string(1, "fo(rest"), true);
+  } catch (const runtime_error &) {
+    return 0;
+  }
+  cout << "Bad regex compiled." << endl;
+  return 1;
+}
+
+/*
+  Confirm that regex queries compose as literal ones do, with and
+  without the index.
+*/
+int test_query() {
+  int ret = 0;
+  string password = pseudo_random_string(20);
+  {
+    Root root(password, "", true);
+    vector_string messages = test_text();
+    for (size_t i = 0; i < messages.size(); ++i) {
+      ostringstream key;
+      key << "key " << i;
+      root.add_leaf(key.str(), messages[i], false);
+    }
+    root.commit();
+  }
+  Root root(password, "");
+  vector_string keys(1, "^key [0-4]$");
+  vector_string payloads;
+  payloads.push_back("fo+r");
+  payloads.push_back("t.e");
+  vector_string all(keys);
+  all.insert(all.end(), payloads.begin(), payloads.end());
+  for (int indexed = 0; indexed < 2; ++indexed) {
+    if (indexed)
+      root.build_index();
+    for (int disjunction = 0; disjunction < 2; ++disjunction) {
+      RegexStringMatcher matcher(all, true);
+      LeafProxyMap found =
+          root.filter_keys(keys, false, matcher)
+              .filter_payloads(payloads, disjunction, matcher);
+      size_t expected = 0;
+      for (LeafProxyMap::iterator it = root.begin(); it != root.end(); ++it) {
+        const string key = it->second.key();
+        const string payload = it->second.payload();
+        if (key.size() != 5 || key[4] > '4')
+          continue;
+        const bool first = regex_search(payload, regex("fo+r"));
+        const bool second = regex_search(payload, regex("t.e"));
+        if (disjunction ? first || second : first && second)
+          expected++;
+      }
+      if (found.size() != expected) {
+        cout << "Query found " << found.size() << ", expected " << expected
+             << "." << endl;
+        ret++;
+      }
+    }
+  }
+  return ret;
+}
+}
+
+int main(int argc, char *argv[]) {
+  cout << "Testing regex_matcher.cpp" << endl;
+
+  mode(Verbose, false);
+  mode(Testing, true);
+  mode(ReadOnly, false);
+
+  int err_count = 0;
+  err_count += test_literals();
+  err_count += test_matching();
+  err_count += test_long_text();
+  err_count += test_bad_regex();
+  err_count += test_query();
+
+  if (err_count)
+    cout << "Errors (" << err_count << ") in test!!" << endl;
+  else
+    cout << "All tests passed!" << endl;
+  return 0 != err_count;
+}
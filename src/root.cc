@@ -18,17 +18,44 @@
 */
 
 #include <algorithm>
+#include <errno.h>
 #include <functional>
+#include <signal.h>
 #include <stdlib.h>
 #include <sstream>
 #include <string>
+#include <string.h>
 #include <unistd.h>
+#include <unordered_map>
 
 #include "srd.h"
 
 using namespace srd;
 using namespace std;
 
+namespace {
+
+/*
+  Return the name of this host, which qualifies process ids in the
+  journal.
+*/
+string host_name() {
+  char name[256];
+  if (gethostname(name, sizeof(name)))
+    throw(runtime_error("Failed to get host name:  " +
+                        string(strerror(errno))));
+  name[sizeof(name) - 1] = '\0';
+  return name;
+}
+
+/*
+  Return whether the process pid, on this host, is still running.
+*/
+bool process_is_running(const uint32_t pid) {
+  return 0 == kill(pid, 0) || EPERM == errno;
+}
+}
+
 /*
   Instantiate a root node.
   If provided, path is the directory in which to find the srd encrypted files.
@@ -40,12 +67,16 @@ using namespace std;
   The name of the root node must be determinable solely by the password.
 */
 Root::Root(const string &pass, const string dir_name, const bool create)
-    : password(pass), modified(false), valid(true) {
+    : password(pass), cipher(new CipherContext(pass)), inline_max(0),
+      filter_rate(0), filter_max(0), generation(0), snapshot_size(0),
+      rewrite(false), journalled(false), modified(false), valid(true) {
   string base_name(pass);
   for (int i = 0; i < 30; i++)
     base_name = message_digest(base_name, true);
   basename(base_name); // Must be reproducible from password alone
   dirname(dir_name);   // If empty, will be computed for us
+  log.reset(new RootLog(basename() + ".log", dirname()));
+  journal.reset(new RootLog(basename() + ".journal", dirname()));
   if (exists() == create) {
     // i.e., if exists() != !create
     if (create)
@@ -62,6 +93,7 @@ Root::Root(const string &pass, const string dir_name, const bool create)
     cout << "Root node does not exist, will create." << endl;
     if (mode(Verbose))
       cout << "    [" << full_path() << "]" << endl;
+    rewrite = true;
     modified = true;
     validate();
     return;
@@ -71,7 +103,8 @@ Root::Root(const string &pass, const string dir_name, const bool create)
 }
 
 /*
-  Load the root's contents.
+  Load the root's contents:  the root as last written in full, then
+  the changes logged since.
 */
 void Root::load() {
   if (modified) {
@@ -87,33 +120,133 @@ void Root::load() {
     mode(ReadOnly, true);
   }
   clear(); // Drop existing LeafProxy's, if any
+  sorted_keys.clear();
+  changed.clear();
+  rewrite = false;
   string plain_text;
+  vector_string records;
+  bool legacy;
   {
     Lock L(full_path() + ".lck");
-    plain_text = decrypt(file_contents(), password);
+    boost::shared_ptr<FileView> view = file_view();
+    snapshot_size = view->size();
+    plain_text = cipher->decrypt(view->data(), view->size(), legacy);
+    records = log->records();
   }
   string big_text = decompress(plain_text);
   RootData root_data;
-  if (!root_data.ParseFromString(big_text)) {
+  bool parsed;
+  {
+    StageTimer timer(StageParse);
+    timer.bytes(big_text.size());
+    parsed = root_data.ParseFromString(big_text);
+  }
+  if (!parsed) {
     cerr << "Failed to deserialize root." << endl;
     throw(runtime_error("Failed to deserialize root"));
   }
-  // TODO(jeff@purple.com): It's a kludge to capture this in the lambda closure.
-  for_each(root_data.keys().begin(), root_data.keys().end(),
-           [root_data, this](RootData_KeyData key) mutable {
-             (*this)[key.proxy_name()] =
-                 LeafProxy(password, key.proxy_name(), "");
-             (*this)[key.proxy_name()].key_cache(key.cached_key());
-           });
+  if (root_data.has_pack_name()) {
+    // Keep our pack if it's still the right one, since it may
+    // already have an open file descriptor.
+    if (!pack || pack->basename() != root_data.pack_name())
+      pack.reset(new Pack(root_data.pack_name(), dirname()));
+  } else
+    pack.reset();
+  generation = root_data.generation();
+  inline_max = root_data.inline_max_size();
+  filter_rate = root_data.filter_error_rate();
+  filter_max = root_data.filter_max_size();
+  if (root_data.has_payload_index()) {
+    payload_index.reset(new PayloadIndex());
+    const RootData_PayloadIndex &index_data = root_data.payload_index();
+    for (int i = 0; i < index_data.postings_size(); ++i) {
+      const RootData_PayloadIndex_Posting &posting = index_data.postings(i);
+      for (int j = 0; j < posting.leaf_size(); ++j) {
+        if (posting.leaf(j) >= static_cast<uint32_t>(root_data.keys_size()))
+          throw(runtime_error("Corrupt payload index."));
+        payload_index->insert(posting.trigram(),
+                              root_data.keys(posting.leaf(j)).proxy_name());
+      }
+    }
+  } else
+    payload_index.reset();
+  // Keys arrive in key order, so the key index is built in one pass.
+  for (int i = 0; i < root_data.keys_size(); ++i)
+    load_key(root_data.keys(i));
   assert(size() == static_cast<unsigned int>(root_data.keys_size()));
+  replay(records);
+  if (!mode(ReadOnly))
+    recover();
+  stats_set(CountLeavesInMap, size());
+  // A root in the older cipher format is written in full, in the
+  // current one, when it next changes.  Reading alone never writes.
+  if (legacy)
+    rewrite = true;
   validate();
 }
 
+/*
+  Add (or replace) the leaf that key describes.
+*/
+void Root::load_key(const RootData_KeyData &key) {
+  LeafProxy &proxy = (*this)[key.proxy_name()];
+  proxy = LeafProxy(cipher, key.proxy_name(), "");
+  if (key.has_inline_payload())
+    proxy.set_inline(key.cached_key(), key.inline_payload());
+  else {
+    proxy.key_cache(key.cached_key());
+    if (pack)
+      proxy.pack_location(
+          PackLocation(pack, key.pack_offset(), key.pack_length()));
+  }
+  if (key.has_payload_filter())
+    proxy.payload_filter(PayloadFilter::parse(key.payload_filter()));
+  // The cached key, unless the root predates caching keys.
+  sorted_keys.set(key.proxy_name(), proxy.key());
+}
+
+/*
+  Apply the changes logged since the root was last written in full.
+
+  Records logged against an earlier generation of the root, as when
+  we stopped between writing the root and removing the log, are
+  already in the root, so we skip them.
+*/
+void Root::replay(const vector_string &records) {
+  for (vector_string::const_iterator it = records.begin();
+       it != records.end(); ++it) {
+    bool legacy;
+    RootDelta delta;
+    if (!delta.ParseFromString(cipher->decrypt(it->data(), it->size(), legacy)))
+      throw(runtime_error("Corrupt root log."));
+    if (delta.generation() != generation)
+      continue;
+    if (payload_index) {
+      // We don't log changes to an indexed root, since the index
+      // would need them too, but another process did.
+      cerr << "Payload index is out of date, dropping it.  "
+              "(Rebuild with --index.)"
+           << endl;
+      payload_index.reset();
+      rewrite = true;
+      modified = true;
+    }
+    for (int i = 0; i < delta.set_size(); ++i)
+      load_key(delta.set(i));
+    for (int i = 0; i < delta.removed_size(); ++i) {
+      erase(delta.removed(i));
+      sorted_keys.remove(delta.removed(i));
+    }
+  }
+}
+
 /*
   Serialize and persist the node before destruction.
 */
 Root::~Root() {
-  if (valid) {
+  // If we've nothing to persist, don't validate either:  a long-lived
+  // root may be out of date if another process removed leaves.
+  if (valid && modified) {
     validate();
     commit();
   }
@@ -128,10 +261,16 @@ void Root::add_leaf(const string &key, const string &payload,
   validate();
   if (exists() && underlying_is_modified())
     load();
-  LeafProxy proxy(password, "", dirname());
-  proxy.set(key, payload);
+  const string proxy_name = File().basename();
+  if (has_file(payload))
+    journal_leaves(vector_string(1, proxy_name));
+  LeafProxy proxy = write_leaf(proxy_name, key, payload);
   (*this)[proxy.basename()] = proxy;
-  modified = true; // Adding a leaf requires persisting the root.
+  sorted_keys.set(proxy.basename(), key);
+  if (payload_index)
+    payload_index->add(proxy.basename(), payload);
+  // Adding a leaf requires persisting the root.
+  leaf_changed(proxy.basename());
   if (do_commit)
     // Best practice is to commit, and so do_commit
     // defaults to true.  If the client knows that it will
@@ -168,8 +307,32 @@ void Root::set_leaf(const string &proxy_key, const string &key,
   if (end() == it)
     throw(runtime_error("Key not found."));
   LeafProxy &proxy = it->second;
-  if (proxy.set(key, payload))
-    modified = true;
+  const bool was_inline = proxy.is_inline();
+  if (fits_inline(payload) != was_inline) {
+    // Moving into or out of the root.  Write the new, and remove the
+    // old once the root no longer refers to it.
+    LeafProxy old_proxy = proxy;
+    proxy.unload();
+    if (has_file(payload) || uses_file(proxy_key))
+      journal_leaves(vector_string(1, proxy_key));
+    doomed.erase(proxy_key);
+    if (!has_file(payload))
+      doomed[proxy_key] = old_proxy;
+    proxy = write_leaf(proxy_key, key, payload);
+    leaf_changed(proxy_key);
+  } else {
+    // A packed leaf is appended anew, and an inline one lives in the
+    // root, as does a payload filter, so the root must be rewritten.
+    if (proxy.set(key, payload) || pack || was_inline || filter_rate)
+      leaf_changed(proxy_key);
+    set_filter(proxy, payload);
+  }
+  sorted_keys.set(proxy_key, key);
+  if (payload_index) {
+    payload_index->remove(proxy_key);
+    payload_index->add(proxy_key, payload);
+    leaf_changed(proxy_key);
+  }
   validate();
 }
 
@@ -184,9 +347,17 @@ void Root::rm_leaf(const string &proxy_key) {
   iterator it = find(proxy_key);
   if (end() == it)
     throw(runtime_error("Key not found."));
-  it->second.erase();
+  // We remove the leaf once the root no longer refers to it.  Until
+  // then, the journal remembers it.
+  if (uses_file(proxy_key))
+    journal_leaves(vector_string(1, proxy_key));
+  // Before erasing it, since proxy_key may be the map's own copy.
+  doomed[proxy_key] = it->second;
+  sorted_keys.remove(proxy_key);
+  if (payload_index)
+    payload_index->remove(proxy_key);
+  leaf_changed(proxy_key);
   erase(it);
-  modified = true;
   commit();
   validate();
 }
@@ -202,20 +373,45 @@ void Root::rm_leaf(const string &proxy_key) {
 
   Return the new root.  Will throw runtime_error if the new password
   generates an existing root object.
+
+  If we are packed, so is the new root, but in a pack of its own.
+  If we are indexed, inline small leaves, or filter payloads, so does
+  the new root.
 */
 Root Root::change_password(const std::string &new_password) {
   validate();
   if (exists() && underlying_is_modified())
     load();
   Root new_root(new_password, dirname(), true);
+  if (pack)
+    new_root.pack.reset(new Pack(string(), dirname()));
+  new_root.inline_max = inline_max;
+  new_root.filter_rate = filter_rate;
+  new_root.filter_max = filter_max;
+  if (payload_index)
+    new_root.payload_index.reset(new PayloadIndex());
+  RootBatch batch(new_root);
   for (const_iterator it = begin(); it != end(); it++)
-    new_root.add_leaf((*it).second.key(), (*it).second.payload(), false);
-  new_root.commit();
+    batch.add_leaf((*it).second.key(), (*it).second.payload());
+  try {
+    batch.commit();
+  } catch (...) {
+    // Don't leave behind an empty root for the new password.
+    new_root.valid = false;
+    throw;
+  }
   while (!empty()) {
     iterator it = begin();
     (*it).second.erase();
     erase(it);
   }
+  sorted_keys.clear();
+  if (pack && pack->exists())
+    pack->rm();
+  if (log->exists())
+    log->rm();
+  if (journal->exists())
+    journal->rm();
   validate();
   valid = false;
   new_root.validate();
@@ -223,34 +419,503 @@ Root Root::change_password(const std::string &new_password) {
 }
 
 /*
-  If we have been modified, persist to our underlying file.
+  Move every leaf into a new pack file.
+
+  For a database with one file per leaf, this is the conversion to a
+  packed database.  For a packed database, it compacts the pack,
+  dropping the space left behind by modified and deleted leaves.
+
+  Inline leaves stay in the root.
+
+  We copy cipher text as is, so nothing is decrypted.  The old files
+  (or old pack) are only removed once the root pointing at the new
+  pack has been persisted, so that an interruption leaves a readable
+  database, if perhaps some stray files.
+*/
+void Root::repack() {
+  validate();
+  if (mode(ReadOnly)) {
+    cerr << "Database is read-only, not repacking." << endl;
+    return;
+  }
+  if (exists() && underlying_is_modified())
+    load();
+  boost::shared_ptr<Pack> new_pack(new Pack(string(), dirname()));
+  vector<LeafProxy> stale_leaves;
+  for (iterator it = begin(); it != end(); ++it) {
+    LeafProxy &proxy = it->second;
+    if (proxy.is_inline())
+      continue;
+    string cipher_text = proxy.cipher_text();
+    if (!proxy.pack_location().pack)
+      stale_leaves.push_back(proxy);
+    proxy.pack_location(PackLocation(new_pack, new_pack->append(cipher_text),
+                                     cipher_text.size()));
+  }
+  boost::shared_ptr<Pack> old_pack = pack;
+  pack = new_pack;
+  rewrite = true;
+  modified = true;
+  commit();
+
+  for (vector<LeafProxy>::iterator it = stale_leaves.begin();
+       it != stale_leaves.end(); ++it)
+    it->erase();
+  if (old_pack && old_pack->exists())
+    old_pack->rm();
+  if (mode(Verbose))
+    cout << "root repacked, size=" << size() << endl;
+  validate();
+}
+
+/*
+  Store payloads of at most max_size bytes in the root rather than in
+  leaves of their own, from now on and for the leaves we have.  Zero
+  moves every leaf back out of the root.
+
+  A database of many small leaves then loads with the root, rather
+  than a file (or a slice of the pack) per leaf, at the price of a
+  larger root.  This loads every leaf.  As with repack(), leaves that
+  move are only removed once the root no longer refers to them.
+*/
+void Root::inline_leaves(const uint32_t max_size) {
+  validate();
+  if (mode(ReadOnly)) {
+    cerr << "Database is read-only, not inlining." << endl;
+    return;
+  }
+  if (exists() && underlying_is_modified())
+    load();
+  inline_max = max_size;
+  vector<LeafProxy> stale_leaves;
+  for (iterator it = begin(); it != end(); ++it) {
+    LeafProxy &proxy = it->second;
+    const string payload = proxy.payload();
+    if (fits_inline(payload) == proxy.is_inline())
+      continue;
+    const string key = proxy.key();
+    stale_leaves.push_back(proxy);
+    proxy.unload();
+    proxy = write_leaf(it->first, key, payload);
+  }
+  rewrite = true;
+  modified = true;
+  commit();
+
+  for (vector<LeafProxy>::iterator it = stale_leaves.begin();
+       it != stale_leaves.end(); ++it)
+    it->erase();
+  if (mode(Verbose))
+    cout << "root inlined " << max_size << " bytes, moved "
+         << stale_leaves.size() << endl;
+  validate();
+}
+
+/*
+  Give every leaf a payload filter with false positive rate
+  error_rate, of at most max_size bytes, from now on and for the
+  leaves we have, so that payload searches needn't load leaves that
+  surely don't match.  A zero error_rate removes the filters.
+
+  Filters live in the root, so are as secret as the keys.  Building
+  them loads every leaf.
+*/
+void Root::filter_leaves(const double error_rate, const uint32_t max_size) {
+  validate();
+  if (error_rate < 0 || error_rate >= 1 || (error_rate > 0 && 0 == max_size))
+    throw(runtime_error("Bad payload filter error rate or size."));
+  if (mode(ReadOnly)) {
+    cerr << "Database is read-only, not filtering." << endl;
+    return;
+  }
+  if (exists() && underlying_is_modified())
+    load();
+  filter_rate = error_rate;
+  filter_max = error_rate > 0 ? max_size : 0;
+  size_t total_size = 0;
+  for (iterator it = begin(); it != end(); ++it) {
+    LeafProxy &proxy = it->second;
+    if (filter_rate)
+      set_filter(proxy, proxy.payload());
+    else
+      proxy.payload_filter(boost::shared_ptr<const PayloadFilter>());
+    if (proxy.payload_filter())
+      total_size += proxy.payload_filter()->size();
+  }
+  rewrite = true;
+  modified = true;
+  commit();
+  if (mode(Verbose))
+    cout << "root filtered, bytes=" << total_size << endl;
+  validate();
+}
+
+/*
+  Index every leaf's payload, so that payload searches need only load
+  the leaves that might match.  From now on, we keep the index up to
+  date as leaves change.  The index lives in the root, so is as
+  secret as the keys.
+
+  Building the index loads every leaf.  Rebuilding is harmless.
+*/
+void Root::build_index() {
+  validate();
+  if (mode(ReadOnly)) {
+    cerr << "Database is read-only, not indexing." << endl;
+    return;
+  }
+  if (exists() && underlying_is_modified())
+    load();
+  boost::shared_ptr<PayloadIndex> index(new PayloadIndex());
+  for (const_iterator it = begin(); it != end(); ++it)
+    index->add(it->first, it->second.payload());
+  payload_index = index;
+  rewrite = true;
+  modified = true;
+  commit();
+  if (mode(Verbose))
+    cout << "root indexed, postings=" << payload_index->postings().size()
+         << endl;
+  validate();
+}
+
+/*
+  Catch up with changes made by other processes, for clients that
+  keep a root open for a long time.
+
+  If the root file has changed, reload it.  Otherwise, another process
+  may still have rewritten a leaf without changing its key, which
+  doesn't touch the root, so let go of the leaves we've loaded.
+  They'll come back from the leaf cache if they haven't changed.
+
+  Return true if we reloaded.
+*/
+bool Root::refresh() {
+  // Check for changes before validating, since a leaf removed by
+  // another process no longer matches its proxy.
+  if (!exists()) {
+    if (modified)
+      // We're new and haven't been persisted yet.
+      return false;
+    throw(runtime_error("Root has been removed.  (Password changed?)"));
+  }
+  if (underlying_is_modified()) {
+    load(); // which validates
+    return true;
+  }
+  validate();
+  for (iterator it = begin(); it != end(); ++it)
+    it->second.unload();
+  return false;
+}
+
+/*
+  If we have been modified, persist to our underlying file:  by
+  logging the leaves that changed, if we can, or else by writing the
+  root in full, which empties the log.
 */
 void Root::commit() {
   validate();
   if (!modified || mode(ReadOnly))
     return;
+  if (log_changes()) {
+    changed.clear();
+    modified = false;
+    settle();
+    validate();
+    if (mode(Verbose))
+      cout << "root logged, size=" << size() << endl;
+    return;
+  }
 
   RootData root_data;
-  for_each(begin(), end(),
-           [&root_data](LeafProxyMapInternalType::value_type val) mutable {
-             RootData_KeyData *key_data = root_data.add_keys();
-             key_data->set_proxy_name(val.first);
-             key_data->set_cached_key(val.second.key());
-           });
+  root_data.set_generation(generation + 1);
+  if (pack)
+    root_data.set_pack_name(pack->basename());
+  if (inline_max)
+    root_data.set_inline_max_size(inline_max);
+  if (filter_rate) {
+    root_data.set_filter_error_rate(filter_rate);
+    root_data.set_filter_max_size(filter_max);
+  }
+  // Where each leaf lands in keys, which the index refers to.
+  map<string, uint32_t> leaf_numbers;
+  for (KeyIndex::const_iterator it = sorted_keys.begin();
+       it != sorted_keys.end(); ++it) {
+    const_iterator found = find(it->second);
+    assert(end() != found);
+    leaf_numbers[it->second] = root_data.keys_size();
+    save_key(it->second, it->first, found->second, root_data.add_keys());
+  }
+  if (payload_index) {
+    RootData_PayloadIndex *index_data = root_data.mutable_payload_index();
+    const PayloadIndex::Postings &postings = payload_index->postings();
+    for (PayloadIndex::Postings::const_iterator it = postings.begin();
+         it != postings.end(); ++it) {
+      RootData_PayloadIndex_Posting *posting = index_data->add_postings();
+      posting->set_trigram(it->first);
+      for (set<string>::const_iterator name_it = it->second.begin();
+           name_it != it->second.end(); ++name_it) {
+        map<string, uint32_t>::const_iterator found =
+            leaf_numbers.find(*name_it);
+        if (leaf_numbers.end() != found)
+          posting->add_leaf(found->second);
+      }
+    }
+  }
   string big_text;
   if (!root_data.SerializeToString(&big_text)) {
     cerr << "Failed to serialize root." << endl;
     throw(runtime_error("Failed to serialize root."));
   }
   string plain_text = compress(big_text);
-  string cipher_text = encrypt(plain_text, password);
+  string cipher_text = cipher->encrypt(plain_text);
   file_contents(cipher_text);
+  generation++;
+  snapshot_size = cipher_text.size();
+  changed.clear();
+  rewrite = false;
+  modified = false;
+  // What we logged is now in the root, and names an older
+  // generation, so removing the log is only tidying up, which mustn't
+  // throw now that the root is written.
+  try {
+    if (log->exists())
+      log->rm();
+  } catch (const exception &e) {
+    cerr << "Failed to remove root log:  " << e.what() << endl;
+  }
+  settle();
 
   validate();
   if (mode(Verbose))
     cout << "root committed, size=" << size() << endl;
 }
 
+/*
+  Return whether we keep the leaf proxy_name in a file of its own,
+  rather than in the root or a pack.
+*/
+bool Root::uses_file(const string &proxy_name) const {
+  const_iterator it = find(proxy_name);
+  return end() != it && !it->second.is_inline() &&
+         !it->second.pack_location().pack;
+}
+
+/*
+  Record that we're about to write or remove the files of leaves,
+  whose fate depends on whether the root, when next persisted, uses
+  them.  Cf. recover().
+*/
+void Root::journal_leaves(const vector_string &leaves) {
+  RootJournal entry;
+  entry.set_host(host_name());
+  entry.set_pid(getpid());
+  for (vector_string::const_iterator it = leaves.begin(); it != leaves.end();
+       ++it)
+    entry.add_leaves(*it);
+  string plain_text;
+  if (!entry.SerializeToString(&plain_text))
+    throw(runtime_error("Failed to serialize root journal."));
+  const string cipher_text = cipher->encrypt(plain_text);
+  Lock L(full_path() + ".lck");
+  journal->append_record(cipher_text);
+  journalled = true;
+}
+
+/*
+  Now that the root is persisted, remove the leaves it no longer
+  refers to, and then our journal records, which have served.  Our
+  caller may no longer undo the commit, so we warn rather than throw:
+  a stray file or record costs nothing that the next load won't
+  recover.
+*/
+void Root::settle() {
+  // The root no longer refers to these, so failing to remove them
+  // just leaves stray files.
+  for (LeafProxyMap::iterator it = doomed.begin(); it != doomed.end(); ++it) {
+    try {
+      it->second.erase();
+    } catch (const exception &e) {
+      cerr << "Failed to remove old leaf " << it->first << ":  " << e.what()
+           << endl;
+    }
+  }
+  doomed.clear();
+  if (!journalled)
+    return;
+  journalled = false;
+  try {
+    Lock L(full_path() + ".lck");
+    const string host = host_name();
+    vector_string records = journal->records();
+    vector_string kept;
+    for (vector_string::const_iterator it = records.begin();
+         it != records.end(); ++it) {
+      RootJournal entry = read_journal(*it);
+      if (entry.host() != host ||
+          entry.pid() != static_cast<uint32_t>(getpid()))
+        kept.push_back(*it);
+    }
+    keep_journal(records, kept);
+  } catch (const exception &e) {
+    cerr << "Failed to update root journal:  " << e.what() << endl;
+  }
+}
+
+/*
+  Finish what processes that stopped while changing the root left
+  undone, by removing the leaf files they journalled that the root
+  doesn't use.  A process still running may yet commit, and we can't
+  tell whether one on another host is, so we leave their records be.
+*/
+void Root::recover() {
+  if (!journal->exists())
+    return;
+  Lock L(full_path() + ".lck");
+  const string host = host_name();
+  vector_string records = journal->records();
+  vector_string kept;
+  int removed = 0;
+  for (vector_string::const_iterator it = records.begin(); it != records.end();
+       ++it) {
+    RootJournal entry = read_journal(*it);
+    if (entry.host() != host || process_is_running(entry.pid())) {
+      kept.push_back(*it);
+      continue;
+    }
+    for (int i = 0; i < entry.leaves_size(); ++i) {
+      File leaf_file(entry.leaves(i), dirname());
+      if (!uses_file(entry.leaves(i)) && leaf_file.exists()) {
+        leaf_file.rm();
+        removed++;
+      }
+    }
+  }
+  keep_journal(records, kept);
+  if (removed)
+    cerr << "Removed " << removed << " leaves left by an interrupted update."
+         << endl;
+}
+
+/*
+  Parse a journal record.
+*/
+RootJournal Root::read_journal(const string &record) const {
+  bool legacy;
+  RootJournal entry;
+  if (!entry.ParseFromString(
+          cipher->decrypt(record.data(), record.size(), legacy)))
+    throw(runtime_error("Corrupt root journal."));
+  return entry;
+}
+
+/*
+  Reduce the journal, which holds records, to kept, which are some of
+  them, in order.  If none, remove it.
+*/
+void Root::keep_journal(const vector_string &records,
+                        const vector_string &kept) {
+  if (kept.size() == records.size() && !kept.empty())
+    return;
+  if (journal->exists())
+    journal->rm();
+  for (vector_string::const_iterator it = kept.begin(); it != kept.end(); ++it)
+    journal->append_record(*it);
+}
+
+/*
+  Describe the leaf proxy_name, with key, as the root records it.
+*/
+void Root::save_key(const string &proxy_name, const string &key,
+                    const LeafProxy &proxy, RootData_KeyData *key_data) const {
+  key_data->set_proxy_name(proxy_name);
+  key_data->set_cached_key(key);
+  const PackLocation &location = proxy.pack_location();
+  if (proxy.is_inline())
+    key_data->set_inline_payload(proxy.payload());
+  else if (location.pack) {
+    key_data->set_pack_offset(location.offset);
+    key_data->set_pack_length(location.length);
+  }
+  if (proxy.payload_filter())
+    key_data->set_payload_filter(proxy.payload_filter()->data());
+}
+
+/*
+  Append the leaves we've changed to the log, rather than writing the
+  root in full, if we can, and return whether we did.
+
+  We can't if the root is new or something other than leaves changed,
+  or if another process has changed the root since we read it.
+  Nor do we log changes to an indexed root, since the index would
+  need them too, nor let the log grow larger than the root, past
+  which loading would cost more than writing the root in full.
+*/
+bool Root::log_changes() {
+  if (rewrite || changed.empty() || payload_index || !exists())
+    return false;
+  RootDelta delta;
+  delta.set_generation(generation);
+  for (set<string>::const_iterator it = changed.begin(); it != changed.end();
+       ++it) {
+    const_iterator found = find(*it);
+    if (end() == found)
+      delta.add_removed(*it);
+    else
+      save_key(*it, found->second.key(), found->second, delta.add_set());
+  }
+  string plain_text;
+  if (!delta.SerializeToString(&plain_text))
+    throw(runtime_error("Failed to serialize root change."));
+  const string cipher_text = cipher->encrypt(plain_text);
+  Lock L(full_path() + ".lck");
+  // If another process has written the root since we read it, our
+  // record would name the wrong generation, so write it in full.
+  if (underlying_is_modified() ||
+      log->bytes() + cipher_text.size() > snapshot_size)
+    return false;
+  log->append_record(cipher_text);
+  // The change is persisted, so we mustn't throw.  Others may be
+  // slow to notice it, though.
+  try {
+    touch();
+  } catch (const exception &e) {
+    cerr << e.what() << endl;
+  }
+  return true;
+}
+
+/*
+  Write key and payload to a leaf named proxy_key (or a new name, if
+  empty):  in the root if the payload is small enough, else in our
+  pack or a file of its own.  Return the leaf's proxy, for the caller
+  to put in the root.
+*/
+LeafProxy Root::write_leaf(const string &proxy_key, const string &key,
+                           const string &payload) {
+  LeafProxy proxy(cipher, proxy_key.empty() ? File().basename() : proxy_key,
+                  dirname());
+  if (fits_inline(payload))
+    proxy.set_inline(key, payload);
+  else {
+    if (pack)
+      proxy.pack_location(PackLocation(pack));
+    proxy.set(key, payload);
+  }
+  set_filter(proxy, payload);
+  return proxy;
+}
+
+/*
+  Give proxy a filter of payload, if we keep filters.
+*/
+void Root::set_filter(LeafProxy &proxy, const string &payload) const {
+  if (filter_rate)
+    proxy.payload_filter(boost::shared_ptr<const PayloadFilter>(
+        new PayloadFilter(payload, filter_rate, filter_max)));
+}
+
 /*
   Confirm that all is well.
   It is an error if all is not, and we will die.
@@ -261,6 +926,7 @@ void Root::commit() {
 void Root::validate(bool force_load) const {
   assert(valid);
   assert(password.size() > 0);
+  assert(sorted_keys.size() == size());
   // Validate each of the leaf proxies.  Note that this won't cause them to
   // load.
   for (const_iterator it = begin(); it != end(); it++) {
@@ -274,14 +940,83 @@ void Root::validate(bool force_load) const {
 */
 void Root::checksum(bool force_load) const {
   validate(true);
-  LeafProxyMap::LPM_Set leaves = this->as_set();
   string text;
-  for (LeafProxyMap::LPM_Set::iterator it = leaves.begin(); it != leaves.end();
-       ++it) {
-    string key = (*it).key();
-    string value = (*it).payload();
-    text.append(key);
-    text.append(value);
+  for (KeyIndex::const_iterator it = sorted_keys.begin();
+       it != sorted_keys.end();) {
+    // Leaves that share a key go in payload order, which unlike
+    // their names survives a change of password.
+    vector_string payloads;
+    const string &key = it->first;
+    for (; it != sorted_keys.end() && it->first == key; ++it)
+      payloads.push_back(find(it->second)->second.payload());
+    sort(payloads.begin(), payloads.end());
+    for (vector_string::const_iterator payload = payloads.begin();
+         payload != payloads.end(); ++payload) {
+      text.append(key);
+      text.append(*payload);
+    }
   }
   cout << message_digest(text) << endl;
 }
+
+/*
+  Put leaves, which must be ours, in key order.  When they are a good
+  part of the root, walking the key index is quicker than sorting
+  them.
+*/
+void Root::sort_by_key(LeafQuery::Results &leaves) {
+  if (leaves.size() * 16 < size()) {
+    LeafQuery::sort_by_key(leaves);
+    return;
+  }
+  unordered_map<string, iterator> wanted;
+  for (LeafQuery::Results::const_iterator it = leaves.begin();
+       it != leaves.end(); ++it)
+    wanted[(*it)->first] = *it;
+  LeafQuery::Results sorted;
+  sorted.reserve(leaves.size());
+  for (KeyIndex::const_iterator it = sorted_keys.begin();
+       it != sorted_keys.end(); ++it) {
+    unordered_map<string, iterator>::const_iterator found =
+        wanted.find(it->second);
+    if (wanted.end() != found)
+      sorted.push_back(found->second);
+  }
+  assert(sorted.size() == leaves.size());
+  leaves.swap(sorted);
+}
+
+/*
+  Return the leaves whose keys begin with any of prefixes (or, if
+  there are none, all leaves) and satisfy low <= key < high, in key
+  order.  An empty high is no bound.  We search the key index, so the
+  cost is in what we find, not in the size of the root.
+*/
+LeafQuery::Results Root::keys_within(const vector_string &prefixes,
+                                     const string &low, const string &high) {
+  vector_string sorted(prefixes);
+  if (sorted.empty())
+    sorted.push_back(string());
+  sort(sorted.begin(), sorted.end());
+  LeafQuery::Results leaves;
+  string last;
+  for (size_t i = 0; i < sorted.size(); ++i) {
+    // Sorted, a prefix that extends the last one we searched adds
+    // nothing, and the rest find disjoint runs of keys, in order.
+    if (i > 0 && 0 == sorted[i].compare(0, last.size(), last))
+      continue;
+    last = sorted[i];
+    const string past = KeyIndex::prefix_end(last);
+    string stop = high;
+    if (stop.empty() || (!past.empty() && past < stop))
+      stop = past;
+    KeyIndex::Range range = sorted_keys.range(max(low, last), stop);
+    for (KeyIndex::const_iterator it = range.first; it != range.second;
+         ++it) {
+      iterator leaf = find(it->second);
+      assert(end() != leaf);
+      leaves.push_back(leaf);
+    }
+  }
+  return leaves;
+}
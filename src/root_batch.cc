@@ -0,0 +1,188 @@
+/*
+  Copyright 2026  Jeff Abrahamson
+
+  This file is part of srd.
+
+  srd is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  srd is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with srd.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "srd.h"
+
+using namespace srd;
+using namespace std;
+
+RootBatch::RootBatch(Root &root) : m_root(root) {}
+
+/*
+  Stage a new leaf.
+*/
+void RootBatch::add_leaf(const string &key, const string &payload) {
+  m_adds.push_back(KeyPayload(key, payload));
+}
+
+/*
+  Stage new contents for an existing leaf.
+*/
+void RootBatch::set_leaf(const string &proxy_key, const string &key,
+                         const string &payload) {
+  stage_existing(proxy_key);
+  m_sets[proxy_key] = KeyPayload(key, payload);
+}
+
+/*
+  Stage removal of an existing leaf.
+*/
+void RootBatch::rm_leaf(const string &proxy_key) {
+  stage_existing(proxy_key);
+  m_rms.insert(proxy_key);
+}
+
+/*
+  Make sure proxy_key names a leaf we haven't already staged a change
+  to, since we wouldn't know which change to believe.
+*/
+void RootBatch::stage_existing(const string &proxy_key) {
+  if (m_root.end() == m_root.find(proxy_key))
+    throw(runtime_error("Key not found."));
+  if (m_sets.count(proxy_key) || m_rms.count(proxy_key))
+    throw(runtime_error("Leaf already changed in this batch."));
+}
+
+/*
+  Apply the staged changes and persist the root, once.
+
+  First journal the leaf files we'll write or remove.  Then write
+  every new or changed leaf to a new leaf, which nothing yet refers
+  to.  If that fails, remove what we wrote.  Then point the root at
+  the new leaves and commit it.  If that fails, put the root back as
+  it was.  Only then does the root remove the leaves that it no longer
+  refers to.  If we stop part way, the next load removes whichever
+  journalled files the root doesn't use.
+
+  On failure, throws with the root (in memory and on disk) unchanged.
+*/
+void RootBatch::commit() {
+  Root &root = m_root;
+  root.validate();
+  if (mode(ReadOnly))
+    throw(runtime_error("Database is read-only."));
+  if (root.exists() && root.underlying_is_modified())
+    root.load();
+  for (map<string, KeyPayload>::const_iterator it = m_sets.begin();
+       it != m_sets.end(); ++it)
+    if (root.end() == root.find(it->first))
+      throw(runtime_error("Key not found."));
+  for (set<string>::const_iterator it = m_rms.begin(); it != m_rms.end(); ++it)
+    if (root.end() == root.find(*it))
+      throw(runtime_error("Key not found."));
+
+  vector<KeyPayload> incoming(m_adds);
+  for (map<string, KeyPayload>::const_iterator it = m_sets.begin();
+       it != m_sets.end(); ++it)
+    incoming.push_back(it->second);
+  vector<string> written_names;
+  vector_string journalled;
+  for (vector<KeyPayload>::const_iterator it = incoming.begin();
+       it != incoming.end(); ++it) {
+    written_names.push_back(File().basename());
+    if (root.has_file(it->second))
+      journalled.push_back(written_names.back());
+  }
+  for (map<string, KeyPayload>::const_iterator it = m_sets.begin();
+       it != m_sets.end(); ++it)
+    if (root.uses_file(it->first))
+      journalled.push_back(it->first);
+  for (set<string>::const_iterator it = m_rms.begin(); it != m_rms.end(); ++it)
+    if (root.uses_file(*it))
+      journalled.push_back(*it);
+  if (!journalled.empty())
+    root.journal_leaves(journalled);
+
+  LeafProxyMap written;
+  try {
+    for (size_t i = 0; i < incoming.size(); ++i)
+      written[written_names[i]] = root.write_leaf(
+          written_names[i], incoming[i].first, incoming[i].second);
+  } catch (...) {
+    for (LeafProxyMap::iterator it = written.begin(); it != written.end();
+         ++it)
+      it->second.erase();
+    throw;
+  }
+
+  LeafProxyMap replaced;
+  for (map<string, KeyPayload>::const_iterator it = m_sets.begin();
+       it != m_sets.end(); ++it)
+    replaced[it->first] = root.find(it->first)->second;
+  for (set<string>::const_iterator it = m_rms.begin(); it != m_rms.end(); ++it)
+    replaced[*it] = root.find(*it)->second;
+  boost::shared_ptr<PayloadIndex> old_index = root.payload_index;
+  bool old_modified = root.modified;
+  set<string> old_changed = root.changed;
+
+  try {
+    if (old_index)
+      root.payload_index.reset(new PayloadIndex(*old_index));
+    for (LeafProxyMap::iterator it = replaced.begin(); it != replaced.end();
+         ++it) {
+      root.erase(it->first);
+      root.sorted_keys.remove(it->first);
+      if (root.payload_index)
+        root.payload_index->remove(it->first);
+      root.leaf_changed(it->first);
+      root.doomed[it->first] = it->second;
+    }
+    for (size_t i = 0; i < written_names.size(); ++i) {
+      root[written_names[i]] = written.find(written_names[i])->second;
+      root.sorted_keys.set(written_names[i], incoming[i].first);
+      if (root.payload_index)
+        root.payload_index->add(written_names[i], incoming[i].second);
+      root.leaf_changed(written_names[i]);
+    }
+    root.commit();
+  } catch (...) {
+    for (LeafProxyMap::iterator it = written.begin(); it != written.end();
+         ++it) {
+      root.erase(it->first);
+      root.sorted_keys.remove(it->first);
+      it->second.erase();
+    }
+    for (LeafProxyMap::iterator it = replaced.begin(); it != replaced.end();
+         ++it) {
+      root[it->first] = it->second;
+      root.sorted_keys.set(it->first, it->second.key());
+    }
+    root.payload_index = old_index;
+    root.changed.swap(old_changed);
+    for (LeafProxyMap::iterator it = replaced.begin(); it != replaced.end();
+         ++it)
+      root.doomed.erase(it->first);
+    root.modified = old_modified;
+    throw;
+  }
+
+  if (mode(Verbose))
+    cout << "batch committed, added=" << m_adds.size()
+         << ", changed=" << m_sets.size() << ", removed=" << m_rms.size()
+         << endl;
+  m_adds.clear();
+  m_sets.clear();
+  m_rms.clear();
+  root.validate();
+}
@@ -0,0 +1,244 @@
+/*
+  Copyright 2026  Jeff Abrahamson
+
+  This file is part of srd.
+
+  srd is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  srd is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with srd.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+#include "srd.h"
+#include "test_text.h"
+
+using namespace srd;
+using namespace std;
+
+namespace {
+
+/*
+  Return the payload of the leaf with key, or "" if there isn't one.
+*/
+string payload_of(Root &root, const string &key) {
+  LeafProxyMap found =
+      root.filter_keys(vector_string(1, key), true, IdentStringMatcher());
+  if (1 != found.size())
+    return "";
+  return found.begin()->second.payload();
+}
+
+/*
+  Add, change and remove leaves in one batch, and confirm that the
+  root is only written on commit and that old leaves are removed.
+*/
+int test_batch(const bool indexed) {
+  int ret = 0;
+  vector_string messages = test_text();
+  string password = pseudo_random_string(20);
+  string dir;
+  {
+    Root root(password, "", true);
+    dir = root.dirname();
+    if (indexed) {
+      root.commit();
+      root.build_index();
+    }
+    RootBatch batch(root);
+    for (size_t i = 0; i < messages.size(); ++i) {
+      ostringstream key;
+      key << "key-" << i;
+      batch.add_leaf(key.str(), messages[i]);
+    }
+    batch.commit();
+    if (root.size() != messages.size()) {
+      cout << "Batch added " << root.size() << " leaves, expected "
+           << messages.size() << endl;
+      ret++;
+    }
+  }
+  vector_string old_leaves;
+  {
+    Root root(password, "");
+    // Not the modification time, which can be too coarse to change.
+    string before = root.file_contents();
+    string changed = root.filter_keys(vector_string(1, "key-0"), true,
+                                      IdentStringMatcher())
+                         .begin()
+                         ->first;
+    RootBatch batch(root);
+    batch.set_leaf(changed, "key-0", "a changed payload");
+    for (Root::iterator it = root.begin(); it != root.end(); ++it)
+      if (it->first != changed)
+        batch.rm_leaf(it->first);
+    batch.add_leaf("added", "an added payload");
+    try {
+      batch.rm_leaf(changed);
+      cout << "Staged two changes to one leaf." << endl;
+      ret++;
+    } catch (const runtime_error &e) {
+      // As expected.
+    }
+    if (root.file_contents() != before) {
+      cout << "Root written before batch commit." << endl;
+      ret++;
+    }
+    for (Root::iterator it = root.begin(); it != root.end(); ++it)
+      old_leaves.push_back(dir + "/" + it->first);
+    batch.commit();
+    if (root.file_contents() == before) {
+      cout << "Root not written on batch commit." << endl;
+      ret++;
+    }
+    if (root.end() != root.find(changed)) {
+      cout << "Changed leaf kept its old name." << endl;
+      ret++;
+    }
+  }
+  {
+    Root root(password, "");
+    if (2 != root.size()) {
+      cout << "Batch left " << root.size() << " leaves, expected 2." << endl;
+      ret++;
+    }
+    if (payload_of(root, "key-0") != "a changed payload" ||
+        payload_of(root, "added") != "an added payload") {
+      cout << "Batch changes not persisted." << endl;
+      ret++;
+    }
+    for (vector_string::iterator it = old_leaves.begin();
+         it != old_leaves.end(); ++it)
+      if (file_exists(*it)) {
+        cout << "Old leaf remains after batch:  " << *it << endl;
+        ret++;
+      }
+    if (indexed) {
+      vector_string pattern(1, "changed");
+      if (1 != root.filter_payloads(pattern, false, UpperStringMatcher())
+                   .size()) {
+        cout << "Index missed batch change." << endl;
+        ret++;
+      }
+      pattern[0] = messages[1].substr(0, 20);
+      if (0 != root.filter_payloads(pattern, false, IdentStringMatcher())
+                   .size()) {
+        cout << "Index found removed leaf." << endl;
+        ret++;
+      }
+    }
+  }
+  return ret;
+}
+
+/*
+  A batch that fails or is never committed must leave no trace.
+*/
+int test_batch_rollback() {
+  int ret = 0;
+  string password = pseudo_random_string(20);
+  Root root(password, "", true);
+  root.add_leaf("one", "the first payload");
+  root.add_leaf("two", "the second payload");
+  string one = root.filter_keys(vector_string(1, "one"), true,
+                                IdentStringMatcher())
+                   .begin()
+                   ->first;
+  string two = root.filter_keys(vector_string(1, "two"), true,
+                                IdentStringMatcher())
+                   .begin()
+                   ->first;
+  {
+    RootBatch batch(root);
+    batch.add_leaf("three", "never committed");
+    batch.rm_leaf(one);
+  }
+  {
+    RootBatch batch(root);
+    batch.add_leaf("three", "the third payload");
+    batch.set_leaf(one, "one", "a changed payload");
+    batch.rm_leaf(two);
+    // Someone else removes two before we commit.
+    root.rm_leaf(two);
+    try {
+      batch.commit();
+      cout << "Batch on a removed leaf did not fail." << endl;
+      ret++;
+    } catch (const runtime_error &e) {
+      // As expected.
+    }
+  }
+  if (1 != root.size() || payload_of(root, "one") != "the first payload") {
+    cout << "Failed batch changed the root." << endl;
+    ret++;
+  }
+  if (!file_exists(root.dirname() + "/" + one)) {
+    cout << "Failed batch removed a leaf." << endl;
+    ret++;
+  }
+  return ret;
+}
+
+/*
+  Once the root is written, failing to tidy up after it must not undo
+  the batch, whose leaves the root now refers to.
+*/
+int test_batch_tidy_failure() {
+  int ret = 0;
+  string password = pseudo_random_string(20);
+  Root root(password, "", true);
+  root.add_leaf("one", "the first payload");
+  // Journal records we can't read make dropping ours fail.
+  RootLog journal(root.basename() + ".journal", root.dirname());
+  journal.append_record("not a journal record");
+  RootBatch batch(root);
+  batch.add_leaf("two", "the second payload");
+  try {
+    batch.commit();
+  } catch (const runtime_error &e) {
+    cout << "Tidying up after a batch threw:  " << e.what() << endl;
+    ret++;
+  }
+  LeafProxyMap two =
+      root.filter_keys(vector_string(1, "two"), true, IdentStringMatcher());
+  if (1 != two.size() ||
+      !file_exists(root.dirname() + "/" + two.begin()->first)) {
+    cout << "Batch lost a leaf the root refers to." << endl;
+    ret++;
+  }
+  journal.rm();
+  return ret;
+}
+}
+
+int main(int argc, char *argv[]) {
+  cout << "Testing root_batch.cpp" << endl;
+
+  mode(Verbose, false);
+  mode(Testing, true);
+  mode(ReadOnly, false);
+
+  int err_count = 0;
+  err_count += test_batch(false);
+  err_count += test_batch(true);
+  err_count += test_batch_rollback();
+  err_count += test_batch_tidy_failure();
+
+  if (err_count)
+    cout << "Errors (" << err_count << ") in test!!" << endl;
+  else
+    cout << "All tests passed!" << endl;
+  return 0 != err_count;
+}
@@ -0,0 +1,104 @@
+/*
+  Copyright 2026  Jeff Abrahamson
+
+  This file is part of srd.
+
+  srd is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  srd is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with srd.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <errno.h>
+#include <stdexcept>
+#include <string>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+#include "srd.h"
+
+using namespace srd;
+using namespace std;
+
+RootLog::RootLog(const string base_name, const string dir_name)
+    : Pack(base_name, dir_name) {}
+
+/*
+  Append record, preceded by its size in four bytes, least
+  significant first.
+
+  A record cut short by a crash would otherwise swallow the start of
+  this one, so we drop it first.  The caller must keep others from
+  appending meanwhile.
+*/
+void RootLog::append_record(const string &record) {
+  const uint64_t whole = scan(NULL);
+  if (whole < bytes() && truncate(full_path().c_str(), whole))
+    throw(runtime_error("Failed to truncate root log:  " +
+                        string(strerror(errno))));
+  string framed(4, '\0');
+  const uint32_t size = record.size();
+  for (int i = 0; i < 4; ++i)
+    framed[i] = static_cast<char>(size >> (8 * i));
+  framed += record;
+  append(framed);
+}
+
+/*
+  Return the records in the log, in the order we appended them, or
+  none if there is no log.  A record cut short, as by a crash while
+  appending it, ends the log.
+*/
+vector_string RootLog::records() {
+  vector_string out;
+  scan(&out);
+  return out;
+}
+
+/*
+  Read the whole records in the log into out, if given, and return
+  where the last of them ends.
+*/
+uint64_t RootLog::scan(vector_string *out) {
+  if (!exists())
+    return 0;
+  boost::shared_ptr<FileView> view = file_view();
+  const unsigned char *data =
+      reinterpret_cast<const unsigned char *>(view->data());
+  size_t at = 0;
+  while (at + 4 <= view->size()) {
+    uint32_t size = 0;
+    for (int i = 0; i < 4; ++i)
+      size |= static_cast<uint32_t>(data[at + i]) << (8 * i);
+    if (size > view->size() - at - 4)
+      break;
+    if (out)
+      out->push_back(string(view->data() + at + 4, size));
+    at += 4 + size;
+  }
+  return at;
+}
+
+/*
+  Return the size of the log in bytes, or zero if there is none.
+*/
+uint64_t RootLog::bytes() {
+  struct stat stat_buf;
+  if (stat(full_path().c_str(), &stat_buf)) {
+    if (ENOENT == errno)
+      return 0;
+    throw(runtime_error("Failed to stat root log:  " +
+                        string(strerror(errno))));
+  }
+  return stat_buf.st_size;
+}
@@ -0,0 +1,111 @@
+/*
+  Copyright 2026  Jeff Abrahamson
+
+  This file is part of srd.
+
+  srd is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  srd is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with srd.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <iostream>
+#include <string>
+
+#include "srd.h"
+#include "test_text.h"
+
+using namespace srd;
+using namespace std;
+
+namespace {
+
+/*
+  Append records, including an empty one, and read them back.
+*/
+int test_append_read(const vector_string &messages) {
+  int ret = 0;
+  RootLog log(File().basename(), "/tmp");
+  if (!log.records().empty() || log.bytes()) {
+    cout << "Missing log is not empty." << endl;
+    ret++;
+  }
+  vector_string appended(messages);
+  appended.push_back("");
+  uint64_t bytes = 0;
+  for (vector_string::const_iterator it = appended.begin();
+       it != appended.end(); ++it) {
+    log.append_record(*it);
+    bytes += 4 + it->size();
+  }
+  if (log.records() != appended) {
+    cout << "Records read do not match those appended." << endl;
+    ret++;
+  }
+  if (log.bytes() != bytes) {
+    cout << "Log size is " << log.bytes() << ", expected " << bytes << "."
+         << endl;
+    ret++;
+  }
+  log.rm();
+  return ret;
+}
+
+/*
+  A record cut short, or a size with nothing after it, ends the log
+  without error, and the next append replaces it.
+*/
+int test_torn_tail() {
+  int ret = 0;
+  RootLog log(File().basename(), "/tmp");
+  log.append_record("first");
+  log.append(string("\x09\x00\x00\x00", 4) + "second");
+  if (log.records().size() != 1 || log.records()[0] != "first") {
+    cout << "Torn record was not dropped." << endl;
+    ret++;
+  }
+  log.append_record(string(300, 'x'));
+  vector_string records = log.records();
+  if (records.size() != 2 || records[0] != "first" ||
+      records[1] != string(300, 'x')) {
+    cout << "Record appended after a torn one was not read back." << endl;
+    ret++;
+  }
+  log.rm();
+
+  log.append_record("first");
+  log.append(string("\x09\x00", 2));
+  if (log.records().size() != 1) {
+    cout << "Torn size was not dropped." << endl;
+    ret++;
+  }
+  log.rm();
+  return ret;
+}
+}
+
+int main(int argc, char *argv[]) {
+  cout << "Testing root_log.cpp" << endl;
+
+  mode(Verbose, false);
+  mode(Testing, true);
+  mode(ReadOnly, false);
+
+  int err_count = 0;
+  err_count += test_append_read(test_text());
+  err_count += test_torn_tail();
+
+  if (err_count)
+    cout << "Errors (" << err_count << ") in test!!" << endl;
+  else
+    cout << "All tests passed!" << endl;
+  return 0 != err_count;
+}
@@ -19,9 +19,12 @@
 
 #include <boost/bind.hpp>
 #include <errno.h>
+#include <fcntl.h>
 #include <string>
 #include <string.h>
 #include <sstream>
+#include <sys/stat.h>
+#include <sys/wait.h>
 #include <time.h>
 #include <unistd.h>
 
@@ -237,6 +240,398 @@ bool confirm_ordering(Root &root) {
   return 0 == errors;
 }
 
+/*
+  Confirm that the root's key index lists each of its leaves, under
+  its key, in key order.
+*/
+int count_key_index_errors(Root &root) {
+  int errors = 0;
+  const KeyIndex &index = root.key_index();
+  if (index.size() != root.size())
+    errors++;
+  string last_key;
+  for (KeyIndex::const_iterator it = index.begin(); it != index.end(); ++it) {
+    Root::iterator found = root.find(it->second);
+    if (root.end() == found || found->second.key() != it->first ||
+        it->first < last_key)
+      errors++;
+    last_key = it->first;
+  }
+  if (errors > 0)
+    cout << "Found " << errors << " key index errors." << endl;
+  return errors;
+}
+
+/*
+  Confirm that the key index follows leaves as they come, go, and
+  change key, one at a time and in batches, and survives a reload.
+*/
+int test_root_key_index() {
+  cout << "test_root_key_index()" << endl;
+  int error_count = 0;
+  string password = pseudo_random_string(20);
+  {
+    Root root(password, "", true);
+    vector_string messages = test_text();
+    for (size_t i = 0; i < messages.size(); ++i)
+      root.add_leaf(message_digest(messages[i]), messages[i], false);
+    root.add_leaf("same", "one", false);
+    root.add_leaf("same", "two", false);
+    root.commit();
+    error_count += count_key_index_errors(root);
+
+    root.set_leaf(root.begin()->first, "a new key", "a new payload");
+    root.rm_leaf((++root.begin())->first);
+    error_count += count_key_index_errors(root);
+
+    RootBatch batch(root);
+    Root::iterator it = root.begin();
+    batch.add_leaf("batch added", "payload");
+    batch.set_leaf((++it)->first, "batch changed", "payload");
+    batch.rm_leaf((++it)->first);
+    batch.commit();
+    error_count += count_key_index_errors(root);
+  }
+  Root root(password, "");
+  error_count += count_key_index_errors(root);
+
+  vector_string all(1, "");
+  LeafQuery::Results results =
+      LeafQuery(root, IdentStringMatcher()).keys(all, false).run();
+  root.sort_by_key(results);
+  KeyIndex::const_iterator entry = root.key_index().begin();
+  for (size_t i = 0; i < results.size(); ++i, ++entry)
+    if (results[i]->first != entry->second) {
+      cout << "Sorted results differ from key index." << endl;
+      error_count++;
+      break;
+    }
+  return error_count;
+}
+
+/*
+  Return the number of leaves that keys_within() finds but
+  shouldn't, or doesn't find but should, or finds out of order.  We
+  compare with a walk over the whole key index.
+*/
+int count_keys_within_errors(Root &root, const vector_string &prefixes,
+                             const string &low, const string &high) {
+  vector_string expected;
+  const KeyIndex &index = root.key_index();
+  for (KeyIndex::const_iterator it = index.begin(); it != index.end(); ++it) {
+    const string &key = it->first;
+    bool wanted = prefixes.empty();
+    for (size_t i = 0; i < prefixes.size(); ++i)
+      if (0 == key.compare(0, prefixes[i].size(), prefixes[i]))
+        wanted = true;
+    if (wanted && low <= key && (high.empty() || key < high))
+      expected.push_back(it->second);
+  }
+  LeafQuery::Results found = root.keys_within(prefixes, low, high);
+  int error_count = 0;
+  if (found.size() != expected.size())
+    error_count++;
+  for (size_t i = 0; i < found.size() && i < expected.size(); ++i)
+    if (found[i]->first != expected[i])
+      error_count++;
+  if (error_count)
+    cout << "keys_within(" << prefixes.size() << " prefixes, \"" << low
+         << "\", \"" << high << "\") found " << found.size()
+         << " leaves, expected " << expected.size() << "." << endl;
+  return error_count;
+}
+
+int test_root_keys_within() {
+  cout << "test_root_keys_within()" << endl;
+  string password = pseudo_random_string(20);
+  Root root(password, "", true);
+  vector_string messages = test_text();
+  for (size_t i = 0; i < messages.size(); ++i)
+    root.add_leaf(message_digest(messages[i]), messages[i], false);
+  root.add_leaf("same", "one", false);
+  root.add_leaf("same", "two", false);
+  root.commit();
+
+  int error_count = 0;
+  vector_string none;
+  error_count += count_keys_within_errors(root, none, "", "");
+  error_count += count_keys_within_errors(root, none, "4", "a");
+  error_count += count_keys_within_errors(root, none, "a", "4");
+  error_count += count_keys_within_errors(root, none, "same", "");
+  const char *const prefix_list[] = {"a", "3", "ab", "same", "", "z"};
+  vector_string prefixes;
+  for (size_t i = 0; i < sizeof(prefix_list) / sizeof(prefix_list[0]); ++i) {
+    prefixes.push_back(prefix_list[i]);
+    error_count += count_keys_within_errors(root, prefixes, "", "");
+    error_count += count_keys_within_errors(root, prefixes, "35", "b");
+  }
+  return error_count;
+}
+
+/*
+  Return the number of leaves without a payload filter, or whose
+  filter lacks what their payload contains.
+*/
+int count_filter_errors(Root &root) {
+  int error_count = 0;
+  for (Root::iterator it = root.begin(); it != root.end(); ++it) {
+    const boost::shared_ptr<const PayloadFilter> &filter =
+        it->second.payload_filter();
+    const string payload = it->second.payload();
+    if (!filter || !filter->might_contain(payload.substr(0, 10)))
+      error_count++;
+  }
+  if (error_count)
+    cout << error_count << " leaves lack good payload filters." << endl;
+  return error_count;
+}
+
+/*
+  Confirm that payload filters persist, follow changes to leaves, and
+  go when asked.
+*/
+int test_root_filters() {
+  cout << "test_root_filters()" << endl;
+  int error_count = 0;
+  string password = pseudo_random_string(20);
+  vector_string messages = test_text();
+  {
+    Root root(password, "", true);
+    for (size_t i = 0; i < messages.size() / 2; ++i)
+      root.add_leaf(message_digest(messages[i]), messages[i], false);
+    root.commit();
+    root.filter_leaves(0.01, 64);
+  }
+  {
+    Root root(password, "");
+    error_count += count_filter_errors(root);
+    root.set_leaf(root.begin()->first, "a new key", "a new payload");
+    for (size_t i = messages.size() / 2; i < messages.size(); ++i)
+      root.add_leaf(message_digest(messages[i]), messages[i], false);
+    root.commit();
+    error_count += count_filter_errors(root);
+  }
+  Root root(password, "");
+  error_count += count_filter_errors(root);
+  root.filter_leaves(0, 0);
+  for (Root::iterator it = root.begin(); it != root.end(); ++it)
+    if (it->second.payload_filter()) {
+      cout << "Payload filter not removed." << endl;
+      error_count++;
+      break;
+    }
+  return error_count;
+}
+
+/*
+  Return the number of ways root differs from expected, which maps
+  keys to payloads.
+*/
+int count_contents_errors(Root &root, const map<string, string> &expected) {
+  map<string, string> got;
+  for (Root::iterator it = root.begin(); it != root.end(); ++it)
+    got[it->second.key()] = it->second.payload();
+  if (got == expected)
+    return count_key_index_errors(root);
+  cout << "Root has " << got.size() << " leaves, expected " << expected.size()
+       << ", or they differ." << endl;
+  return 1;
+}
+
+/*
+  Confirm that small changes to a root are logged rather than written
+  in full, that they survive a reload, that the log is compacted into
+  the root when it grows, and that a log left over from before
+  compaction is ignored.
+*/
+int test_root_log() {
+  cout << "test_root_log()" << endl;
+  int error_count = 0;
+  string password = pseudo_random_string(20);
+  vector_string messages = test_text();
+  map<string, string> expected;
+  string base_name, dir_name;
+  {
+    Root root(password, "", true);
+    for (size_t i = 0; i < messages.size(); ++i) {
+      ostringstream ss;
+      ss << "key " << i;
+      root.add_leaf(ss.str(), messages[i], false);
+      expected[ss.str()] = messages[i];
+    }
+    root.commit();
+    base_name = root.basename() + ".log";
+    dir_name = root.dirname();
+  }
+  RootLog log(base_name, dir_name);
+  if (log.exists()) {
+    cout << "New root was logged." << endl;
+    error_count++;
+  }
+  {
+    Root root(password, "");
+    Root::iterator first = root.begin();
+    expected.erase(first->second.key());
+    root.rm_leaf(first->first);
+    first = root.begin();
+    expected.erase(first->second.key());
+    expected["a new key"] = "a new payload";
+    root.set_leaf(first->first, "a new key", "a new payload");
+    expected["an added key"] = "an added payload";
+    root.add_leaf("an added key", "an added payload");
+  }
+  if (log.records().empty()) {
+    cout << "Changes were not logged." << endl;
+    error_count++;
+  }
+  vector_string stale = log.records();
+  {
+    Root root(password, "");
+    error_count += count_contents_errors(root, expected);
+    // Changing the key changes the root.
+    for (int i = 0; log.exists() && i < 1000; ++i) {
+      const string name = root.key_index().prefix("an added key").first->second;
+      expected.erase(root.find(name)->second.key());
+      ostringstream ss;
+      ss << "an added key " << i;
+      expected[ss.str()] = "an added payload";
+      root.set_leaf(name, ss.str(), "an added payload");
+      root.commit();
+    }
+    if (log.exists()) {
+      cout << "Root log was never compacted." << endl;
+      error_count++;
+    }
+  }
+  for (size_t i = 0; i < stale.size(); ++i)
+    log.append_record(stale[i]);
+  {
+    Root root(password, "");
+    error_count += count_contents_errors(root, expected);
+  }
+
+  // A change made while another process rewrites the root must not
+  // be logged against the generation the rewrite replaced, even if
+  // the rewrite leaves the root's modification time as it was.
+  {
+    Root root(password, "");
+    expected["a later key"] = "a later payload";
+    root.add_leaf("a later key", "a later payload", false);
+    struct stat before;
+    stat(root.full_path().c_str(), &before);
+    {
+      Root other(password, "");
+      other.filter_leaves(0.01, 64);
+    }
+    const struct timespec times[2] = {before.st_atim, before.st_mtim};
+    utimensat(AT_FDCWD, root.full_path().c_str(), times, 0);
+    root.commit();
+  }
+  Root root(password, "");
+  error_count += count_contents_errors(root, expected);
+  return error_count;
+}
+
+/*
+  Return the id of a process that has exited.
+*/
+pid_t exited_pid() {
+  pid_t pid = fork();
+  if (0 == pid)
+    _exit(0);
+  waitpid(pid, NULL, 0);
+  return pid;
+}
+
+/*
+  Journal leaves as process pid would, as though it stopped before
+  finishing with them.
+*/
+void journal_leaves(const string &password, Root &root, const pid_t pid,
+                    const vector_string &leaves) {
+  char host[256];
+  gethostname(host, sizeof(host));
+  host[sizeof(host) - 1] = '\0';
+  RootJournal entry;
+  entry.set_host(host);
+  entry.set_pid(pid);
+  for (size_t i = 0; i < leaves.size(); ++i)
+    entry.add_leaves(leaves[i]);
+  RootLog journal(root.basename() + ".journal", root.dirname());
+  journal.append_record(CipherContext(password).encrypt(
+      entry.SerializeAsString()));
+}
+
+/*
+  Confirm that changing leaves leaves no journal behind, and that
+  loading a root removes the journalled leaf files of a process that
+  stopped part way, but only those the root doesn't use, and only if
+  the process is no longer running.
+*/
+int test_root_journal() {
+  cout << "test_root_journal()" << endl;
+  int error_count = 0;
+  string password = pseudo_random_string(20);
+  vector_string messages = test_text();
+  string used, dir_name;
+  {
+    Root root(password, "", true);
+    for (size_t i = 0; i < messages.size(); ++i)
+      root.add_leaf(message_digest(messages[i]), messages[i], false);
+    root.commit();
+    root.rm_leaf(root.begin()->first);
+    root.add_leaf("added", "an added payload");
+    used = root.begin()->first;
+    dir_name = root.dirname();
+    if (RootLog(root.basename() + ".journal", dir_name).exists()) {
+      cout << "Root journal not removed." << endl;
+      error_count++;
+    }
+  }
+  File orphan(File().basename(), dir_name);
+  File live_orphan(File().basename(), dir_name);
+  string data("orphan");
+  orphan.file_contents(data);
+  live_orphan.file_contents(data);
+  {
+    Root root(password, "");
+    vector_string leaves;
+    leaves.push_back(orphan.basename());
+    leaves.push_back(used);
+    journal_leaves(password, root, exited_pid(), leaves);
+    journal_leaves(password, root, getpid(),
+                   vector_string(1, live_orphan.basename()));
+  }
+  Root root(password, "");
+  if (orphan.exists() || !live_orphan.exists()) {
+    cout << "Recovery removed the wrong orphans." << endl;
+    error_count++;
+  }
+  if (root.end() == root.find(used) || !File(used, dir_name).exists()) {
+    cout << "Recovery removed a leaf in use." << endl;
+    error_count++;
+  }
+  if (RootLog(root.basename() + ".journal", dir_name).records().size() != 1) {
+    cout << "Recovery did not keep the running process's record." << endl;
+    error_count++;
+  }
+  live_orphan.rm();
+  RootLog(root.basename() + ".journal", dir_name).rm();
+
+  // A record cut short by a crash must not hide those after it.
+  RootLog(root.basename() + ".journal", dir_name)
+      .append(string("\x40\x00\x00\x00torn", 8));
+  root.add_leaf("after the tear", string(100, 'p'));
+  {
+    Root reloaded(password, "");
+    if (RootLog(root.basename() + ".journal", dir_name).exists()) {
+      cout << "Torn root journal not removed." << endl;
+      error_count++;
+    }
+  }
+  return error_count;
+}
+
 /*
   Add random data to the root.
   Confirm that the ordering is correct (based on key).
@@ -274,6 +669,8 @@ int test_ordering() {
       cout << "Root order test failed after persist." << endl;
       return 1;
     }
+    if (count_key_index_errors(root))
+      return 1;
     time_t end_time = time(0);
     assert(end_time > 0);
     cout << "  ...done in " << end_time - start_time << " seconds." << endl;
@@ -331,8 +728,281 @@ int test_root_change_password() {
   }
   return error_count;
 }
+
+/*
+  Return the number of messages in text that we can't find in root
+  by payload.
+*/
+int count_missing_payloads(Root &root, const vector_string &messages) {
+  int missing = 0;
+  for (vector_string::const_iterator it = messages.begin();
+       it != messages.end(); it++) {
+    vector_string payloads_to_find;
+    payloads_to_find.push_back(*it);
+    LeafProxyMap results =
+        root.filter_payloads(payloads_to_find, true, IdentStringMatcher());
+    if (0 == results.size())
+      missing++;
+  }
+  return missing;
+}
+
+/*
+  Make a root with one file per leaf, convert it to a pack, and
+  confirm that we get the same data back, both before and after
+  re-instantiating the root.  Then modify the packed root, compact
+  it, and check again.
+*/
+int test_root_pack() {
+  cout << "test_root_pack()" << endl;
+  int error_count = 0;
+  vector_string messages = test_text();
+  string password = pseudo_random_string(20);
+  vector_string leaf_paths;
+  {
+    Root root(password, "", true);
+    for (vector_string::iterator it = messages.begin(); it != messages.end();
+         it++) {
+      ostringstream ss;
+      ss << it->size();
+      root.add_leaf(ss.str(), *it, false);
+    }
+    root.commit();
+    for (Root::iterator it = root.begin(); it != root.end(); ++it)
+      leaf_paths.push_back(root.dirname() + "/" + it->first);
+    root.repack();
+    error_count += count_missing_payloads(root, messages);
+  }
+  for (vector_string::iterator it = leaf_paths.begin(); it != leaf_paths.end();
+       ++it)
+    if (file_exists(*it)) {
+      cout << "Leaf file remains after packing:  " << *it << endl;
+      error_count++;
+    }
+
+  cout << "Re-instantiating packed root." << endl;
+  {
+    Root root(password, "");
+    error_count += count_missing_payloads(root, messages);
+    string proxy_key = root.begin()->first;
+    root.set_leaf(proxy_key, "changed", "a changed payload");
+    root.rm_leaf((++root.begin())->first);
+    root.add_leaf("added", "an added payload");
+    root.repack();
+  }
+  {
+    Root root(password, "");
+    // One leaf removed, one added.
+    if (root.size() != messages.size()) {
+      cout << "Packed root has " << root.size() << " leaves, expected "
+           << messages.size() << endl;
+      error_count++;
+    }
+    vector_string expected;
+    expected.push_back("a changed payload");
+    expected.push_back("an added payload");
+    error_count += count_missing_payloads(root, expected);
+  }
+  return error_count;
+}
+
+/*
+  Return the number of leaves that are inline when they shouldn't be,
+  or not when they should, or whose files don't agree.
+*/
+int count_misplaced_leaves(Root &root, const uint32_t max_size) {
+  int misplaced = 0;
+  for (Root::iterator it = root.begin(); it != root.end(); ++it) {
+    const bool small = max_size > 0 && it->second.payload().size() <= max_size;
+    const bool has_file = file_exists(root.dirname() + "/" + it->first);
+    if (it->second.is_inline() != small || has_file == small) {
+      cout << "Leaf of " << it->second.payload().size() << " bytes is "
+           << (it->second.is_inline() ? "" : "not ") << "inline with"
+           << (has_file ? "" : "out") << " a file." << endl;
+      misplaced++;
+    }
+  }
+  return misplaced;
+}
+
+/*
+  Move small leaves into the root and confirm that we get the same
+  data back, that they have no files, and that leaves move in and out
+  as they change size.  Then move everything back out.
+*/
+int test_root_inline() {
+  cout << "test_root_inline()" << endl;
+  int error_count = 0;
+  vector_string messages = test_text();
+  string password = pseudo_random_string(20);
+  const uint32_t max_size = 100;
+  {
+    Root root(password, "", true);
+    for (vector_string::iterator it = messages.begin(); it != messages.end();
+         it++) {
+      ostringstream ss;
+      ss << it->size();
+      root.add_leaf(ss.str(), *it, false);
+    }
+    root.commit();
+    root.inline_leaves(max_size);
+    error_count += count_missing_payloads(root, messages);
+    error_count += count_misplaced_leaves(root, max_size);
+  }
+
+  cout << "Re-instantiating inlined root." << endl;
+  string grown, shrunk;
+  {
+    Root root(password, "");
+    if (root.inline_max_size() != max_size) {
+      cout << "Root forgot to inline." << endl;
+      error_count++;
+    }
+    error_count += count_missing_payloads(root, messages);
+    error_count += count_misplaced_leaves(root, max_size);
+    for (Root::iterator it = root.begin(); it != root.end(); ++it)
+      if (it->second.is_inline())
+        grown = it->first;
+      else
+        shrunk = it->first;
+    root.set_leaf(grown, "grown", string(max_size + 1, 'g'));
+    root.set_leaf(shrunk, "shrunk", "a shrunken payload");
+    root.add_leaf("added", "an added payload");
+    error_count += count_misplaced_leaves(root, max_size);
+  }
+  {
+    Root root(password, "");
+    vector_string expected;
+    expected.push_back(string(max_size + 1, 'g'));
+    expected.push_back("a shrunken payload");
+    expected.push_back("an added payload");
+    error_count += count_missing_payloads(root, expected);
+    error_count += count_misplaced_leaves(root, max_size);
+    if (root.size() != messages.size() + 1) {
+      cout << "Inlined root has " << root.size() << " leaves, expected "
+           << messages.size() + 1 << endl;
+      error_count++;
+    }
+    root.rm_leaf(shrunk);
+    root.inline_leaves(0);
+    error_count += count_misplaced_leaves(root, 0);
+  }
+  {
+    Root root(password, "");
+    error_count += count_misplaced_leaves(root, 0);
+    if (root.size() != messages.size()) {
+      cout << "Root has " << root.size() << " leaves, expected "
+           << messages.size() << endl;
+      error_count++;
+    }
+  }
+  return error_count;
+}
+}
+/*
+  Confirm that an indexed search finds exactly the leaves that a
+  search of every payload would.  Return the number of mismatches.
+*/
+int check_index_search(Root &root, const vector_string &patterns,
+                       const bool disjunction, const StringMatcher &matcher) {
+  set<string> expected;
+  for (Root::iterator it = root.begin(); it != root.end(); ++it) {
+    string payload = it->second.payload();
+    int hits = count_if(patterns.begin(), patterns.end(),
+                        [&](const string &pattern) {
+                          return matcher.contains(payload, pattern);
+                        });
+    if ((disjunction && hits > 0) ||
+        (!disjunction && hits == static_cast<int>(patterns.size())))
+      expected.insert(it->first);
+  }
+  LeafProxyMap found = root.filter_payloads(patterns, disjunction, matcher);
+  LeafProxyMap found_or =
+      root.filter_keys_or_payloads(patterns, false, matcher);
+  int error_count = 0;
+  set<string> got;
+  for (LeafProxyMap::iterator it = found.begin(); it != found.end(); ++it)
+    got.insert(it->first);
+  if (got != expected) {
+    cout << "Indexed search for " << patterns[0] << "... found " << got.size()
+         << " leaves, expected " << expected.size() << endl;
+    error_count++;
+  }
+  if (disjunction)
+    for (set<string>::iterator it = expected.begin(); it != expected.end();
+         ++it)
+      if (found_or.end() == found_or.find(*it)) {
+        cout << "Indexed key or payload search missed " << *it << endl;
+        error_count++;
+      }
+  return error_count;
 }
 
+int check_index_searches(Root &root) {
+  vector<vector_string> queries;
+  queries.push_back(vector_string(1, "the"));
+  queries.push_back(vector_string(1, "The"));
+  queries.push_back(vector_string(1, "forest"));
+  queries.push_back(vector_string(1, "th"));
+  queries.push_back(vector_string(1, "xyzzy"));
+  queries.push_back(vector_string(1, "changed"));
+  vector_string two;
+  two.push_back("the");
+  two.push_back("and");
+  queries.push_back(two);
+  two[1] = "xyzzy";
+  queries.push_back(two);
+  two[1] = "a";
+  queries.push_back(two);
+  int error_count = 0;
+  for (vector<vector_string>::iterator it = queries.begin();
+       it != queries.end(); ++it)
+    for (int disjunction = 0; disjunction < 2; ++disjunction) {
+      error_count +=
+          check_index_search(root, *it, disjunction, IdentStringMatcher());
+      error_count +=
+          check_index_search(root, *it, disjunction, UpperStringMatcher());
+    }
+  return error_count;
+}
+
+/*
+  Index a root and confirm that searches find what they would without
+  the index, after re-instantiating the root and after changing it.
+*/
+int test_root_index() {
+  cout << "test_root_index()" << endl;
+  int error_count = 0;
+  vector_string messages = test_text();
+  string password = pseudo_random_string(20);
+  {
+    Root root(password, "", true);
+    for (vector_string::iterator it = messages.begin(); it != messages.end();
+         it++) {
+      ostringstream ss;
+      ss << it->size();
+      root.add_leaf(ss.str(), *it, false);
+    }
+    root.commit();
+    root.build_index();
+    error_count += check_index_searches(root);
+  }
+  {
+    Root root(password, "");
+    error_count += check_index_searches(root);
+    root.set_leaf(root.begin()->first, "changed", "a changed payload");
+    root.rm_leaf((++root.begin())->first);
+    root.add_leaf("added", "an added payload, the end");
+    error_count += check_index_searches(root);
+  }
+  {
+    Root root(password, "");
+    error_count += check_index_searches(root);
+  }
+  return error_count;
+}
+
+
 int main(int argc, char *argv[]) {
   cout << "Testing root.cpp" << endl;
 
@@ -351,6 +1021,14 @@ int main(int argc, char *argv[]) {
   map<string, string> doubles = case_text();
   err_count += test_root_singles(doubles);
   err_count += test_root_doubles(doubles);
+  err_count += test_root_pack();
+  err_count += test_root_inline();
+  err_count += test_root_index();
+  err_count += test_root_key_index();
+  err_count += test_root_keys_within();
+  err_count += test_root_filters();
+  err_count += test_root_log();
+  err_count += test_root_journal();
 
   if (err_count)
     cout << "Errors (" << err_count << ") in test!!" << endl;
@@ -0,0 +1,277 @@
+/*
+  Copyright 2026  Jeff Abrahamson
+
+  This file is part of srd.
+
+  srd is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  srd is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with srd.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <cctype>
+#include <cstring>
+#include <string>
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define SRD_SEARCH_X86 1
+#include <immintrin.h>
+#endif
+
+#include "srd.h"
+
+using namespace srd;
+using namespace std;
+
+namespace {
+
+/*
+  The folded value of every byte, so that folding is a lookup rather
+  than a call.
+*/
+struct FoldTable {
+  FoldTable() {
+    for (int c = 0; c < 256; ++c)
+      folded[c] = toupper(c);
+  }
+  unsigned char folded[256];
+};
+
+const unsigned char *fold_table() {
+  static const FoldTable table;
+  return table.folded;
+}
+
+/*
+  A search kernel returns the position of pattern (of size m) in text
+  (of size n), or string::npos, ignoring case if fold.  The caller
+  ensures 0 < m <= n.
+*/
+typedef size_t (*Kernel)(const unsigned char *t, const size_t n,
+                         const unsigned char *p, const size_t m,
+                         const bool fold);
+
+bool same(const unsigned char *t, const unsigned char *p, const size_t m,
+          const bool fold) {
+  if (!fold)
+    return 0 == memcmp(t, p, m);
+  const unsigned char *table = fold_table();
+  for (size_t i = 0; i < m; ++i)
+    if (table[t[i]] != table[p[i]])
+      return false;
+  return true;
+}
+
+/*
+  Set forms to the bytes that match c: c itself, or if fold, its upper
+  and lower case (the same byte twice if c has no case).
+*/
+void byte_forms(const unsigned char c, const bool fold,
+                unsigned char forms[2]) {
+  forms[0] = fold ? fold_table()[c] : c;
+  forms[1] = fold ? tolower(forms[0]) : forms[0];
+}
+
+size_t find_scalar(const unsigned char *t, const size_t n,
+                   const unsigned char *p, const size_t m, const bool fold) {
+  const size_t last = n - m;
+  if (!fold) {
+    for (const unsigned char *at = t;
+         (at = static_cast<const unsigned char *>(
+              memchr(at, p[0], last + 1 - (at - t))));
+         ++at)
+      if (same(at, p, m, false))
+        return at - t;
+    return string::npos;
+  }
+  unsigned char first[2];
+  byte_forms(p[0], fold, first);
+  for (size_t i = 0; i <= last; ++i)
+    if ((t[i] == first[0] || t[i] == first[1]) && same(t + i, p, m, fold))
+      return i;
+  return string::npos;
+}
+
+#ifdef SRD_SEARCH_X86
+/*
+  The vector kernels compare a block of text against the pattern's
+  first byte, and the block m - 1 bytes on against its last byte.
+  Only where both match do we compare the whole pattern.  What's left
+  after the last whole block goes to the scalar kernel.
+*/
+size_t find_tail(const unsigned char *t, const size_t n,
+                 const unsigned char *p, const size_t m, const bool fold,
+                 const size_t i) {
+  if (n - i < m)
+    return string::npos;
+  const size_t at = find_scalar(t + i, n - i, p, m, fold);
+  return string::npos == at ? at : i + at;
+}
+
+size_t find_sse2(const unsigned char *t, const size_t n,
+                 const unsigned char *p, const size_t m, const bool fold) {
+  unsigned char first[2], last[2];
+  byte_forms(p[0], fold, first);
+  byte_forms(p[m - 1], fold, last);
+  const __m128i first_0 = _mm_set1_epi8(first[0]);
+  const __m128i first_1 = _mm_set1_epi8(first[1]);
+  const __m128i last_0 = _mm_set1_epi8(last[0]);
+  const __m128i last_1 = _mm_set1_epi8(last[1]);
+  size_t i = 0;
+  for (; i + m - 1 + 16 <= n; i += 16) {
+    const __m128i a = _mm_loadu_si128((const __m128i *)(t + i));
+    const __m128i b = _mm_loadu_si128((const __m128i *)(t + i + m - 1));
+    const __m128i eq = _mm_and_si128(
+        _mm_or_si128(_mm_cmpeq_epi8(a, first_0), _mm_cmpeq_epi8(a, first_1)),
+        _mm_or_si128(_mm_cmpeq_epi8(b, last_0), _mm_cmpeq_epi8(b, last_1)));
+    for (unsigned mask = _mm_movemask_epi8(eq); mask; mask &= mask - 1) {
+      const size_t at = i + __builtin_ctz(mask);
+      if (same(t + at, p, m, fold))
+        return at;
+    }
+  }
+  return find_tail(t, n, p, m, fold, i);
+}
+
+__attribute__((target("avx2"))) size_t
+find_avx2(const unsigned char *t, const size_t n, const unsigned char *p,
+          const size_t m, const bool fold) {
+  unsigned char first[2], last[2];
+  byte_forms(p[0], fold, first);
+  byte_forms(p[m - 1], fold, last);
+  const __m256i first_0 = _mm256_set1_epi8(first[0]);
+  const __m256i first_1 = _mm256_set1_epi8(first[1]);
+  const __m256i last_0 = _mm256_set1_epi8(last[0]);
+  const __m256i last_1 = _mm256_set1_epi8(last[1]);
+  size_t i = 0;
+  for (; i + m - 1 + 32 <= n; i += 32) {
+    const __m256i a = _mm256_loadu_si256((const __m256i *)(t + i));
+    const __m256i b = _mm256_loadu_si256((const __m256i *)(t + i + m - 1));
+    const __m256i eq = _mm256_and_si256(
+        _mm256_or_si256(_mm256_cmpeq_epi8(a, first_0),
+                        _mm256_cmpeq_epi8(a, first_1)),
+        _mm256_or_si256(_mm256_cmpeq_epi8(b, last_0),
+                        _mm256_cmpeq_epi8(b, last_1)));
+    for (unsigned mask = _mm256_movemask_epi8(eq); mask; mask &= mask - 1) {
+      const size_t at = i + __builtin_ctz(mask);
+      if (same(t + at, p, m, fold))
+        return at;
+    }
+  }
+  return find_tail(t, n, p, m, fold, i);
+}
+#endif
+
+SearchKernel best_kernel() {
+#ifdef SRD_SEARCH_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    return SearchAvx2;
+  return SearchSse2;
+#else
+  return SearchScalar;
+#endif
+}
+
+SearchKernel &current_kernel() {
+  static SearchKernel kernel = best_kernel();
+  return kernel;
+}
+
+Kernel kernel(const SearchKernel which) {
+  switch (which) {
+#ifdef SRD_SEARCH_X86
+  case SearchAvx2:
+    return find_avx2;
+  case SearchSse2:
+    return find_sse2;
+#endif
+  default:
+    return find_scalar;
+  }
+}
+
+size_t search(const string &text, const string &pattern, const size_t from,
+              const bool fold) {
+  if (from > text.size())
+    return string::npos;
+  if (pattern.empty())
+    return from;
+  if (pattern.size() > text.size() - from)
+    return string::npos;
+  const size_t at =
+      kernel(current_kernel())(
+          reinterpret_cast<const unsigned char *>(text.data()) + from,
+          text.size() - from,
+          reinterpret_cast<const unsigned char *>(pattern.data()),
+          pattern.size(), fold);
+  return string::npos == at ? at : from + at;
+}
+}
+
+unsigned char srd::fold_case(const unsigned char c) { return fold_table()[c]; }
+
+string srd::fold_case(const string &text) {
+  const unsigned char *fold = fold_table();
+  string folded(text);
+  for (string::iterator it = folded.begin(); it != folded.end(); ++it)
+    *it = fold[static_cast<unsigned char>(*it)];
+  return folded;
+}
+
+bool srd::equal_folded(const string &a, const string &b) {
+  if (a.size() != b.size())
+    return false;
+  const unsigned char *fold = fold_table();
+  for (size_t i = 0; i < a.size(); ++i)
+    if (fold[static_cast<unsigned char>(a[i])] !=
+        fold[static_cast<unsigned char>(b[i])])
+      return false;
+  return true;
+}
+
+/*
+  Say whether this machine can run kernel.
+*/
+bool srd::search_kernel_supported(const SearchKernel kernel) {
+  return kernel <= best_kernel();
+}
+
+SearchKernel srd::search_kernel() { return current_kernel(); }
+
+/*
+  Search with kernel from now on, if this machine can.  We choose the
+  best kernel ourselves, so this is for tests and benchmarks.
+*/
+bool srd::search_kernel(const SearchKernel kernel) {
+  if (!search_kernel_supported(kernel))
+    return false;
+  current_kernel() = kernel;
+  return true;
+}
+
+/*
+  Return the position of the first occurrence of pattern in text at
+  or after from, or string::npos if there is none, as
+  std::string::find() does.
+*/
+size_t srd::find_substring(const string &text, const string &pattern,
+                           const size_t from) {
+  return search(text, pattern, from, false);
+}
+
+/*
+  As find_substring(), but ignoring case.
+*/
+size_t srd::find_folded(const string &text, const string &pattern,
+                        const size_t from) {
+  return search(text, pattern, from, true);
+}
@@ -0,0 +1,164 @@
+/*
+  Copyright 2026  Jeff Abrahamson
+
+  This file is part of srd.
+
+  srd is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  srd is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with srd.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <iostream>
+#include <string>
+
+#include "srd.h"
+#include "test_text.h"
+
+using namespace srd;
+using namespace std;
+
+namespace {
+
+/*
+  Confirm that our searches find what std::string::find() finds, in
+  the folded text and pattern when ignoring case.
+*/
+int check_find(const string &text, const string &pattern,
+               const size_t from = 0) {
+  int ret = 0;
+  size_t expected = fold_case(text).find(fold_case(pattern), from);
+  size_t got = find_folded(text, pattern, from);
+  if (got != expected) {
+    cout << "Found \"" << pattern << "\" at " << got << ", expected "
+         << expected << ", ignoring case." << endl;
+    ret++;
+  }
+  expected = text.find(pattern, from);
+  got = find_substring(text, pattern, from);
+  if (got != expected) {
+    cout << "Found \"" << pattern << "\" at " << got << ", expected "
+         << expected << "." << endl;
+    ret++;
+  }
+  return ret;
+}
+
+int test_fold() {
+  int ret = 0;
+  if (fold_case("Hello, World 42!") != "HELLO, WORLD 42!") {
+    cout << "Folding failed." << endl;
+    ret++;
+  }
+  if (!equal_folded("forest", "FoReSt") || equal_folded("forest", "forests") ||
+      equal_folded("forest", "fovest")) {
+    cout << "Comparing without case failed." << endl;
+    ret++;
+  }
+  return ret;
+}
+
+int test_find() {
+  int ret = 0;
+  ret += check_find("", "");
+  ret += check_find("abc", "");
+  ret += check_find("", "abc");
+  ret += check_find("ab", "abc");
+  ret += check_find("aaab", "AAB");
+  ret += check_find("The Forest", "forest");
+  ret += check_find("The Forest", "forests");
+  ret += check_find("ushers", "HERS");
+
+  vector_string messages = test_text();
+  for (size_t i = 0; i < messages.size(); ++i) {
+    const string &message = messages[i];
+    if (message.size() > 10) {
+      ret += check_find(message, message.substr(message.size() / 2, 5));
+      ret += check_find(message, fold_case(message.substr(message.size() - 4)));
+    }
+    ret += check_find(message, pseudo_random_string(3));
+  }
+  return ret;
+}
+
+/*
+  Patterns at every offset of texts long enough to span several
+  vector blocks, so that matches fall in blocks, across them, and in
+  the tail.
+*/
+int test_blocks() {
+  int ret = 0;
+  const string filler(100, 'a');
+  for (size_t size = 1; size < 40; size += 3) {
+    string pattern = string(size - 1, 'a') + "Zb";
+    for (size_t at = 0; at < filler.size(); at += 7) {
+      string text = filler;
+      text.insert(at, pattern);
+      ret += check_find(text, pattern);
+      ret += check_find(text, fold_case(pattern));
+      ret += check_find(text, pattern, at);
+      ret += check_find(text, pattern, at + 1);
+      ret += check_find(text.substr(0, text.size() - 1), pattern);
+    }
+  }
+  return ret;
+}
+
+/*
+  Every kernel this machine can run finds the same thing.
+*/
+int test_kernels() {
+  int ret = 0;
+  const SearchKernel best = search_kernel();
+  const SearchKernel kernels[] = {SearchScalar, SearchSse2, SearchAvx2};
+  for (size_t i = 0; i < sizeof(kernels) / sizeof(kernels[0]); ++i) {
+    if (!search_kernel(kernels[i]))
+      continue;
+    ret += test_find();
+    ret += test_blocks();
+  }
+  if (!search_kernel_supported(SearchScalar) || !search_kernel(best)) {
+    cout << "Couldn't restore search kernel." << endl;
+    ret++;
+  }
+  return ret;
+}
+
+/*
+  Confirm that the matcher agrees with folding both sides.
+*/
+int test_matcher() {
+  int ret = 0;
+  UpperStringMatcher matcher;
+  if (!matcher("Key", "kEY") || matcher("Key", "Keys") ||
+      !matcher.contains("The Forest", "FOREST") ||
+      matcher.contains("The Forest", "ocean")) {
+    cout << "UpperStringMatcher failed." << endl;
+    ret++;
+  }
+  return ret;
+}
+}
+
+int main(int argc, char *argv[]) {
+  cout << "Testing search.cpp" << endl;
+
+  int err_count = 0;
+  err_count += test_fold();
+  err_count += test_kernels();
+  err_count += test_matcher();
+
+  if (err_count)
+    cout << "Errors (" << err_count << ") in test!!" << endl;
+  else
+    cout << "All tests passed!" << endl;
+  return 0 != err_count;
+}
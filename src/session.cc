@@ -0,0 +1,217 @@
+/*
+  Copyright 2026  Jeff Abrahamson
+
+  This file is part of srd.
+
+  srd is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  srd is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with srd.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <ctype.h>
+#include <errno.h>
+#include <iostream>
+#include <signal.h>
+#include <sstream>
+#include <stdexcept>
+#include <string.h>
+#include <string>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "srd.h"
+
+using namespace srd;
+using namespace std;
+
+vector_string srd::split_command_line(const string &line) {
+  vector_string words;
+  string word;
+  bool in_word = false;
+  char quote = 0;
+  for (size_t i = 0; i < line.size(); ++i) {
+    char c = line[i];
+    if ('\'' == quote) {
+      if ('\'' == c)
+        quote = 0;
+      else
+        word += c;
+    } else if ('"' == quote) {
+      if ('"' == c)
+        quote = 0;
+      else if ('\\' == c && i + 1 < line.size() &&
+               ('"' == line[i + 1] || '\\' == line[i + 1]))
+        word += line[++i];
+      else
+        word += c;
+    } else if ('\'' == c || '"' == c) {
+      quote = c;
+      in_word = true; // So that "" is an (empty) word.
+    } else if ('\\' == c && i + 1 < line.size()) {
+      word += line[++i];
+      in_word = true;
+    } else if (isspace(static_cast<unsigned char>(c))) {
+      if (in_word)
+        words.push_back(word);
+      word.clear();
+      in_word = false;
+    } else {
+      word += c;
+      in_word = true;
+    }
+  }
+  if (quote)
+    throw(runtime_error("Unbalanced quote in command."));
+  if (in_word)
+    words.push_back(word);
+  return words;
+}
+
+namespace {
+
+volatile sig_atomic_t stop_requested = 0;
+
+void request_stop(int) { stop_requested = 1; }
+
+/*
+  Read one line (without its newline) or until the client closes.
+  Requests are command lines, so a modest limit is plenty.
+*/
+string read_request(const int fd) {
+  const size_t max_request = 64 * 1024;
+  string request;
+  char buf[1024];
+  while (request.size() < max_request) {
+    ssize_t ret = read(fd, buf, sizeof(buf));
+    if (-1 == ret && EINTR == errno && !stop_requested)
+      continue;
+    if (ret <= 0)
+      break;
+    request.append(buf, ret);
+    size_t pos = request.find('\n');
+    if (string::npos != pos) {
+      request.resize(pos);
+      break;
+    }
+  }
+  return request;
+}
+
+void write_response(const int fd, const string &response) {
+  size_t done = 0;
+  while (done < response.size()) {
+    // MSG_NOSIGNAL so that a client that hangs up early doesn't
+    // kill us with SIGPIPE.
+    ssize_t ret = send(fd, response.data() + done, response.size() - done,
+                       MSG_NOSIGNAL);
+    if (-1 == ret && EINTR == errno)
+      continue;
+    if (-1 == ret) {
+      if (mode(Verbose))
+        cerr << "Failed to write response:  " << strerror(errno) << endl;
+      return;
+    }
+    done += ret;
+  }
+}
+
+/*
+  Return true if the peer on fd runs as our user.  Anyone who may
+  connect may read the database, so the socket's permissions aren't
+  the only guard.
+*/
+bool peer_is_us(const int fd) {
+#ifdef SO_PEERCRED
+  struct ucred cred;
+  socklen_t len = sizeof(cred);
+  if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len))
+    return false;
+  return cred.uid == getuid();
+#else
+  return true; // The socket is mode 0600.
+#endif
+}
+}
+
+void srd::serve_unix_socket(
+    const string &path,
+    const function<bool(const string &request, string &response)> &handler) {
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(addr.sun_path))
+    throw(runtime_error("Socket path \"" + path + "\" is too long."));
+  strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+
+  int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (-1 == listen_fd)
+    throw(runtime_error(string("Failed to create socket:  ") +
+                        strerror(errno)));
+  // Create the socket readable and writeable only by us.
+  mode_t old_mask = umask(0177);
+  int ret = bind(listen_fd, reinterpret_cast<struct sockaddr *>(&addr),
+                 sizeof(addr));
+  int error = errno;
+  umask(old_mask);
+  if (ret || listen(listen_fd, 8)) {
+    if (!ret)
+      error = errno;
+    close(listen_fd);
+    ostringstream oss;
+    oss << "Failed to listen on \"" << path << "\":  " << strerror(error);
+    throw(runtime_error(oss.str()));
+  }
+
+  // No SA_RESTART, so that a signal interrupts accept().
+  struct sigaction action, old_int, old_term;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = request_stop;
+  sigemptyset(&action.sa_mask);
+  stop_requested = 0;
+  sigaction(SIGINT, &action, &old_int);
+  sigaction(SIGTERM, &action, &old_term);
+
+  bool more = true;
+  try {
+    while (more && !stop_requested) {
+      int fd = accept(listen_fd, NULL, NULL);
+      if (-1 == fd) {
+        if (EINTR == errno)
+          continue;
+        throw(runtime_error(string("Failed to accept connection:  ") +
+                            strerror(errno)));
+      }
+      if (!peer_is_us(fd)) {
+        cerr << "Refusing connection from another user." << endl;
+        close(fd);
+        continue;
+      }
+      string response;
+      more = handler(read_request(fd), response);
+      write_response(fd, response);
+      close(fd);
+    }
+  } catch (...) {
+    sigaction(SIGINT, &old_int, NULL);
+    sigaction(SIGTERM, &old_term, NULL);
+    close(listen_fd);
+    unlink(path.c_str());
+    throw;
+  }
+  sigaction(SIGINT, &old_int, NULL);
+  sigaction(SIGTERM, &old_term, NULL);
+  close(listen_fd);
+  unlink(path.c_str());
+}
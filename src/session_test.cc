@@ -0,0 +1,167 @@
+/*
+  Copyright 2026  Jeff Abrahamson
+
+  This file is part of srd.
+
+  srd is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  srd is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with srd.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string.h>
+#include <string>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+
+#include "srd.h"
+
+using namespace srd;
+using namespace std;
+
+namespace {
+
+/*
+  Confirm that line splits into the words in expected, which are
+  separated by '|'.
+*/
+int test_split(const string &line, const string &expected) {
+  vector_string words = split_command_line(line);
+  string joined;
+  for (vector_string::const_iterator it = words.begin(); it != words.end();
+       ++it) {
+    if (it != words.begin())
+      joined += "|";
+    joined += *it;
+  }
+  if (joined != expected) {
+    cout << "Split [" << line << "] as [" << joined << "], expected ["
+         << expected << "]" << endl;
+    return 1;
+  }
+  return 0;
+}
+
+int test_split_command_line() {
+  int ret = 0;
+  ret += test_split("", "");
+  ret += test_split("   ", "");
+  ret += test_split("-m dog", "-m|dog");
+  ret += test_split("  -m   dog  -f ", "-m|dog|-f");
+  ret += test_split("-m ''", "-m|");
+  ret += test_split("-m \"\" -f", "-m||-f");
+  ret += test_split("-d 'two words'", "-d|two words");
+  ret += test_split("-d \"say \\\"hi\\\"\"", "-d|say \"hi\"");
+  ret += test_split("-d it\\'s", "-d|it's");
+  ret += test_split("-d a'b c'd", "-d|ab cd");
+  try {
+    split_command_line("-d 'oops");
+    cout << "Unbalanced quote did not throw." << endl;
+    ret++;
+  } catch (const runtime_error &e) {
+    // As expected.
+  }
+  return ret;
+}
+
+/*
+  Send request to the socket at path and return the response.
+*/
+string ask(const string &path, const string &request) {
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+  // The server may not be listening yet.
+  for (int tries = 0;
+       connect(fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr));
+       ++tries) {
+    if (tries > 100) {
+      close(fd);
+      return "(failed to connect)";
+    }
+    usleep(10000);
+  }
+  string line = request + "\n";
+  if (write(fd, line.data(), line.size()) != static_cast<ssize_t>(line.size()))
+    cout << "Short write to socket." << endl;
+  string response;
+  char buf[256];
+  ssize_t len;
+  while ((len = read(fd, buf, sizeof(buf))) > 0)
+    response.append(buf, len);
+  close(fd);
+  return response;
+}
+
+/*
+  Serve a socket that echoes requests, ask it a few questions, and
+  confirm that it cleans up after itself when told to stop.
+*/
+int test_serve_unix_socket() {
+  int ret = 0;
+  ostringstream oss;
+  oss << "/tmp/srd-session-test-" << getpid();
+  string path = oss.str();
+  int requests = 0;
+  thread server([&]() {
+    serve_unix_socket(path, [&](const string &request, string &response) {
+      requests++;
+      response = "echo:" + request;
+      return "quit" != request;
+    });
+  });
+  if (ask(path, "hello") != "echo:hello") {
+    cout << "Failed to echo hello." << endl;
+    ret++;
+  }
+  if (ask(path, "-m 'two words'") != "echo:-m 'two words'") {
+    cout << "Failed to echo request with quotes." << endl;
+    ret++;
+  }
+  ask(path, "quit");
+  server.join();
+  if (3 != requests) {
+    cout << "Expected 3 requests, got " << requests << endl;
+    ret++;
+  }
+  if (file_exists(path)) {
+    cout << "Socket not removed." << endl;
+    ret++;
+  }
+  return ret;
+}
+}
+
+int main(int argc, char *argv[]) {
+  cout << "Testing session.cpp" << endl;
+
+  mode(Verbose, false);
+  mode(Testing, true);
+  mode(ReadOnly, false);
+
+  int err_count = 0;
+  err_count += test_split_command_line();
+  err_count += test_serve_unix_socket();
+
+  if (err_count)
+    cout << "Errors (" << err_count << ") in test!!" << endl;
+  else
+    cout << "All tests passed!" << endl;
+  return 0 != err_count;
+}
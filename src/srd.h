@@ -22,12 +22,19 @@
 
 #include <algorithm>
 #include <assert.h>
-#include <boost/algorithm/string/case_conv.hpp>
 #include <boost/interprocess/sync/file_lock.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/shared_ptr.hpp>
+#include <functional>
 #include <iostream>
+#include <list>
 #include <map>
+#include <mutex>
 #include <set>
+#include <stdint.h>
+#include <sys/types.h>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include "leaf.pb.h"
@@ -38,7 +45,23 @@ namespace srd {
 /* ************************************************************ */
 /* Compression */
 
+/*
+  Bzip2 is always available.  The others depend on how we were built
+  (cf. WITH_ZSTD and WITH_LZ4 in the Makefile).  Values are the tags
+  that begin compressed data, so don't change them.
+*/
+enum Codec { Bzip2 = 1, Zstd = 2, Lz4 = 3 };
+
+bool codec_available(const Codec codec);
+Codec codec_named(const std::string &name);
+// Choose how compress() compresses.  A level of 0 means the codec's default.
+void compression(const Codec codec, const int level = 0);
+Codec compression_codec();
+int compression_level();
+
 std::string compress(const std::string &);
+std::string compress(const std::string &, const Codec codec,
+                     const int level = 0);
 std::string decompress(const std::string &, unsigned int = 0);
 
 /* ************************************************************ */
@@ -48,6 +71,9 @@ std::string decompress(const std::string &, unsigned int = 0);
 std::string message_digest(const std::string &message,
                            const bool filesystem_safe = false);
 
+// Return the password for what the user types.
+std::string password_from_pass_phrase(const std::string &pass_phrase);
+
 // Return a (not necessarily human readable) string of random bits.
 std::string pseudo_random_string(int length);
 
@@ -56,12 +82,44 @@ std::string pseudo_random_string(int length);
 // and http://www.cryptopp.com/wiki/FAQ
 
 /*
-  This is a simple mixin class that provides encryption and decryption.
+  Encrypt and decrypt with keys derived once from a password.  A
+  database does a lot of both, and key setup is a noticeable part of
+  it.  Safe to share between threads.
+*/
+class CipherContext {
+public:
+  explicit CipherContext(const std::string &password);
+  ~CipherContext();
+
+  std::string encrypt(const std::string &plain_message) const;
+  // Set legacy if cipher_message predates authenticated encryption.
+  std::string decrypt(const char *cipher_message, const size_t length,
+                      bool &legacy) const;
+
+private:
+  CipherContext(const CipherContext &);
+  CipherContext &operator=(const CipherContext &);
+  bool gcm_decrypt(const char *cipher_message, const size_t length,
+                   std::string &plain_message) const;
+  std::string legacy_decrypt(const char *cipher_message,
+                             const size_t length) const;
+
+  struct Keys;
+  boost::scoped_ptr<Keys> m_keys;
+};
+
+/*
+  As CipherContext, for a single use.
 */
 std::string encrypt(const std::string &plain_message,
                     const std::string &password);
 std::string decrypt(const std::string &cipher_message,
                     const std::string &password);
+std::string decrypt(const char *cipher_message, const size_t length,
+                    const std::string &password);
+// Set legacy if cipher_message predates authenticated encryption.
+std::string decrypt(const char *cipher_message, const size_t length,
+                    const std::string &password, bool &legacy);
 
 /* ************************************************************ */
 /* mode */
@@ -79,11 +137,89 @@ enum Mode {
   Verbose,
   Testing,
   ReadOnly,
+  AllowLegacy, // Read what fails to authenticate as the older format.
 };
 
 void mode(const Mode m, const bool new_state);
 const bool mode(const Mode m);
 
+/* ************************************************************ */
+/* Workers */
+
+/*
+  How many threads may share work that can be done in parallel,
+  notably loading and matching leaves.  Zero means one per processor.
+  The default is one, which means no threads at all.
+*/
+void worker_count(const unsigned int count);
+unsigned int worker_count();
+
+/*
+  Call fn(0), ..., fn(n - 1), spread over up to worker_count()
+  threads, and return when all calls have returned.  The calls may
+  happen in any order.  If any throw, we rethrow the first exception
+  once all threads are done.
+*/
+void parallel_for(const size_t n, const std::function<void(size_t)> &fn);
+
+/* ************************************************************ */
+/* Stats */
+
+/*
+  Where a query's time goes, for srd --stats.  Stages are timed (their
+  calls, bytes and nanoseconds are summed over threads, so a parallel
+  stage can take longer than the query did), counters only count.
+  Stages nest:  filtering includes the loading it causes.
+
+  Until stats(true), timing and counting cost a test of a flag.
+*/
+enum Stage {
+  StageStat,
+  StageRead,
+  StageDecrypt,
+  StageDecompress,
+  StageParse,
+  StageFilter,
+  StageCount
+};
+
+enum Counter {
+  CountLeavesInMap, // Set, not counted, when the root loads.
+  CountKeysExamined,
+  CountPayloadsExamined,
+  CountPayloadsFiltered, // Ruled out without loading.
+  CountLeavesLoaded, // Read and decrypted.
+  CountCacheHits,
+  CounterCount
+};
+
+void stats(const bool on);
+bool stats();
+void stats_count(const Counter counter, const uint64_t n = 1);
+void stats_set(const Counter counter, const uint64_t n);
+uint64_t stats_counter(const Counter counter);
+uint64_t stats_calls(const Stage stage);
+void stats_clear();
+void print_stats(std::ostream &out);
+
+/*
+  Time a stage from construction to destruction.
+*/
+class StageTimer {
+public:
+  StageTimer(const Stage stage);
+  ~StageTimer();
+  void bytes(const uint64_t n) { m_bytes = n; }
+
+private:
+  StageTimer(const StageTimer &);
+  StageTimer &operator=(const StageTimer &);
+
+  const Stage m_stage;
+  uint64_t m_bytes;
+  uint64_t m_start; // Nanoseconds, or zero if stats are off.
+};
+
 /* ************************************************************ */
 /* types */
 
@@ -96,6 +232,39 @@ typedef std::pair<time_t, unsigned long int>
 
 void set_base_dir(const std::string &in_dir);
 
+/*
+  A read-only view of a file's bytes.
+
+  Regular files are mapped rather than read, so that looking at the
+  bytes (to decrypt them, say) costs no copy.  Anything else (a pipe,
+  a device) is read into a buffer we own.  A view may also be a slice
+  of another view, in which case it keeps the other alive.
+
+  We never modify files in place (cf. File::file_contents_sub() and
+  Pack::append()), so the bytes under a mapping don't change.
+*/
+class FileView {
+public:
+  FileView(const std::string &filename);
+  FileView(boost::shared_ptr<FileView> whole, const size_t offset,
+           const size_t length);
+  ~FileView();
+
+  const char *data() const { return m_data; }
+  size_t size() const { return m_size; }
+
+private:
+  FileView(const FileView &);
+  FileView &operator=(const FileView &);
+
+  const char *m_data;
+  size_t m_size;
+
+  void *m_map;                      // If we mapped the file.
+  std::string m_buffer;             // If we couldn't.
+  boost::shared_ptr<FileView> m_whole; // If we are a slice.
+};
+
 /*
   A simple mix-in class to handle reading and writing (binary) files,
   as well as testing for existence and removing them.
@@ -124,9 +293,11 @@ public:
 
   void file_contents(std::string &data, bool lock = true);
   std::string file_contents();
+  boost::shared_ptr<FileView> file_view();
 
-  time_pair modtime(const bool silent = true);
+  time_pair modtime(const bool silent = true, ino_t *inode = NULL);
   bool underlying_is_modified();
+  void touch();
 
   void rm();
   bool exists(); /* Can't be const, because asking for
@@ -139,6 +310,7 @@ protected:
 
 private:
   void file_contents_sub(std::string &data);
+  void note_version();
 
   std::string m_dir_name;
   std::string m_base_name;
@@ -147,9 +319,83 @@ private:
   // If false, we'll check and create if needed.
   bool m_dir_verified;
 
-  // When first we read the file, check it's mod time.
-  // If that changes. we'll know to reread.
+  // When first we read the file, check it's mod time and inode.
+  // If either changes, we'll know to reread.
   time_pair m_modtime;
+  ino_t m_inode;
+};
+
+/* ************************************************************ */
+/* Pack */
+
+/*
+  A single append-only file holding the cipher text of many leaves,
+  so that a large database need not be one file per leaf.
+
+  The pack knows nothing about what it holds.  The root keeps the
+  offset and length of each leaf (cf. PackLocation), and space left
+  behind by modified or deleted leaves is only reclaimed when the
+  root rewrites the whole pack (cf. Root::repack()).
+*/
+class Pack : public File {
+public:
+  Pack(const std::string base_name = std::string(),
+       const std::string dir_name = std::string());
+
+  boost::shared_ptr<FileView> view(const uint64_t offset,
+                                   const uint64_t length);
+  uint64_t append(const std::string &data);
+
+private:
+  // Copying would share m_view, so don't.  Share the pointer instead.
+  Pack(const Pack &);
+  Pack &operator=(const Pack &);
+
+  // The whole pack as of when we last needed it.  Appends never move
+  // existing bytes, so we only remap when asked for bytes past the end.
+  boost::shared_ptr<FileView> m_view;
+  std::mutex m_view_mutex; // Leaves may be loaded in parallel.
+};
+
+/* ************************************************************ */
+/* RootLog */
+
+/*
+  The changes to a root since it was last written in full, appended
+  as they happen, so that changing a leaf needn't rewrite the whole
+  root.  Each record is cipher text the root made, preceded by its
+  size, so that a record cut short by a crash is recognizably
+  incomplete.
+
+  Cf. Root::commit(), which decides when to write the root in full
+  and drop the log instead.  The root's journal is also a RootLog.
+*/
+class RootLog : public Pack {
+public:
+  RootLog(const std::string base_name, const std::string dir_name);
+
+  void append_record(const std::string &record);
+  vector_string records();
+  uint64_t bytes();
+
+private:
+  uint64_t scan(vector_string *out);
+};
+
+/*
+  Where in a pack a leaf's cipher text lives.  If pack is empty, the
+  leaf lives in its own file.  If pack is set but length is zero, the
+  leaf belongs in the pack but hasn't been written yet.
+*/
+struct PackLocation {
+  PackLocation() : offset(0), length(0) {}
+  PackLocation(boost::shared_ptr<Pack> in_pack, const uint64_t in_offset = 0,
+               const uint64_t in_length = 0)
+      : pack(in_pack), offset(in_offset), length(in_length) {}
+
+  boost::shared_ptr<Pack> pack;
+  uint64_t offset;
+  uint64_t length;
 };
 
 /* ************************************************************ */
@@ -161,22 +407,28 @@ private:
   to do so, persist our data (via the inherited file object).
 
   We have a key and a payload.  For purposes of being useful,
-  we keep track of the password.  That's admittedly not a good
-  idea, since a core dump would potentially contain the
-  password multiple times, which would make it easier to find.
-  On the other hand, it's not the human-readable pass phrase
-  at least.
+  we keep the keys derived from the password (shared with the
+  other leaves of our root), though not the password itself.
 */
 class Leaf : public File {
 public:
   Leaf() { assert(0); }; // seemingly needed by serialize()
   Leaf(const std::string &password, const std::string base_name = std::string(),
-       const std::string dir_name = std::string(), const bool do_load = true);
+       const std::string dir_name = std::string(), const bool do_load = true,
+       const PackLocation &location = PackLocation());
+  Leaf(const boost::shared_ptr<CipherContext> &cipher,
+       const std::string base_name = std::string(),
+       const std::string dir_name = std::string(), const bool do_load = true,
+       const PackLocation &location = PackLocation());
   virtual ~Leaf();
 
   void commit();
   void erase();
 
+  std::string cipher_text();
+  boost::shared_ptr<FileView> cipher_view();
+  const PackLocation &location() const { return m_location; }
+
   void key(const std::string &key_in) {
     m_node_key = key_in;
     m_modified = true;
@@ -201,8 +453,11 @@ public:
 
 private:
   void load();
+  bool persisted();
+  time_pair version();
 
-  const std::string m_password;
+  const boost::shared_ptr<CipherContext> m_cipher;
+  PackLocation m_location;
   bool m_modified;
   // m_loaded is true if the leaf has been loaded from its underlying file
   // or if the leaf is new (and perhaps hasn't been persisted yet).
@@ -212,6 +467,97 @@ private:
   std::string m_node_payload;
 };
 
+/* ************************************************************ */
+/* LeafCache */
+
+/*
+  A process-wide cache of decrypted leaf contents, so that looking at
+  the same leaf twice (two filters, or a filter and then printing)
+  doesn't mean decrypting and decompressing it twice.
+
+  Entries are named by the leaf's basename and carry a version, which
+  is anything that changes when the persisted leaf changes:  the
+  file's modification time, or for a packed leaf its offset and length
+  (packed bytes never move).  A lookup with a different version misses.
+
+  We hold at most budget() bytes of keys and payloads, evicting least
+  recently used entries first.  Evicted plain text is overwritten
+  before it is freed.
+*/
+class LeafCache {
+public:
+  LeafCache(const size_t budget = 16 * 1024 * 1024);
+  ~LeafCache();
+
+  void budget(const size_t bytes);
+  size_t budget() const { return m_budget; }
+  size_t size() const { return m_size; }
+
+  bool get(const std::string &name, const time_pair &version,
+           std::string &key, std::string &payload);
+  void put(const std::string &name, const time_pair &version,
+           const std::string &key, const std::string &payload);
+  void erase(const std::string &name);
+  void clear();
+
+private:
+  LeafCache(const LeafCache &);
+  LeafCache &operator=(const LeafCache &);
+
+  struct Entry {
+    std::string name;
+    time_pair version;
+    std::string key;
+    std::string payload;
+  };
+  typedef std::list<Entry> EntryList;
+
+  void evict(EntryList::iterator it);
+  void trim();
+
+  size_t m_budget;
+  size_t m_size;
+  EntryList m_entries; // Most recently used first.
+  std::unordered_map<std::string, EntryList::iterator> m_index;
+  std::mutex m_mutex;
+};
+
+// The cache that leaves use.
+LeafCache &leaf_cache();
+
+/* ************************************************************ */
+/* PayloadFilter */
+
+/*
+  A Bloom filter of the trigrams of one leaf's payload, upper cased as
+  for PayloadIndex.  If it says the payload doesn't contain a pattern,
+  it doesn't, with or without case.  If it says it might, it's wrong
+  about as often as the error rate we asked for, or more often if
+  max_size was too small for the payload.
+
+  Unlike the index, filters cost nothing to keep up to date beyond
+  the leaf that changed, and their size grows with the database rather
+  than with the number of distinct trigrams in it.
+*/
+class PayloadFilter {
+public:
+  PayloadFilter(const std::string &payload, const double error_rate,
+                const uint32_t max_size);
+  static boost::shared_ptr<const PayloadFilter>
+  parse(const std::string &data);
+
+  std::string data() const;
+  size_t size() const { return m_bits.size(); }
+  bool might_contain(const std::string &pattern) const;
+
+private:
+  PayloadFilter() : m_hashes(1) {}
+  size_t position(const uint64_t hash, const unsigned int i) const;
+
+  std::string m_bits;
+  unsigned int m_hashes;
+};
+
 /* ************************************************************ */
 /* LeafProxy */
 
@@ -229,6 +575,9 @@ public:
   LeafProxy(const std::string &password,
             const std::string base_name = std::string(),
             const std::string dir_name = std::string());
+  LeafProxy(const boost::shared_ptr<CipherContext> &cipher,
+            const std::string base_name = std::string(),
+            const std::string dir_name = std::string());
   /*
     Deleting the leaf pointer will cause the leaf to
     persist if appropriate.  It would be perverse to
@@ -268,10 +617,13 @@ public:
 
   void key_cache(const std::string &in) {
     cached_key = in;
+    cached_folded_key.clear();
     validate();
   }
   void key(const std::string &in_key);
   std::string key() const;
+  // The key, case folded, computed once per key.
+  const std::string &folded_key() const;
   void payload(const std::string &in_payload);
   std::string payload() const;
 
@@ -282,26 +634,58 @@ public:
   void commit();
   void erase();
 
+  void pack_location(const PackLocation &in);
+  const PackLocation &pack_location() const { return location; }
+  /*
+    A small leaf may live in the root rather than in a file of its
+    own, in which case we hold its key and payload, and the root
+    persists them.  Cf. Root::inline_leaves().
+  */
+  void set_inline(const std::string &in_key, const std::string &in_payload);
+  bool is_inline() const { return inlined; }
+  /*
+    If the root keeps them, a summary of the payload, so that a search
+    can rule the leaf out without loading it.  Changing the payload
+    drops it.  Cf. Root::filter_leaves().
+  */
+  void payload_filter(const boost::shared_ptr<const PayloadFilter> &in) {
+    filter = in;
+  }
+  const boost::shared_ptr<const PayloadFilter> &payload_filter() const {
+    return filter;
+  }
+  std::string cipher_text() const;
+  void unload() const;
+
   void validate(bool force_load = false) const;
 
 private:
   void init_leaf(bool do_load = true) const;
   void delete_leaf() const;
 
-  std::string password; // should be const but for operator=()
+  // Should be const but for operator=().
+  boost::shared_ptr<CipherContext> cipher;
 
   // input_base_name and input_dir_name exist to create
   // the leaf, but we consult the leaf for actual
   // values.
   std::string input_base_name;
   std::string input_dir_name;
+  PackLocation location;
   bool valid;
 
   // We cache the_leaf.key in cached_key so that we don't need to
   // load all leaves for what is likely the most common type of search.
   // This means that the root must persist the cached key value.
   std::string cached_key;
+  // Empty until folded_key() is called, and whenever cached_key changes.
+  mutable std::string cached_folded_key;
   mutable Leaf *the_leaf;
+
+  // If inlined, there is no leaf, and cached_key is the key.
+  bool inlined;
+  std::string inline_payload;
+  boost::shared_ptr<const PayloadFilter> filter;
 };
 
 /*
@@ -325,6 +709,136 @@ private:
   bool conjunction;
 };
 
+/* ************************************************************ */
+/* PayloadIndex */
+
+/*
+  Map each trigram (three consecutive bytes) of upper cased payloads
+  to the names of the leaves containing it.  A leaf whose payload
+  contains a pattern contains all of the pattern's trigrams, with or
+  without case, so the index tells us which leaves might match and
+  spares us loading the rest.
+*/
+class PayloadIndex {
+public:
+  typedef std::map<std::string, std::set<std::string>> Postings;
+
+  void add(const std::string &proxy_name, const std::string &payload);
+  void remove(const std::string &proxy_name);
+  void insert(const std::string &trigram, const std::string &proxy_name) {
+    m_postings[trigram].insert(proxy_name);
+  }
+  bool candidates(const std::string &pattern,
+                  std::set<std::string> &names) const;
+  const Postings &postings() const { return m_postings; }
+
+private:
+  Postings m_postings;
+};
+
+/* ************************************************************ */
+/* KeyIndex */
+
+/*
+  The leaves' keys, in order, each with the proxy name of its leaf, so
+  that listing leaves by key is a walk rather than a sort, and finding
+  a key prefix or range is a search.  Root keeps one up to date as
+  leaves come, go, and change key.
+
+  Several leaves may share a key.  They order by proxy name.
+*/
+class KeyIndex {
+public:
+  // A key and a proxy name.
+  typedef std::pair<std::string, std::string> Entry;
+  typedef std::set<Entry>::const_iterator const_iterator;
+  typedef std::pair<const_iterator, const_iterator> Range;
+
+  void set(const std::string &proxy_name, const std::string &key);
+  void remove(const std::string &proxy_name);
+  void clear();
+  size_t size() const { return m_entries.size(); }
+  const_iterator begin() const { return m_entries.begin(); }
+  const_iterator end() const { return m_entries.end(); }
+
+  Range prefix(const std::string &prefix) const;
+  Range range(const std::string &low, const std::string &high) const;
+  static std::string prefix_end(const std::string &prefix);
+
+private:
+  std::set<Entry> m_entries;
+  std::unordered_map<std::string, const_iterator> m_positions;
+};
+
+/* ************************************************************ */
+/* Search */
+
+/*
+  Case folding and case insensitive search, without copying what we
+  search.  We fold as UpperStringMatcher always has, to upper case in
+  the C locale.
+*/
+unsigned char fold_case(const unsigned char c);
+std::string fold_case(const std::string &text);
+bool equal_folded(const std::string &a, const std::string &b);
+
+/*
+  Substring search, with or without case.  We scan many bytes at a
+  time with the widest vector instructions the CPU has, or one byte
+  at a time if it has none we know.
+*/
+enum SearchKernel { SearchScalar, SearchSse2, SearchAvx2 };
+bool search_kernel_supported(const SearchKernel kernel);
+SearchKernel search_kernel();
+bool search_kernel(const SearchKernel kernel);
+size_t find_substring(const std::string &text, const std::string &pattern,
+                      const size_t from = 0);
+size_t find_folded(const std::string &text, const std::string &pattern,
+                   const size_t from = 0);
+
+/* ************************************************************ */
+/* PatternSet */
+
+/*
+  Find which of many patterns occur in a text in a single pass over
+  the text, however many patterns there are.  This is Aho-Corasick:
+  the patterns make a trie, and the trie's failure links are folded
+  into a table of transitions, one per state and byte.  A few
+  patterns we just look for one by one, with find_substring().
+
+  If fold_case, we ignore case as UpperStringMatcher does.
+*/
+class PatternSet {
+public:
+  PatternSet(const vector_string &patterns, const bool fold_case);
+
+  size_t size() const { return m_pattern_ids.size(); }
+  // Return true if text contains all (if all) or any of the patterns.
+  bool matches(const std::string &text, const bool all) const;
+  // Set found[i] to whether text contains pattern i, and return how
+  // many patterns it contains.
+  size_t find(const std::string &text, std::vector<char> &found) const;
+
+private:
+  int32_t add_state();
+  bool contains(const std::string &text, const uint32_t id) const;
+  size_t scan(const std::string &text, std::vector<char> &found,
+              const bool stop_at_first) const;
+
+  bool m_fold_case;
+  unsigned char m_fold[256];
+  // The distinct patterns, folded if m_fold_case.
+  vector_string m_patterns;
+  // The patterns' positions among distinct patterns, since matching
+  // one copy of a pattern matches all.
+  std::vector<uint32_t> m_pattern_ids;
+  uint32_t m_distinct;
+  // Transitions, 256 per state.  State 0 is the root.
+  std::vector<int32_t> m_next;
+  // The distinct patterns that end at each state.
+  std::vector<std::vector<uint32_t>> m_out;
+};
+
 /* ************************************************************ */
 /* LeafProxyMap */
 
@@ -360,6 +874,15 @@ struct StringMatcher {
     return false;
   };
   // virtual const int id() const { return 1; };
+  // If contains() is substring search, with or without regard to
+  // case, patterns may be compiled into a PatternSet instead.
+  virtual const bool substring() const { return false; }
+  virtual const bool folds_case() const { return false; }
+  // A string that any text containing pattern contains, perhaps
+  // empty, so that the payload index can narrow searches.
+  virtual const std::string literal(const std::string &pattern) const {
+    return std::string();
+  }
 };
 
 struct IdentStringMatcher : public StringMatcher {
@@ -369,7 +892,11 @@ struct IdentStringMatcher : public StringMatcher {
   }
   virtual const bool contains(const std::string &in_a,
                               const std::string &in_b) const {
-    return in_a.find(in_b) != std::string::npos;
+    return find_substring(in_a, in_b) != std::string::npos;
+  }
+  virtual const bool substring() const { return true; }
+  virtual const std::string literal(const std::string &pattern) const {
+    return pattern;
   }
   // virtual const int id() const { return 2; };
 };
@@ -377,17 +904,50 @@ struct IdentStringMatcher : public StringMatcher {
 struct UpperStringMatcher : public StringMatcher {
   virtual const bool operator()(const std::string &in_a,
                                 const std::string &in_b) const {
-    return boost::algorithm::to_upper_copy(in_a) ==
-           boost::algorithm::to_upper_copy(in_b);
+    return equal_folded(in_a, in_b);
   }
   virtual const bool contains(const std::string &in_a,
                               const std::string &in_b) const {
-    return boost::algorithm::to_upper_copy(in_a).find(
-               boost::algorithm::to_upper_copy(in_b)) != std::string::npos;
+    return find_folded(in_a, in_b) != std::string::npos;
+  }
+  virtual const bool substring() const { return true; }
+  virtual const bool folds_case() const { return true; }
+  virtual const std::string literal(const std::string &pattern) const {
+    return pattern;
   }
   // virtual const int id() const { return 3; };
 };
 
+/*
+  Match regular expressions (ECMAScript, with boost::regex): a key
+  matches exactly if the whole key matches.  We compile the patterns
+  we're given once, up front, and throw runtime_error if one won't
+  compile.  With each we keep a literal that every match contains,
+  so that a substring search can rule out most texts before we run
+  the regex.
+*/
+class RegexStringMatcher : public StringMatcher {
+public:
+  RegexStringMatcher(const vector_string &patterns, const bool case_sensitive);
+
+  // The text is in_a, the pattern in_b.
+  virtual const bool operator()(const std::string &in_a,
+                                const std::string &in_b) const;
+  virtual const bool contains(const std::string &in_a,
+                              const std::string &in_b) const;
+  virtual const std::string literal(const std::string &pattern) const;
+
+  static std::string required_literal(const std::string &pattern);
+
+private:
+  struct Compiled;
+  boost::shared_ptr<const Compiled> compiled(const std::string &pattern) const;
+  bool prefilter(const Compiled &pattern, const std::string &text) const;
+
+  const bool m_case_sensitive;
+  std::map<std::string, boost::shared_ptr<const Compiled>> m_compiled;
+};
+
 class LeafProxyMap {
   // public std::iterator<std::random_access_iterator_tag,
   // LeafProxyMapInternalType::value_type>
@@ -411,10 +971,14 @@ public:
   virtual ~LeafProxyMap(){};
 
   // Need copy and assignment operators due to the_map.
-  LeafProxyMap(const LeafProxyMap &lpm) { the_map = lpm.the_map; }
+  LeafProxyMap(const LeafProxyMap &lpm)
+      : payload_index(lpm.payload_index) {
+    the_map = lpm.the_map;
+  }
   LeafProxyMap &operator=(const LeafProxyMap &lpm) {
     LeafProxyMap temp(lpm);
     the_map.swap(temp.the_map);
+    payload_index = lpm.payload_index;
     return *this;
   }
 
@@ -449,10 +1013,93 @@ public:
   iterator end() { return the_map.end(); }
   const_iterator end() const { return the_map.end(); }
 
+protected:
+  // If set, the root's index, which filters pass on to their results.
+  boost::shared_ptr<PayloadIndex> payload_index;
+
 private:
+  friend class LeafQuery;
+  bool index_candidates(const srd::vector_string &patterns,
+                        const bool disjunction,
+                        std::set<std::string> &names) const;
+  LeafProxyMap subset(const std::vector<iterator> &leaves) const;
+
   LeafProxyMapInternalType the_map;
 };
 
+/* ************************************************************ */
+/* LeafQuery */
+
+/*
+  Find the leaves of a LeafProxyMap (usually the root) that satisfy
+  every one of some predicates, in a single pass over the map.
+
+  For each leaf, we try predicates on keys, which are cached, before
+  those on payloads, and ask the payload index, if any, before loading
+  anything.  A payload is loaded at most once, however many predicates
+  look at it.  Leaves are spread over our workers.
+
+  Results refer to the map's own entries rather than copying them, so
+  a leaf that matched stays loaded for whoever looks at it next.
+  Leaves we loaded that didn't match are unloaded.
+*/
+class LeafQuery {
+public:
+  typedef std::vector<LeafProxyMap::iterator> Results;
+
+  LeafQuery(LeafProxyMap &leaves, const StringMatcher &matcher);
+
+  // Keys that are (if exact) or contain any of patterns.
+  LeafQuery &keys(const vector_string &patterns, const bool exact);
+  // Payloads that contain all (or, if disjunction, any) of patterns.
+  LeafQuery &payloads(const vector_string &patterns, const bool disjunction);
+  // Keys as keys(), or payloads that contain any of patterns.
+  LeafQuery &keys_or_payloads(const vector_string &patterns,
+                              const bool exact);
+
+  // Only these leaves, in this order, rather than the whole map.
+  LeafQuery &within(const Results &leaves);
+
+  Results run(); // In map order, or that given within().
+
+  static void sort_by_key(Results &results);
+
+private:
+  // In the order we try them.
+  enum Kind { Keys, KeysOrPayloads, Payloads };
+  struct Predicate {
+    Kind kind;
+    vector_string patterns;
+    // If the matcher folds case, the patterns folded, once.
+    vector_string folded;
+    bool exact;       // For keys.
+    bool disjunction; // For payloads.
+    // If the index could narrow the search, the leaves it allows.
+    bool narrowed;
+    std::set<std::string> names;
+    // For payloads, what a text must contain to match each pattern.
+    vector_string literals;
+    // If the matcher allows, patterns compiled for contains().
+    boost::shared_ptr<PatternSet> compiled;
+  };
+
+  void add(const Kind kind, const vector_string &patterns, const bool exact,
+           const bool disjunction);
+  bool contains(const Predicate &predicate, const std::string &text,
+                const bool all) const;
+  bool key_matches(const Predicate &predicate, const std::string &key) const;
+  bool payload_matches(const Predicate &predicate,
+                       const std::string &payload) const;
+  bool filter_allows(const Predicate &predicate, const LeafProxy &proxy) const;
+  bool matches(LeafProxyMap::value_type &leaf) const;
+
+  LeafProxyMap &m_leaves;
+  const StringMatcher &m_matcher;
+  std::vector<Predicate> m_predicates;
+  bool m_within;
+  Results m_candidates;
+};
+
 /* ************************************************************ */
 /* Root */
 
@@ -484,19 +1131,122 @@ public:
   void rm_leaf(const std::string &proxy_key);
 
   Root change_password(const std::string &new_password);
+  void repack();
+  void inline_leaves(const uint32_t max_size);
+  void filter_leaves(const double error_rate, const uint32_t max_size);
+  uint32_t inline_max_size() const { return inline_max; }
+  void build_index();
+  bool refresh();
   void commit();
   void validate(bool force_load = false) const;
   void checksum(bool force_load = false) const;
+  const KeyIndex &key_index() const { return sorted_keys; }
+  void sort_by_key(LeafQuery::Results &leaves);
+  LeafQuery::Results keys_within(const vector_string &prefixes,
+                                 const std::string &low,
+                                 const std::string &high);
 
 private:
+  friend class RootBatch;
   void load();
+  void load_key(const RootData_KeyData &key_data);
+  void replay(const vector_string &records);
+  void save_key(const std::string &proxy_name, const std::string &key,
+                const LeafProxy &proxy, RootData_KeyData *key_data) const;
+  bool log_changes();
+  void leaf_changed(const std::string &proxy_name) {
+    changed.insert(proxy_name);
+    modified = true;
+  }
+  LeafProxy write_leaf(const std::string &proxy_key, const std::string &key,
+                       const std::string &payload);
+  bool fits_inline(const std::string &payload) const {
+    return inline_max > 0 && payload.size() <= inline_max;
+  }
+  void set_filter(LeafProxy &proxy, const std::string &payload) const;
+  bool has_file(const std::string &payload) const {
+    return !pack && !fits_inline(payload);
+  }
+  bool uses_file(const std::string &proxy_name) const;
+  void journal_leaves(const vector_string &leaves);
+  void settle();
+  void recover();
+  RootJournal read_journal(const std::string &record) const;
+  void keep_journal(const vector_string &records, const vector_string &kept);
 
   // Data members
   const std::string password;
+  // Shared with our leaves.
+  boost::shared_ptr<CipherContext> cipher;
+  // If set, new and modified leaves are written here rather than
+  // to their own files.
+  boost::shared_ptr<Pack> pack;
+  // Payloads of at most this many bytes live in the root.  If zero,
+  // none do.
+  uint32_t inline_max;
+  // Leaves carry payload filters with this false positive rate, of at
+  // most filter_max bytes.  If zero, they carry none.
+  double filter_rate;
+  uint32_t filter_max;
+  // Our leaves by key.  We persist leaves in this order, so loading
+  // it is a walk.
+  KeyIndex sorted_keys;
+  // Changes since we last wrote the root in full, and which we've yet
+  // to persist:  leaves added, changed, or removed, unless rewrite,
+  // in which case we can't just log them.
+  boost::shared_ptr<RootLog> log;
+  uint64_t generation;
+  uint64_t snapshot_size; // Bytes, as last written or read.
+  std::set<std::string> changed;
+  bool rewrite;
+  // Leaf files we're about to write or remove, so that if we stop
+  // before the root is persisted, the next load can remove those the
+  // root doesn't use.  Leaves we've removed from the root wait in
+  // doomed until it is persisted.
+  boost::shared_ptr<RootLog> journal;
+  bool journalled;
+  LeafProxyMap doomed;
   bool modified;
   bool valid; // if false, all operations except deletion should fail
 };
 
+/* ************************************************************ */
+/* RootBatch */
+
+/*
+  Stage changes to a root and apply them together:  commit() writes
+  the root once, however many leaves change, and either everything
+  takes effect or nothing does.  Staged changes that are never
+  committed are dropped.
+
+  A changed leaf is written anew and its old file removed only once
+  the root no longer refers to it, so that an interruption leaves the
+  database as it was.  Any files it leaves behind are in the root's
+  journal, and the next load removes them.
+*/
+class RootBatch {
+public:
+  RootBatch(Root &root);
+
+  void add_leaf(const std::string &key, const std::string &payload);
+  void set_leaf(const std::string &proxy_key, const std::string &key,
+                const std::string &payload);
+  void rm_leaf(const std::string &proxy_key);
+  size_t size() const { return m_adds.size() + m_sets.size() + m_rms.size(); }
+
+  void commit();
+
+private:
+  typedef std::pair<std::string, std::string> KeyPayload;
+
+  void stage_existing(const std::string &proxy_key);
+
+  Root &m_root;
+  std::vector<KeyPayload> m_adds;
+  std::map<std::string, KeyPayload> m_sets;
+  std::set<std::string> m_rms;
+};
+
 /* ************************************************************ */
 /* Lock */
 
@@ -518,6 +1268,27 @@ private:
 void file_create(const std::string &filename);
 bool file_exists(const std::string &filename);
 void file_rm(const std::string &filename);
+
+/* ************************************************************ */
+/* Session */
+
+/*
+  Split a command line into words, much as a shell would:  words
+  are separated by white space, which quotes ('' or "") and
+  backslash protect.  Throws runtime_error on unbalanced quotes.
+*/
+vector_string split_command_line(const std::string &line);
+
+/*
+  Listen on a UNIX socket at path, accepting one request (a line)
+  per connection and answering with what handler puts in response.
+  Only our own user may connect.  Return, removing the socket, when
+  handler returns false or on SIGINT or SIGTERM.
+*/
+void serve_unix_socket(
+    const std::string &path,
+    const std::function<bool(const std::string &request,
+                             std::string &response)> &handler);
 }
 
 #endif /* __SRD_H__*/
@@ -0,0 +1,121 @@
+/*
+  Copyright 2026  Jeff Abrahamson
+
+  This file is part of srd.
+
+  srd is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  srd is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with srd.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <atomic>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+
+#include "srd.h"
+
+using namespace srd;
+using namespace std;
+
+namespace {
+
+atomic<bool> stats_on(false);
+
+struct StageStats {
+  atomic<uint64_t> calls;
+  atomic<uint64_t> bytes;
+  atomic<uint64_t> nanoseconds;
+};
+
+// Zero initialized, being static.
+StageStats stage_stats[StageCount];
+atomic<uint64_t> counters[CounterCount];
+
+const char *const stage_names[StageCount] = {
+    "stat", "read", "decrypt", "decompress", "parse", "filter"};
+
+const char *const counter_names[CounterCount] = {
+    "Leaves in map",     "Keys examined", "Payloads examined",
+    "Payloads filtered", "Leaves loaded", "Leaf cache hits"};
+
+/*
+  Nanoseconds on a clock that never goes backwards.  Never zero, so
+  that zero can mean "not timing".
+*/
+uint64_t now() {
+  return 1 + chrono::duration_cast<chrono::nanoseconds>(
+                 chrono::steady_clock::now().time_since_epoch())
+                 .count();
+}
+}
+
+void srd::stats(const bool on) { stats_on = on; }
+
+bool srd::stats() { return stats_on.load(memory_order_relaxed); }
+
+void srd::stats_count(const Counter counter, const uint64_t n) {
+  if (stats())
+    counters[counter].fetch_add(n, memory_order_relaxed);
+}
+
+void srd::stats_set(const Counter counter, const uint64_t n) {
+  if (stats())
+    counters[counter].store(n, memory_order_relaxed);
+}
+
+uint64_t srd::stats_counter(const Counter counter) {
+  return counters[counter];
+}
+
+uint64_t srd::stats_calls(const Stage stage) {
+  return stage_stats[stage].calls;
+}
+
+void srd::stats_clear() {
+  for (int i = 0; i < StageCount; ++i) {
+    stage_stats[i].calls = 0;
+    stage_stats[i].bytes = 0;
+    stage_stats[i].nanoseconds = 0;
+  }
+  for (int i = 0; i < CounterCount; ++i)
+    counters[i] = 0;
+}
+
+/*
+  Write what we've counted, a line per stage and then a line per
+  counter.
+*/
+void srd::print_stats(ostream &out) {
+  out << left << setw(12) << "stage" << right << setw(10) << "calls"
+      << setw(14) << "bytes" << setw(12) << "seconds" << endl;
+  for (int i = 0; i < StageCount; ++i)
+    out << left << setw(12) << stage_names[i] << right << setw(10)
+        << stage_stats[i].calls << setw(14) << stage_stats[i].bytes
+        << setw(12) << fixed << setprecision(6)
+        << stage_stats[i].nanoseconds / 1e9 << endl;
+  for (int i = 0; i < CounterCount; ++i)
+    out << left << setw(20) << string(counter_names[i]) + ":" << right
+        << counters[i] << endl;
+}
+
+StageTimer::StageTimer(const Stage stage)
+    : m_stage(stage), m_bytes(0), m_start(stats() ? now() : 0) {}
+
+StageTimer::~StageTimer() {
+  if (!m_start)
+    return;
+  StageStats &stage = stage_stats[m_stage];
+  stage.calls.fetch_add(1, memory_order_relaxed);
+  stage.bytes.fetch_add(m_bytes, memory_order_relaxed);
+  stage.nanoseconds.fetch_add(now() - m_start, memory_order_relaxed);
+}
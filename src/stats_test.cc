@@ -0,0 +1,153 @@
+/*
+  Copyright 2026  Jeff Abrahamson
+
+  This file is part of srd.
+
+  srd is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  srd is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with srd.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include "srd.h"
+#include "test_text.h"
+
+using namespace srd;
+using namespace std;
+
+namespace {
+
+int expect(const string &what, const uint64_t got, const uint64_t want) {
+  if (got == want)
+    return 0;
+  cout << what << ":  got " << got << ", expected " << want << "." << endl;
+  return 1;
+}
+
+/*
+  Confirm that nothing is counted while stats are off.
+*/
+int test_off() {
+  int ret = 0;
+  stats(false);
+  stats_clear();
+  {
+    StageTimer timer(StageRead);
+    timer.bytes(100);
+  }
+  stats_count(CountLeavesLoaded);
+  stats_set(CountLeavesInMap, 10);
+  ret += expect("Calls while off", stats_calls(StageRead), 0);
+  ret += expect("Count while off", stats_counter(CountLeavesLoaded), 0);
+  ret += expect("Set while off", stats_counter(CountLeavesInMap), 0);
+  return ret;
+}
+
+/*
+  Confirm that timers and counters count, and that clearing clears.
+*/
+int test_on() {
+  int ret = 0;
+  stats(true);
+  stats_clear();
+  for (int i = 0; i < 3; ++i)
+    StageTimer timer(StageDecompress);
+  stats_count(CountKeysExamined, 5);
+  stats_count(CountKeysExamined);
+  stats_set(CountLeavesInMap, 10);
+  stats_set(CountLeavesInMap, 7);
+  ret += expect("Timer calls", stats_calls(StageDecompress), 3);
+  ret += expect("Other timer calls", stats_calls(StageDecrypt), 0);
+  ret += expect("Counted", stats_counter(CountKeysExamined), 6);
+  ret += expect("Set", stats_counter(CountLeavesInMap), 7);
+  stats_clear();
+  ret += expect("Cleared calls", stats_calls(StageDecompress), 0);
+  ret += expect("Cleared count", stats_counter(CountKeysExamined), 0);
+  stats(false);
+  return ret;
+}
+
+/*
+  Confirm that a payload search over a fresh root counts every leaf
+  in the map as loaded, and that searching again finds them cached.
+*/
+int test_loading() {
+  int ret = 0;
+  string password = pseudo_random_string(20);
+  vector_string messages = test_text();
+  {
+    Root root(password, "", true);
+    for (size_t i = 0; i < messages.size(); ++i) {
+      ostringstream key;
+      key << "key-" << i;
+      root.add_leaf(key.str(), messages[i], false);
+    }
+    root.commit();
+  }
+  leaf_cache().clear();
+  stats(true);
+  stats_clear();
+  Root root(password, "");
+  const vector_string patterns(1, "no such text");
+  root.filter_payloads(patterns, false, IdentStringMatcher());
+  ret += expect("Leaves in map", stats_counter(CountLeavesInMap),
+                messages.size());
+  ret += expect("Payloads examined", stats_counter(CountPayloadsExamined),
+                messages.size());
+  ret += expect("Leaves loaded", stats_counter(CountLeavesLoaded),
+                messages.size());
+  ret += expect("Cache hits", stats_counter(CountCacheHits), 0);
+  // The root and each leaf.
+  ret += expect("Decrypt calls", stats_calls(StageDecrypt),
+                messages.size() + 1);
+  ret += expect("Parse calls", stats_calls(StageParse), messages.size() + 1);
+  ret += expect("Filter calls", stats_calls(StageFilter), 1);
+
+  for (Root::iterator it = root.begin(); it != root.end(); ++it)
+    it->second.unload();
+  root.filter_payloads(patterns, false, IdentStringMatcher());
+  ret += expect("Leaves loaded again", stats_counter(CountLeavesLoaded),
+                messages.size());
+  ret += expect("Cache hits again", stats_counter(CountCacheHits),
+                messages.size());
+
+  ostringstream out;
+  print_stats(out);
+  if (string::npos == out.str().find("decompress") ||
+      string::npos == out.str().find("Leaves loaded:"))
+    ret += expect("Stats printed", 0, 1);
+  stats(false);
+  return ret;
+}
+}
+
+int main(int argc, char *argv[]) {
+  cout << "Testing stats.cpp" << endl;
+
+  mode(Verbose, false);
+  mode(Testing, true);
+  mode(ReadOnly, false);
+
+  int err_count = 0;
+  err_count += test_off();
+  err_count += test_on();
+  err_count += test_loading();
+
+  if (err_count)
+    cout << "Errors (" << err_count << ") in test!!" << endl;
+  else
+    cout << "All tests passed!" << endl;
+  return 0 != err_count;
+}
@@ -0,0 +1,30 @@
+#!/bin/bash
+
+# Test that records written with each codec we were built with read
+# back, alongside records written with the default codec.
+
+pass=$(date +%s.%N)
+echo setting pass=$pass for codec test.
+
+echo y | ./srd -T $pass --create --import test.d/import-animals
+expected=$(./srd -T $pass -m '' -f)
+
+for codec in zstd lz4; do
+    if ! ./srd -T $pass --codec $codec -m xyzzy > /dev/null 2>&1; then
+	echo $codec not built in, skipping.
+	continue
+    fi
+    # Rewrite the root with this codec, and add a record with it.
+    ./srd -T $pass --codec $codec --codec-level 3 -x cat
+    echo y | ./srd -T $pass --codec $codec --import test.d/import-animals \
+	> /dev/null
+    results=$(./srd -T $pass -m '' -f | sort -u)
+    sorted=$(echo "$expected" | sort -u)
+    if [ "$results" != "$sorted" ]; then
+	echo $codec test failed.
+	exit 1;
+    fi
+done
+
+# And clean up if all has gone well
+make clean-test
@@ -0,0 +1,49 @@
+#!/bin/bash
+
+# Test that data searches on a database with payload filters find
+# what they do without them, including after changes, and that
+# filters rule out records without loading them.
+
+pass=$(date +%s.%N)
+echo setting pass=$pass for filter test.
+
+echo y | ./srd -T $pass --create --import test.d/import-animals
+
+queries=("-d oo" "-d ers" "-d ERS" "-d ers -i" "-d o" "-d xyzzy"
+	 "-D ers" "-d ie -d ers -J" "-d bes -d hef" "-d ta -r" "-d h+ef -r")
+unfiltered=$(for q in "${queries[@]}"; do ./srd -T $pass $q -f; done)
+./srd -T $pass --filter 0.01 --filter-size 64
+results=$(for q in "${queries[@]}"; do ./srd -T $pass $q -f; done)
+if [ "$results" != "$unfiltered" ]; then
+    echo Filtered search test failed.
+    exit 1;
+fi
+
+filtered=$(./srd -T $pass -d xyzzy --stats 2>&1 | grep 'Payloads filtered:')
+if [ "${filtered##* }" != 4 ]; then
+    echo "Filters didn't rule out records:  $filtered"
+    exit 1;
+fi
+
+# New records get filters too, and deleted ones take theirs along.
+tmp_file=$(mktemp)
+printf '[bird]\n  sparrow\n' > $tmp_file
+echo y | ./srd -T $pass --import $tmp_file > /dev/null
+rm -f $tmp_file
+./srd -T $pass -x dog
+results=$(./srd -T $pass -d sparrow -k)
+filtered=$(./srd -T $pass -d xyzzy --stats 2>&1 | grep 'Payloads filtered:')
+if [ "$results" != "[bird]" -o "${filtered##* }" != 4 ]; then
+    echo "Filtered search after changes failed:  $results, $filtered"
+    exit 1;
+fi
+
+./srd -T $pass --filter 0
+filtered=$(./srd -T $pass -d xyzzy --stats 2>&1 | grep 'Payloads filtered:')
+if [ "${filtered##* }" != 0 ]; then
+    echo "Filters not removed:  $filtered"
+    exit 1;
+fi
+
+# And clean up if all has gone well
+make clean-test
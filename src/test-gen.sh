@@ -0,0 +1,31 @@
+#!/bin/bash
+
+# Test that generated databases have what we asked for, and that srd
+# reads them.
+
+pass=$(date +%s.%N)
+echo setting pass=$pass for generator test.
+
+./srd_gen -T $pass --create -n 300 --batch 128 --payload-size 10-5000/log
+./srd_gen -T $pass -n 20 --binary --key-size 12 --payload-size 1000
+results=$(./srd -T $pass -m '' -k | grep -c '^\[')
+if [ "$results" != 320 ]; then
+    echo Generator test failed, $results records.
+    exit 1;
+fi
+if ! ./srd -T $pass -V; then
+    echo Generated database failed to validate.
+    exit 1;
+fi
+
+# The same seed makes the same records.
+pass2=$pass.2
+./srd_gen -T $pass2 --create -n 300 --batch 128 --payload-size 10-5000/log
+if [ "$(./srd -T $pass -m '' -f | head -200)" != \
+     "$(./srd -T $pass2 -m '' -f | head -200)" ]; then
+    echo Generator seed test failed.
+    exit 1;
+fi
+
+# And clean up if all has gone well
+make clean-test
@@ -0,0 +1,35 @@
+#!/bin/bash
+
+# Test that data searches on an indexed database find what they do
+# without the index, including after changes.
+
+pass=$(date +%s.%N)
+echo setting pass=$pass for index test.
+
+echo y | ./srd -T $pass --create --import test.d/import-animals
+
+queries=("-d oo" "-d ers" "-d ERS" "-d ers -i" "-d o" "-d xyzzy"
+	 "-D ers" "-d ie -d ers -J" "-d bes -d hef")
+unindexed=$(for q in "${queries[@]}"; do ./srd -T $pass $q -f; done)
+./srd -T $pass --index
+results=$(for q in "${queries[@]}"; do ./srd -T $pass $q -f; done)
+if [ "$results" != "$unindexed" ]; then
+    echo Indexed search test failed.
+    exit 1;
+fi
+
+./srd -T $pass -x dog
+expected=$(./srd -T $pass -m '' -f | grep -c '^  ')
+results=$(./srd -T $pass -d '' -f | grep -c '^  ')
+if [ "$results" != "$expected" ]; then
+    echo Indexed delete test failed.
+    exit 1;
+fi
+results=$(./srd -T $pass -d collie)
+if [ "$results" != "" ]; then
+    echo Deleted record still indexed.
+    exit 1;
+fi
+
+# And clean up if all has gone well
+make clean-test
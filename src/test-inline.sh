@@ -0,0 +1,54 @@
+#!/bin/bash
+
+# Test that a database with small records inline in the root reads,
+# edits and deletes the same as one with a file per record.
+
+pass=$(date +%s.%N)
+echo setting pass=$pass for inline test.
+export EDITOR=./test_editor.sh
+
+# Import the animals, then inline all but the horses (the longest).
+echo y | ./srd -T $pass --create --import test.d/import-animals
+./srd -T $pass --inline 15
+
+results=$(./srd -T $pass -m '' -f)
+expected=$(cat test.d/output/animals-all)
+if [ "$results" != "$expected" ]; then
+    echo Inline conversion test failed.
+    exit 1;
+fi
+
+./srd -T $pass -x dog
+results=$(./srd -T $pass -m '' -f)
+expected=$(cat test.d/output/animals-no-dogs)
+if [ "$results" != "$expected" ]; then
+    echo Inline delete test failed.
+    exit 1;
+fi
+
+expected=$(./srd -T $pass cow | perl -pwe 's/cow/cowl/;')
+./srd -T $pass cow | perl -pwe 's/cow/cowl/; s/  //;' | ./srd -T $pass cow -e
+results=$(./srd -T $pass cowl)
+if [ "$results" != "$expected" ]; then
+    echo Inline edit test failed.
+    exit 1;
+fi
+
+# Packing leaves inline records alone, and moving everything back
+# out changes nothing.
+before=$(./srd -T $pass -m '' -f)
+./srd -T $pass --pack
+./srd -T $pass --inline 0
+results=$(./srd -T $pass -m '' -f)
+if [ "$results" != "$before" ]; then
+    echo Inline removal test failed.
+    exit 1;
+fi
+
+if ! ./srd -T $pass -V; then
+    echo Inline validation failed.
+    exit 1;
+fi
+
+# And clean up if all has gone well
+make clean-test
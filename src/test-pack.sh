@@ -0,0 +1,52 @@
+#!/bin/bash
+
+# Test that a database converted to a pack file reads, edits, deletes
+# and compacts the same as one with a file per record.
+
+pass=$(date +%s.%N)
+echo setting pass=$pass for pack test.
+export EDITOR=./test_editor.sh
+
+# Import the animals, then pack them
+echo y | ./srd -T $pass --create --import test.d/import-animals
+./srd -T $pass --pack
+
+results=$(./srd -T $pass -m '' -f)
+expected=$(cat test.d/output/animals-all)
+if [ "$results" != "$expected" ]; then
+    echo Pack conversion test failed.
+    exit 1;
+fi
+
+./srd -T $pass -x dog
+results=$(./srd -T $pass -m '' -f)
+expected=$(cat test.d/output/animals-no-dogs)
+if [ "$results" != "$expected" ]; then
+    echo Packed delete test failed.
+    exit 1;
+fi
+
+expected=$(./srd -T $pass cow | perl -pwe 's/cow/cowl/;')
+./srd -T $pass cow | perl -pwe 's/cow/cowl/; s/  //;' | ./srd -T $pass cow -e
+results=$(./srd -T $pass cowl)
+if [ "$results" != "$expected" ]; then
+    echo Packed edit test failed.
+    exit 1;
+fi
+
+# Compact, then make sure nothing changed.
+before=$(./srd -T $pass -m '' -f)
+./srd -T $pass --pack
+results=$(./srd -T $pass -m '' -f)
+if [ "$results" != "$before" ]; then
+    echo Pack compaction test failed.
+    exit 1;
+fi
+
+if ! ./srd -T $pass -V; then
+    echo Packed validation failed.
+    exit 1;
+fi
+
+# And clean up if all has gone well
+make clean-test
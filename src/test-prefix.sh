@@ -0,0 +1,38 @@
+#!/bin/bash
+
+# Test that --prefix, --from, and --before find what the equivalent
+# key searches find, alone and with other criteria.
+
+set -f
+pass=$(date +%s.%N)
+echo setting pass=$pass for prefix test.
+
+echo y | ./srd -T $pass --create --import test.d/import-animals
+
+check() {
+    results=$(./srd -T $pass -f $1)
+    expected=$(./srd -T $pass -f $2)
+    if [ -z "$expected" -o "$results" != "$expected" ]; then
+	echo "Prefix test failed: $1"
+	exit 1;
+    fi
+}
+
+check "--prefix c" "-m cat -m cow"
+check "--prefix ho --prefix d" "-m horse -m dog"
+check "--prefix c --prefix ca" "-m cat -m cow"
+check "--from cow --before horse" "-m cow -m dog"
+check "--from d" "-m dog -m horse"
+check "--before d" "-m cat -m cow"
+check "--prefix c --from co" "-m cow"
+check "--prefix c -m o" "-m cow"
+check "--prefix c -d bessie" "-d bessie"
+
+results=$(./srd -T $pass --prefix z --prefix C)
+if [ -n "$results" ]; then
+    echo "Prefix test failed: found \"$results\" with no matching keys."
+    exit 1;
+fi
+
+# And clean up if all has gone well
+make clean-test
@@ -0,0 +1,43 @@
+#!/bin/bash
+
+# Test that -r,--regex matches what the equivalent literal searches
+# match, with and without case, exactly, and on an indexed database.
+
+# Patterns go unquoted through check(), so don't glob them.
+set -f
+pass=$(date +%s.%N)
+echo setting pass=$pass for regex test.
+
+echo y | ./srd -T $pass --create --import test.d/import-animals
+
+check() {
+    results=$(./srd -T $pass -f $1)
+    expected=$(./srd -T $pass -f $2)
+    if [ -z "$expected" -o "$results" != "$expected" ]; then
+	echo "Regex test failed: $1"
+	exit 1;
+    fi
+}
+
+run_checks() {
+    check "-r -m ^c" "-m cat -m cow"
+    check "-r -E -m c.t" "-E -m cat"
+    check "-r -E -m C.T -i" "-E -m cat"
+    check "-r -d b.ss" "-d bessie"
+    check "-r -d P[a-z]+E -i" "-d poodle"
+    check "-r -d tab+y -d hef+er -J" "-d tabby -d heffer -J"
+    check "-r -d l+i -D ^d" "-d collie -D dog"
+}
+
+run_checks
+./srd -T $pass --index
+run_checks
+
+results=$(./srd -T $pass -r -m '(' 2>&1)
+if [ "${results#Bad regular expression}" = "$results" ]; then
+    echo Bad regex test failed.
+    exit 1;
+fi
+
+# And clean up if all has gone well
+make clean-test
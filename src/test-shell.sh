@@ -0,0 +1,37 @@
+#!/bin/bash
+
+# Test that a shell session answers queries as separate runs would,
+# and that it notices changes made by other processes.
+
+pass=$(date +%s.%N)
+echo setting pass=$pass for shell test.
+
+echo y | ./srd -T $pass --create --import test.d/import-animals
+
+expected=$(./srd -T $pass -m '' -f; ./srd -T $pass dog; ./srd -T $pass -d o -k)
+results=$(printf '%s\n' "-m '' -f" "" "dog" "-d o -k" | ./srd -T $pass -s)
+if [ "$results" != "$expected" ]; then
+    echo Shell query test failed.
+    exit 1;
+fi
+
+# Delete in one process while the shell is running, then delete in
+# the shell and make sure other processes see that.
+before=$(./srd -T $pass -m '')
+results=$( (echo "-m ''"; sleep 1; ./srd -T $pass -x dog > /dev/null;
+	    echo "-m ''"; echo "-x cat"; echo quit; echo "-m ''") |
+	   ./srd -T $pass -s)
+after=$(./srd -T $pass -m '')
+expected=$(echo "$before"; grep '^\[' test.d/output/animals-no-dogs)
+if [ "$results" != "$expected" ]; then
+    echo Shell external modification test failed.
+    exit 1;
+fi
+expected=$(grep '^\[' test.d/output/animals-no-cats)
+if [ "$after" != "$expected" ]; then
+    echo Shell deletion test failed.
+    exit 1;
+fi
+
+# And clean up if all has gone well
+make clean-test
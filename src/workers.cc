@@ -0,0 +1,88 @@
+/*
+  Copyright 2026  Jeff Abrahamson
+
+  This file is part of srd.
+
+  srd is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  srd is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with srd.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "srd.h"
+
+using namespace srd;
+using namespace std;
+
+namespace {
+unsigned int the_worker_count = 1;
+}
+
+void srd::worker_count(const unsigned int count) { the_worker_count = count; }
+
+/*
+  Return the number of threads to use, resolving zero to the number
+  of processors.
+*/
+unsigned int srd::worker_count() {
+  if (0 == the_worker_count)
+    return max(1U, thread::hardware_concurrency());
+  return the_worker_count;
+}
+
+/*
+  The calling thread works too, so we start one fewer thread than
+  we use.  Work is handed out one index at a time:  leaves vary
+  enormously in size, so equal shares would leave threads idle.
+*/
+void srd::parallel_for(const size_t n, const function<void(size_t)> &fn) {
+  size_t thread_count = min(static_cast<size_t>(worker_count()), n);
+  if (thread_count <= 1) {
+    for (size_t i = 0; i < n; ++i)
+      fn(i);
+    return;
+  }
+
+  atomic<size_t> next(0);
+  exception_ptr first_error;
+  mutex error_mutex;
+  auto work = [&]() {
+    size_t i;
+    while ((i = next++) < n) {
+      try {
+        fn(i);
+      } catch (...) {
+        lock_guard<mutex> guard(error_mutex);
+        if (!first_error)
+          first_error = current_exception();
+        next = n; // No point doing more.
+      }
+    }
+  };
+
+  vector<thread> threads;
+  for (size_t t = 1; t < thread_count; ++t)
+    threads.push_back(thread(work));
+  work();
+  for (vector<thread>::iterator it = threads.begin(); it != threads.end();
+       ++it)
+    it->join();
+  if (first_error)
+    rethrow_exception(first_error);
+}
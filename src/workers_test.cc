@@ -0,0 +1,146 @@
+/*
+  Copyright 2026  Jeff Abrahamson
+
+  This file is part of srd.
+
+  srd is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  srd is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with srd.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "srd.h"
+#include "test_text.h"
+
+using namespace srd;
+using namespace std;
+
+namespace {
+
+/*
+  Confirm that every index is visited exactly once.
+*/
+int test_parallel_for(const unsigned int count, const size_t n) {
+  worker_count(count);
+  vector<atomic<int>> visits(n);
+  for (size_t i = 0; i < n; ++i)
+    visits[i] = 0;
+  parallel_for(n, [&](size_t i) { visits[i]++; });
+  for (size_t i = 0; i < n; ++i)
+    if (1 != visits[i]) {
+      cout << "parallel_for(" << n << ") with " << count
+           << " workers visited " << i << " " << visits[i] << " times."
+           << endl;
+      return 1;
+    }
+  return 0;
+}
+
+/*
+  Confirm that an exception in a worker reaches the caller.
+*/
+int test_parallel_for_throws() {
+  worker_count(4);
+  try {
+    parallel_for(100, [](size_t i) {
+      if (17 == i)
+        throw(runtime_error("seventeen"));
+    });
+  } catch (const runtime_error &e) {
+    if (string("seventeen") == e.what())
+      return 0;
+  }
+  cout << "parallel_for() lost an exception." << endl;
+  return 1;
+}
+
+/*
+  Confirm that parallel payload filters find the same leaves as
+  serial ones.
+*/
+int test_parallel_filter() {
+  int ret = 0;
+  string password = pseudo_random_string(20);
+  Root root(password, "", true);
+  vector_string messages = test_text();
+  for (int copy = 0; copy < 10; ++copy)
+    for (vector_string::iterator it = messages.begin(); it != messages.end();
+         ++it) {
+      ostringstream key;
+      key << copy << "-" << it->size();
+      root.add_leaf(key.str(), *it, false);
+    }
+  root.commit();
+
+  vector_string patterns;
+  patterns.push_back("forest");
+  patterns.push_back("the");
+  worker_count(1);
+  LeafProxyMap serial_and =
+      root.filter_payloads(patterns, false, IdentStringMatcher());
+  LeafProxyMap serial_or =
+      root.filter_keys_or_payloads(patterns, false, IdentStringMatcher());
+  worker_count(8);
+  LeafProxyMap parallel_and =
+      root.filter_payloads(patterns, false, IdentStringMatcher());
+  LeafProxyMap parallel_or =
+      root.filter_keys_or_payloads(patterns, false, IdentStringMatcher());
+  if (serial_and.size() != parallel_and.size() ||
+      !equal(serial_and.begin(), serial_and.end(), parallel_and.begin(),
+             [](const LeafProxyMap::value_type &a,
+                const LeafProxyMap::value_type &b) {
+               return a.first == b.first;
+             })) {
+    cout << "Parallel payload filter differs from serial." << endl;
+    ret++;
+  }
+  if (serial_or.size() != parallel_or.size()) {
+    cout << "Parallel key or payload filter differs from serial." << endl;
+    ret++;
+  }
+  if (0 == serial_and.size()) {
+    cout << "Payload filter found nothing." << endl;
+    ret++;
+  }
+  return ret;
+}
+}
+
+int main(int argc, char *argv[]) {
+  cout << "Testing workers.cpp" << endl;
+
+  mode(Verbose, false);
+  mode(Testing, true);
+  mode(ReadOnly, false);
+
+  int err_count = 0;
+  err_count += test_parallel_for(1, 1000);
+  err_count += test_parallel_for(4, 0);
+  err_count += test_parallel_for(4, 3);
+  err_count += test_parallel_for(8, 10000);
+  err_count += test_parallel_for(0, 1000);
+  err_count += test_parallel_for_throws();
+  err_count += test_parallel_filter();
+
+  if (err_count)
+    cout << "Errors (" << err_count << ") in test!!" << endl;
+  else
+    cout << "All tests passed!" << endl;
+  return 0 != err_count;
+}